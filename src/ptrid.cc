@@ -1,21 +1,162 @@
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <vector>
 
 #include "ptrid_lib/readers.h"
+#include "ptrid_lib/batch_scorer.h"
 #include "ptrid_lib/probabilistic_scheme.h"
 #include "ptrid_lib/markov_chain.h"
+#include "ptrid_lib/likelihood_model.h"
+#include "ptrid_lib/quantized_model.h"
+#include "ptrid_lib/ngrams.h"
 #include "ptrid_lib/math_func.h"
 
 #define MARKOV_CHAIN
 // #define CHISQ
 // #define INFO_DISTANCE
 
+/* number of threads reading directories of types, set by --threads */
+size_t count_threads = 1;
+/* length of n-grams of the Markov chain, set by --deep */
+int deep = 2;
+/* width of codes of quantized models ("16" or "8"), set by --quantize,
+   empty - models of doubles */
+std::string quantize;
+/* pairs scored between checks of early exit, set by --early-exit, 0 - the
+   whole file is scored */
+size_t early_exit_chunk = 0;
+
 #if defined(MARKOV_CHAIN)
 
+/* using likelihood function of a chain of order deep - 1 */
+void PrintTypeByNGrams(std::string& name_path, char** paths_to_types, int count_types) {
+	std::vector<long double> results(count_types);
+	ptrid::ReaderBytes reader(deep);
+	reader.SetCountThreads(count_threads);
+	reader.Read(name_path);
+	ptrid::NGramTable ngrams = reader.GetNGrams();
+	for (int i = 0; i < count_types; i++) {
+		reader.Clean();
+		reader.Read(paths_to_types[i]);
+		ptrid::NGramMarkovChain chain_type(deep, reader.GetNGrams());
+		ngrams.ForEach([&](uint64_t ngram, uint32_t count) {
+			results[i] += (long double)count * log10l(chain_type.GetProbability(ngram));
+		});
+	}
+
+	size_t max = 0;
+	for (size_t i = 1; i < count_types; i++) {
+		if (results[i] > results[max]) {
+			max = i;
+		}
+	}
+	std::cout << "Type: " << max + 1 << " (MC" << deep - 1 << ")" << std::endl;
+}
+
+/* using likelihood function of quantized models, the result is compared
+   with the likelihood in long double */
+void PrintTypeQuantized(std::string& name_path, char** paths_to_types, int count_types) {
+	std::vector<long double> results(count_types), baseline(count_types);
+	ptrid::ReaderBytes reader(2);
+	reader.SetCountThreads(count_threads);
+	reader.Read(name_path);
+	std::vector<uint32_t> frequencies = reader.GetFrequencies();
+	for (int i = 0; i < count_types; i++) {
+		reader.Clean();
+		reader.Read(paths_to_types[i]);
+		ptrid::ProbabilisticScheme scheme(2, 256, reader.GetFrequencies());
+		scheme.useAdditiveSmoothing(1000);
+		ptrid::MarkovChain chain_type(std::move(scheme));
+		ptrid::QuantizedModel model_type(ptrid::LikelihoodModel(chain_type),
+																		 ptrid::GetQuantizedWidth(quantize));
+		results[i] = model_type.Score(frequencies);
+		for (size_t from = 0; from < 256; from++)
+			for (size_t to = 0; to < 256; to++)
+				if (frequencies[from + to * 256] != 0)
+					baseline[i] += (long double)frequencies[from + to * 256] *
+												 log10l(chain_type.GetProbability(from, to));
+	}
+
+	size_t max = 0, max_baseline = 0;
+	long double max_error = 0.;
+	for (size_t i = 0; i < count_types; i++) {
+		if (results[i] > results[max])
+			max = i;
+		if (baseline[i] > baseline[max_baseline])
+			max_baseline = i;
+		if (baseline[i] != 0.)
+			max_error = std::max(max_error, fabsl((results[i] - baseline[i]) / baseline[i]));
+	}
+	std::cout << "Type: " << max + 1 << " (MC, " << quantize << "-bit)" << std::endl
+						<< "Type in long double: " << max_baseline + 1
+						<< ", max relative error of likelihoods: " << max_error << std::endl;
+}
+
+/* using likelihood function, stops once no type can overtake the leader
+   within the rest of the file */
+void PrintTypeEarly(std::string& name_path, char** paths_to_types, int count_types) {
+	ptrid::ReaderBytes reader(2);
+	reader.SetCountThreads(count_threads);
+	std::vector<ptrid::LikelihoodModel> models;
+	for (int i = 0; i < count_types; i++) {
+		reader.Clean();
+		reader.Read(paths_to_types[i]);
+		ptrid::ProbabilisticScheme scheme(2, 256, reader.GetFrequencies());
+		scheme.useAdditiveSmoothing(1000);
+		models.emplace_back(ptrid::MarkovChain(std::move(scheme)));
+	}
+	ptrid::BatchScorer scorer;
+	scorer.Create(models);
+
+	/* a mapped file is scored in place, blocks of pipes and special files
+	   are gathered */
+	size_t size_file = 0;
+	std::vector<uint8_t> data;
+	ptrid::EarlyExitResult result;
+	bool is_mapped = false;
+	if (!ptrid::ReaderBytes::FeedFileMapped(
+					name_path,
+					[&](const uint8_t *block, size_t len) {
+						if (is_mapped) {
+							size_file = len;
+							result = scorer.GetBestEarly(block, len, early_exit_chunk, true);
+						} else {
+							data.insert(data.end(), block, block + len);
+						}
+					},
+					&is_mapped))
+		throw std::runtime_error("PrintTypeEarly: couldn't read " + name_path + " - " +
+														 strerror(errno) + " (--early-exit takes a file)");
+	if (!is_mapped) {
+		size_file = data.size();
+		result = scorer.GetBestEarly(data.data(), data.size(), early_exit_chunk, true);
+	}
+	std::cout << "Type: " << result.type + 1 << " (MC)" << std::endl
+						<< "Scored " << result.consumed << " of " << size_file << " bytes"
+						<< std::endl;
+}
+
 /* using likelihood function */
 void PrintType(std::string& name_path, char** paths_to_types, int count_types) {
+	if (deep > 2) {
+		PrintTypeByNGrams(name_path, paths_to_types, count_types);
+		return;
+	}
+	if (!quantize.empty()) {
+		PrintTypeQuantized(name_path, paths_to_types, count_types);
+		return;
+	}
+	if (early_exit_chunk > 0) {
+		PrintTypeEarly(name_path, paths_to_types, count_types);
+		return;
+	}
 	std::vector<long double> results(count_types);
 	ptrid::ReaderBytes reader(2);
+	reader.SetCountThreads(count_threads);
 	reader.Read(name_path);
 	std::vector<uint32_t> frequencies = reader.GetFrequencies();
 	for (int i = 0; i < count_types; i++) {
@@ -23,15 +164,8 @@ void PrintType(std::string& name_path, char** paths_to_types, int count_types) {
 		reader.Read(paths_to_types[i]);
 		ptrid::ProbabilisticScheme scheme(2, 256, reader.GetFrequencies());
 		scheme.useAdditiveSmoothing(1000);
-		ptrid::MarkovChain chain_type(scheme);
-		for (size_t from = 0; from < 256; from++) {
-			for (size_t to = 0; to < 256; to++) {
-				if (frequencies[from + to * 256] != 0) {
-					results[i] += (long double)frequencies[from + to * 256] *
-								  log10l(chain_type.GetProbability(from, to));
-				}
-			}
-		}
+		ptrid::LikelihoodModel model_type(ptrid::MarkovChain(std::move(scheme)));
+		results[i] = model_type.Score(frequencies);
 	}
 
 	size_t max = 0;
@@ -49,6 +183,7 @@ void PrintType(std::string& name_path, char** paths_to_types, int count_types) {
 void PrintType(std::string& name_path, char** paths_to_types, int count_types) {
 	std::vector<long double> results(count_types);
 	ptrid::ReaderBytes reader(2);
+	reader.SetCountThreads(count_threads);
 	reader.Read(name_path);
 	ptrid::ProbabilisticScheme scheme_file(2, 256, reader.GetFrequencies());
 	scheme_file.useAdditiveSmoothing(10000);
@@ -76,6 +211,7 @@ void PrintType(std::string& name_path, char** paths_to_types, int count_types) {
 void PrintType(std::string& name_path, char** paths_to_types, int count_types) {
 	std::vector<long double> results(count_types);
 	ptrid::ReaderBytes reader(2);
+	reader.SetCountThreads(count_threads);
 	reader.Read(name_path);
 	ptrid::ProbabilisticScheme scheme_file(2, 256, reader.GetFrequencies());
 	scheme_file.useAdditiveSmoothing(1000); 
@@ -102,8 +238,46 @@ void PrintType(std::string& name_path, char** paths_to_types, int count_types) {
 #endif
 
 int main(int argc, char** argv) {
-	if (argc == 1) {
-		std::cout << "Usage: ptrid PATH_TO_DIR_WITH_TYPE_1 ... "
+	int first_type = 1;
+	while (first_type + 1 < argc && (std::string(argv[first_type]) == "--threads" ||
+																	 std::string(argv[first_type]) == "--deep" ||
+																	 std::string(argv[first_type]) == "--quantize" ||
+																	 std::string(argv[first_type]) == "--early-exit")) {
+		std::string option = argv[first_type];
+		try {
+			if (option == "--threads")
+				count_threads = std::stoul(argv[first_type + 1]);
+			else if (option == "--deep")
+				deep = std::stoi(argv[first_type + 1]);
+			else if (option == "--early-exit")
+				early_exit_chunk = std::stoul(argv[first_type + 1]);
+			else
+				quantize = argv[first_type + 1];
+		} catch (std::exception &e) {
+			std::cerr << "Error: " << option << " needs a number" << std::endl;
+			return 1;
+		}
+		first_type += 2;
+	}
+	if (!quantize.empty() && quantize != "16" && quantize != "8") {
+		std::cerr << "Error: --quantize must be 16 or 8" << std::endl;
+		return 1;
+	}
+	if (deep < 2 || deep > ptrid::kMaxDeep) {
+		std::cerr << "Error: --deep must be from 2 to " << (int)ptrid::kMaxDeep << std::endl;
+		return 1;
+	}
+	if (deep > 2 && (!quantize.empty() || early_exit_chunk > 0)) {
+		std::cerr << "Error: --deep above 2 can't be used with --quantize or --early-exit" << std::endl;
+		return 1;
+	}
+	if (!quantize.empty() && early_exit_chunk > 0) {
+		std::cerr << "Error: --quantize can't be used with --early-exit" << std::endl;
+		return 1;
+	}
+
+	if (argc == first_type) {
+		std::cout << "Usage: ptrid [--threads N] [--deep N] [--quantize {16, 8}] [--early-exit PAIRS] PATH_TO_DIR_WITH_TYPE_1 ... "
 				"[PATH_TO_DIR_WITH_TYPE_N]"
 			 << std::endl;
 		return 0;
@@ -118,7 +292,7 @@ int main(int argc, char** argv) {
 		while (sInputPath != std::string("exit")) {
 			if (ptrid::ReaderBytes::CheckTypeOfFile(sInputPath) == S_IFREG) {
 				try {
-					PrintType(sInputPath, argv + 1, argc - 1);
+					PrintType(sInputPath, argv + first_type, argc - first_type);
 				} catch (std::exception &e) {
 					std::cout << "Couldn't read the file" << std::endl;
 				}
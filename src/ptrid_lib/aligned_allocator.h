@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <new>
+
+namespace ptrid {
+
+/* Size of a cache line, tables walked by scoring loops start on it. */
+constexpr size_t kCacheLine = 64;
+
+/* Allocator of std::vector, which places elements on @Alignment bytes. */
+template <class T, size_t Alignment = kCacheLine>
+struct AlignedAllocator {
+	using value_type = T;
+
+	template <class U>
+	struct rebind {
+		using other = AlignedAllocator<U, Alignment>;
+	};
+
+	AlignedAllocator() = default;
+
+	template <class U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+	T *allocate(size_t n) {
+		/* aligned_alloc wants the size to be a multiple of the alignment */
+		size_t size = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+		void *memory = aligned_alloc(Alignment, size);
+		if (!memory) throw std::bad_alloc();
+		return (T *)memory;
+	}
+
+	void deallocate(T *memory, size_t) { free(memory); }
+
+	template <class U>
+	bool operator==(const AlignedAllocator<U, Alignment> &) const {
+		return true;
+	}
+};
+
+}	 // namespace ptrid
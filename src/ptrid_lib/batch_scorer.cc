@@ -0,0 +1,509 @@
+#include "batch_scorer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+namespace ptrid {
+
+namespace {
+
+/* Adds @weight times the row of values of types of a cell to @scores.
+   Rows are padded to the number of lanes, so the inner loop is a whole
+   number of vectors. */
+__attribute__((always_inline)) inline void AddRow(const double *__restrict row,
+																									double weight, size_t stride,
+																									double *__restrict scores) {
+	for (size_t type = 0; type < stride; type += BatchScorer::kCountLanes)
+		for (size_t lane = 0; lane < BatchScorer::kCountLanes; lane++)
+			scores[type + lane] += weight * row[type + lane];
+}
+
+/* Weight of a non-zero cell with @count in the expanded metric. The
+   metric is a template argument, so loops over cells don't branch on it. */
+template <BatchMetric Metric>
+__attribute__((always_inline)) inline double GetWeight(uint32_t count, double koef) {
+	if constexpr (Metric == BatchMetric::kLikelihood)
+		return count;
+	else if constexpr (Metric == BatchMetric::kInfoDistance)
+		return std::log2(koef * count);
+	else
+		return koef * count * koef * count - 1.;
+}
+
+/* Returns the sum of smoothed numerators of the sample. Only @touched
+   cells are visited if they are given. */
+template <BatchMetric Metric>
+__attribute__((always_inline)) inline double AddCells(
+		double koef, const double *table, size_t stride,
+		std::span<const uint32_t> frequencies, const uint32_t *touched,
+		size_t count_touched, double *scores) {
+	double denominator = 0.;
+	if (touched) {
+		denominator = frequencies.size() - count_touched;
+		for (size_t i = 0; i < count_touched; i++) {
+			uint32_t count = frequencies[touched[i]];
+			denominator += koef * count;
+			AddRow(table + touched[i] * stride, GetWeight<Metric>(count, koef), stride, scores);
+		}
+		return denominator;
+	}
+	for (size_t cell = 0; cell < frequencies.size(); cell++) {
+		uint32_t count = frequencies[cell];
+		if (count == 0) {
+			denominator += 1.;
+			continue;
+		}
+		denominator += koef * count;
+		AddRow(table + cell * stride, GetWeight<Metric>(count, koef), stride, scores);
+	}
+	return denominator;
+}
+
+/* Adds the rows of consecutive pairs of @data, a pair seen twice is added
+   twice, as its count would be. */
+__attribute__((always_inline)) inline void AddPairs(const double *table, size_t stride,
+																										const uint8_t *data, size_t len,
+																										double *scores) {
+	for (size_t i = 0, j = 1; j < len; i++, j++)
+		AddRow(table + (data[i] + data[j] * 256) * stride, 1., stride, scores);
+}
+
+/* Adds pairs of @data to the sums of a session of kInfoDistance or kChi2:
+   the term of a cell is replaced by the term of its new count. Returns the
+   change of the sum of smoothed numerators. */
+template <BatchMetric Metric>
+__attribute__((always_inline)) inline double AddCountedPairs(
+		double koef, const double *table, size_t stride, const uint8_t *data,
+		size_t len, NGramTable &counts, double *scores) {
+	double denominator = 0.;
+	for (size_t i = 0, j = 1; j < len; i++, j++) {
+		size_t cell = data[i] + data[j] * 256;
+		uint32_t count = counts.Add(cell);
+		double weight = GetWeight<Metric>(count, koef);
+		if (count > 1) {
+			weight -= GetWeight<Metric>(count - 1, koef);
+			denominator += koef;
+		} else {
+			denominator += koef - 1.;
+		}
+		AddRow(table + cell * stride, weight, stride, scores);
+	}
+	return denominator;
+}
+
+void AddPairsScalar(const double *table, size_t stride, const uint8_t *data,
+										size_t len, double *scores) {
+	AddPairs(table, stride, data, len, scores);
+}
+
+template <BatchMetric Metric>
+double AddCountedPairsScalar(double koef, const double *table, size_t stride,
+														 const uint8_t *data, size_t len, NGramTable &counts,
+														 double *scores) {
+	return AddCountedPairs<Metric>(koef, table, stride, data, len, counts, scores);
+}
+
+template <BatchMetric Metric>
+double AddCellsScalar(double koef, const double *table, size_t stride,
+											std::span<const uint32_t> frequencies, const uint32_t *touched,
+											size_t count_touched, double *scores) {
+	return AddCells<Metric>(koef, table, stride, frequencies, touched, count_touched, scores);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* The same loop compiled for the wider ISA, as the kernels of histogram. */
+template <BatchMetric Metric>
+__attribute__((target("avx2,fma"))) double AddCellsAvx2(
+		double koef, const double *table, size_t stride,
+		std::span<const uint32_t> frequencies, const uint32_t *touched,
+		size_t count_touched, double *scores) {
+	return AddCells<Metric>(koef, table, stride, frequencies, touched, count_touched, scores);
+}
+
+template <BatchMetric Metric>
+__attribute__((target("avx512f"))) double AddCellsAvx512(
+		double koef, const double *table, size_t stride,
+		std::span<const uint32_t> frequencies, const uint32_t *touched,
+		size_t count_touched, double *scores) {
+	return AddCells<Metric>(koef, table, stride, frequencies, touched, count_touched, scores);
+}
+
+__attribute__((target("avx2,fma"))) void AddPairsAvx2(const double *table,
+																											 size_t stride,
+																											 const uint8_t *data,
+																											 size_t len, double *scores) {
+	AddPairs(table, stride, data, len, scores);
+}
+
+__attribute__((target("avx512f"))) void AddPairsAvx512(const double *table,
+																											size_t stride,
+																											const uint8_t *data,
+																											size_t len, double *scores) {
+	AddPairs(table, stride, data, len, scores);
+}
+
+template <BatchMetric Metric>
+__attribute__((target("avx2,fma"))) double AddCountedPairsAvx2(
+		double koef, const double *table, size_t stride, const uint8_t *data,
+		size_t len, NGramTable &counts, double *scores) {
+	return AddCountedPairs<Metric>(koef, table, stride, data, len, counts, scores);
+}
+
+template <BatchMetric Metric>
+__attribute__((target("avx512f"))) double AddCountedPairsAvx512(
+		double koef, const double *table, size_t stride, const uint8_t *data,
+		size_t len, NGramTable &counts, double *scores) {
+	return AddCountedPairs<Metric>(koef, table, stride, data, len, counts, scores);
+}
+
+#endif
+
+/* The ISA is chosen once per call, out of the loop over cells. */
+void AddPairsBy(HistogramKernel kernel, const double *table, size_t stride,
+								const uint8_t *data, size_t len, double *scores) {
+	switch (kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+		case HistogramKernel::kAvx2:
+			AddPairsAvx2(table, stride, data, len, scores);
+			return;
+		case HistogramKernel::kAvx512:
+			AddPairsAvx512(table, stride, data, len, scores);
+			return;
+#endif
+		default:
+			AddPairsScalar(table, stride, data, len, scores);
+	}
+}
+
+template <BatchMetric Metric>
+double AddCellsBy(HistogramKernel kernel, double koef, const double *table,
+									size_t stride, std::span<const uint32_t> frequencies,
+									const uint32_t *touched, size_t count_touched, double *scores) {
+	switch (kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+		case HistogramKernel::kAvx2:
+			return AddCellsAvx2<Metric>(koef, table, stride, frequencies, touched,
+																	count_touched, scores);
+		case HistogramKernel::kAvx512:
+			return AddCellsAvx512<Metric>(koef, table, stride, frequencies, touched,
+																		count_touched, scores);
+#endif
+		default:
+			return AddCellsScalar<Metric>(koef, table, stride, frequencies, touched,
+																		count_touched, scores);
+	}
+}
+
+template <BatchMetric Metric>
+double AddCountedPairsBy(HistogramKernel kernel, double koef, const double *table,
+												 size_t stride, const uint8_t *data, size_t len,
+												 NGramTable &counts, double *scores) {
+	switch (kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+		case HistogramKernel::kAvx2:
+			return AddCountedPairsAvx2<Metric>(koef, table, stride, data, len, counts, scores);
+		case HistogramKernel::kAvx512:
+			return AddCountedPairsAvx512<Metric>(koef, table, stride, data, len, counts, scores);
+#endif
+		default:
+			return AddCountedPairsScalar<Metric>(koef, table, stride, data, len, counts, scores);
+	}
+}
+
+}	 // namespace
+
+void BatchScorer::Resize(BatchMetric metric, size_t count_types, size_t size_scheme) {
+	metric_ = metric;
+	count_types_ = count_types;
+	size_scheme_ = size_scheme;
+	stride_ = (count_types + kCountLanes - 1) / kCountLanes * kCountLanes;
+	table_.assign(size_scheme_ * stride_, 0.);
+	constants_.assign(count_types_, 0.);
+	sums_.assign(count_types_, 0.);
+	min_logs_.assign(count_types_, 0.);
+	max_logs_.assign(count_types_, 0.);
+}
+
+void BatchScorer::Create(std::span<const LikelihoodModel> models) {
+	size_t size_scheme = models.empty() ? 0 : models[0].GetLogProbabilities().size();
+	Resize(BatchMetric::kLikelihood, models.size(), size_scheme);
+	koef_ = 1.;
+	for (size_t type = 0; type < count_types_; type++) {
+		std::span<const double> logs = models[type].GetLogProbabilities();
+		if (logs.size() != size_scheme_)
+			throw std::invalid_argument("ptrid::BatchScorer::Create: models have different sizes.");
+		for (size_t cell = 0; cell < size_scheme_; cell++)
+			table_[cell * stride_ + type] = logs[cell];
+		if (!logs.empty()) {
+			auto [min, max] = std::minmax_element(logs.begin(), logs.end());
+			min_logs_[type] = *min;
+			max_logs_[type] = *max;
+		}
+	}
+}
+
+template <class Real>
+void BatchScorer::Create(BatchMetric metric,
+												 std::span<const BasicProbabilisticScheme<Real>> schemes,
+												 double koef) {
+	if (metric == BatchMetric::kLikelihood)
+		throw std::invalid_argument(
+				"ptrid::BatchScorer::Create: likelihood is scored by LikelihoodModel.");
+	size_t size_scheme = schemes.empty() ? 0 : schemes[0].GetSizeScheme();
+	Resize(metric, schemes.size(), size_scheme);
+	koef_ = koef;
+	for (size_t type = 0; type < count_types_; type++) {
+		const BasicProbabilisticScheme<Real> &scheme = schemes[type];
+		if (scheme.GetDeep() != 2 || scheme.GetSizeScheme() != size_scheme_)
+			throw std::invalid_argument(
+					"ptrid::BatchScorer::Create: schemes must have deep 2 and equal sizes.");
+		size_t size_set = scheme.GetSizeSet();
+		for (size_t cell = 0; cell < size_scheme_; cell++) {
+			double &value = table_[cell * stride_ + type];
+			if (metric == BatchMetric::kInfoDistance) {
+				/* sum p * log2 p - sum p * log2 (n / D) */
+				double probability = scheme.GetProbability(cell % size_set, cell / size_set);
+				value = probability;
+				sums_[type] += probability;
+				if (probability > 0)
+					constants_[type] += probability * std::log2(probability);
+			} else {
+				/* sum (n - m)^2 / m = sum n^2 / m - 2 sum n + sum m */
+				double numerator = scheme.GetNumerator(cell % size_set, cell / size_set);
+				if (numerator <= 0)
+					throw std::invalid_argument(
+							"ptrid::BatchScorer::Create: schemes for chi2 must be smoothed.");
+				value = 1. / numerator;
+				constants_[type] += 1. / numerator + numerator;
+			}
+		}
+	}
+}
+
+void BatchScorer::Score(std::span<const uint32_t> frequencies,
+												std::span<double> scores) const {
+	Score(GetBestScoringKernel(), frequencies, scores);
+}
+
+void BatchScorer::Score(HistogramKernel kernel, std::span<const uint32_t> frequencies,
+												std::span<double> scores) const {
+	ScoreCells(kernel, frequencies, std::span<const uint32_t>(), false, scores);
+}
+
+void BatchScorer::Score(const TouchedHistogram &histogram, std::span<double> scores) const {
+	ScoreCells(GetBestScoringKernel(), histogram.GetCounts(), histogram.GetTouched(),
+						 !histogram.IsDense(), scores);
+}
+
+void BatchScorer::ScoreCells(HistogramKernel kernel, std::span<const uint32_t> frequencies,
+														 std::span<const uint32_t> touched, bool use_touched,
+														 std::span<double> scores) const {
+	assert((frequencies.size() == size_scheme_) &&
+				 "ptrid::BatchScorer::Score: sizes of @frequencies and the types differ.");
+	assert((scores.size() == count_types_) &&
+				 "ptrid::BatchScorer::Score: size of @scores isn't the number of types.");
+	if (!IsSupportedHistogramKernel(kernel))
+		throw std::invalid_argument(
+				"ptrid::BatchScorer::Score: kernel isn't supported by CPU - " +
+				std::string(GetHistogramKernelName(kernel)));
+
+	/* a non-null list of touched cells, even an empty one */
+	static const uint32_t no_cells[1] = {0};
+	const uint32_t *cells = use_touched ? (touched.empty() ? no_cells : touched.data()) : nullptr;
+	thread_local std::vector<double, AlignedAllocator<double>> sums;
+	sums.assign(stride_, 0.);
+	double denominator = 0.;
+	switch (metric_) {
+		case BatchMetric::kLikelihood:
+			denominator = AddCellsBy<BatchMetric::kLikelihood>(
+					kernel, koef_, table_.data(), stride_, frequencies, cells, touched.size(), sums.data());
+			break;
+		case BatchMetric::kInfoDistance:
+			denominator = AddCellsBy<BatchMetric::kInfoDistance>(
+					kernel, koef_, table_.data(), stride_, frequencies, cells, touched.size(), sums.data());
+			break;
+		default:
+			denominator = AddCellsBy<BatchMetric::kChi2>(
+					kernel, koef_, table_.data(), stride_, frequencies, cells, touched.size(), sums.data());
+	}
+
+	FinishScores(sums.data(), denominator, scores);
+}
+
+void BatchScorer::FinishScores(const double *sums, double denominator,
+															 std::span<double> scores) const {
+	for (size_t type = 0; type < count_types_; type++) {
+		if (metric_ == BatchMetric::kLikelihood)
+			scores[type] = sums[type];
+		else if (metric_ == BatchMetric::kInfoDistance)
+			scores[type] =
+					constants_[type] + sums_[type] * std::log2(denominator) - sums[type];
+		else
+			scores[type] = constants_[type] - 2. * denominator + sums[type];
+	}
+}
+
+void BatchScorer::AddToSession(BatchSession &session, const uint8_t *data,
+															 size_t len) const {
+	assert((size_scheme_ == 65536) &&
+				 "ptrid::BatchScorer::AddToSession: sessions are scored by pairs.");
+	if (session.sums_.size() != stride_) {
+		session.Clear();
+		session.sums_.assign(stride_, 0.);
+		session.denominator_ = size_scheme_;
+	}
+	double *sums = session.sums_.data();
+	HistogramKernel kernel = GetBestScoringKernel();
+	if (metric_ == BatchMetric::kLikelihood) {
+		AddPairsBy(kernel, table_.data(), stride_, data, len, sums);
+		return;
+	}
+	if (metric_ == BatchMetric::kInfoDistance)
+		session.denominator_ += AddCountedPairsBy<BatchMetric::kInfoDistance>(
+				kernel, koef_, table_.data(), stride_, data, len, session.counts_, sums);
+	else
+		session.denominator_ += AddCountedPairsBy<BatchMetric::kChi2>(
+				kernel, koef_, table_.data(), stride_, data, len, session.counts_, sums);
+}
+
+void BatchScorer::Score(const BatchSession &session, std::span<double> scores) const {
+	assert((scores.size() == count_types_) &&
+				 "ptrid::BatchScorer::Score: size of @scores isn't the number of types.");
+	if (session.sums_.size() != stride_) {
+		std::vector<double> sums(stride_, 0.);
+		FinishScores(sums.data(), size_scheme_, scores);
+		return;
+	}
+	FinishScores(session.sums_.data(), session.denominator_, scores);
+}
+
+void BatchScorer::ScorePairs(const uint8_t *data, size_t len,
+														 std::span<double> scores) const {
+	ScorePairs(GetBestScoringKernel(), data, len, scores);
+}
+
+void BatchScorer::ScorePairs(HistogramKernel kernel, const uint8_t *data, size_t len,
+														 std::span<double> scores) const {
+	assert((metric_ == BatchMetric::kLikelihood && size_scheme_ == 65536) &&
+				 "ptrid::BatchScorer::ScorePairs: only likelihood of pairs is additive.");
+	assert((scores.size() == count_types_) &&
+				 "ptrid::BatchScorer::ScorePairs: size of @scores isn't the number of types.");
+	if (!IsSupportedHistogramKernel(kernel))
+		throw std::invalid_argument(
+				"ptrid::BatchScorer::ScorePairs: kernel isn't supported by CPU - " +
+				std::string(GetHistogramKernelName(kernel)));
+
+	thread_local std::vector<double, AlignedAllocator<double>> sums;
+	sums.assign(stride_, 0.);
+	AddPairsBy(kernel, table_.data(), stride_, data, len, sums.data());
+	std::copy(sums.begin(), sums.begin() + count_types_, scores.begin());
+}
+
+bool BatchScorer::IsDecided(const double *sums, size_t count_rest) const {
+	size_t best = GetBestOfScores(std::span<const double>(sums, count_types_));
+	double lower = sums[best] + count_rest * min_logs_[best];
+	for (size_t type = 0; type < count_types_; type++) {
+		if (type != best && !(sums[type] + count_rest * max_logs_[type] < lower))
+			return false;
+	}
+	return true;
+}
+
+EarlyExitResult BatchScorer::GetBestEarly(const uint8_t *data, size_t len,
+																					size_t size_chunk, bool is_file) const {
+	assert((metric_ == BatchMetric::kLikelihood && size_scheme_ == 65536) &&
+				 "ptrid::BatchScorer::GetBestEarly: only likelihood of pairs is bounded.");
+	assert((size_chunk > 0) && "ptrid::BatchScorer::GetBestEarly: empty chunks.");
+
+	thread_local std::vector<double, AlignedAllocator<double>> sums;
+	sums.assign(stride_, 0.);
+	HistogramKernel kernel = GetBestScoringKernel();
+	/* the EOF sentinel pair is known beforehand */
+	if (is_file) {
+		const uint8_t sentinel[2] = {len < 2 ? (uint8_t)EOF : data[len - 1], (uint8_t)EOF};
+		AddPairsBy(kernel, table_.data(), stride_, sentinel, 2, sums.data());
+	}
+	EarlyExitResult result;
+	size_t count_pairs = len > 1 ? len - 1 : 0;
+	size_t count_done = 0;
+	while (count_done < count_pairs) {
+		size_t count = std::min(size_chunk, count_pairs - count_done);
+		/* @count pairs take @count + 1 bytes */
+		AddPairsBy(kernel, table_.data(), stride_, data + count_done, count + 1, sums.data());
+		count_done += count;
+		if (count_done < count_pairs && IsDecided(sums.data(), count_pairs - count_done)) {
+			result.is_early = true;
+			break;
+		}
+	}
+	result.consumed = std::min(len, count_done + 1);
+	result.type = GetBestOfScores(std::span<const double>(sums.data(), count_types_));
+	return result;
+}
+
+void BatchScorer::Score(const uint8_t *data, size_t len, std::span<double> scores) const {
+	if (metric_ == BatchMetric::kLikelihood && len <= kMaxLenPairsWalk) {
+		ScorePairs(data, len, scores);
+		return;
+	}
+	thread_local TouchedHistogram histogram;
+	if (histogram.GetSize() != size_scheme_)
+		histogram = TouchedHistogram(size_scheme_);
+	histogram.Clean();
+	histogram.Count(2, data, len);
+	Score(histogram, scores);
+}
+
+size_t BatchScorer::GetBestOfScores(std::span<const double> scores) const {
+	size_t best = 0;
+	for (size_t type = 1; type < count_types_; type++) {
+		if (metric_ == BatchMetric::kLikelihood ? scores[type] > scores[best]
+																						: scores[type] < scores[best])
+			best = type;
+	}
+	return best;
+}
+
+size_t BatchScorer::GetBest(std::span<const uint32_t> frequencies) const {
+	thread_local std::vector<double> scores;
+	scores.resize(count_types_);
+	Score(frequencies, scores);
+	return GetBestOfScores(scores);
+}
+
+size_t BatchScorer::GetBest(const TouchedHistogram &histogram) const {
+	thread_local std::vector<double> scores;
+	scores.resize(count_types_);
+	Score(histogram, scores);
+	return GetBestOfScores(scores);
+}
+
+size_t BatchScorer::GetBest(const BatchSession &session) const {
+	thread_local std::vector<double> scores;
+	scores.resize(count_types_);
+	Score(session, scores);
+	return GetBestOfScores(scores);
+}
+
+size_t BatchScorer::GetBest(const uint8_t *data, size_t len) const {
+	thread_local std::vector<double> scores;
+	scores.resize(count_types_);
+	Score(data, len, scores);
+	return GetBestOfScores(scores);
+}
+
+template void BatchScorer::Create(BatchMetric,
+																	std::span<const BasicProbabilisticScheme<float>>,
+																	double);
+template void BatchScorer::Create(BatchMetric,
+																	std::span<const BasicProbabilisticScheme<double>>,
+																	double);
+template void BatchScorer::Create(BatchMetric,
+																	std::span<const BasicProbabilisticScheme<long double>>,
+																	double);
+
+}	 // namespace ptrid
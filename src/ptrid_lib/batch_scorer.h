@@ -0,0 +1,171 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+#include "aligned_allocator.h"
+#include "histogram.h"
+#include "likelihood_model.h"
+#include "ngrams.h"
+#include "probabilistic_scheme.h"
+
+namespace ptrid {
+
+/* kLikelihood is log10 of the likelihood by Markov chains (the largest is
+   the best), kInfoDistance and kChi2 are the metrics of math_func between
+   a type and a sample smoothed by useAdditiveSmoothing (the least is the
+   best). */
+enum class BatchMetric { kLikelihood, kInfoDistance, kChi2 };
+
+/* Scores of a sample which grows by segments, such as a TCP session. The
+   sums of BatchScorer are kept between segments and updated only by the
+   pairs of a new segment, counts of pairs are kept only for metrics whose
+   terms aren't linear in counts. */
+class BatchSession {
+	friend class BatchScorer;
+
+ private:
+	std::vector<double, AlignedAllocator<double>> sums_;
+	NGramTable counts_;			/* for kInfoDistance and kChi2 */
+	double denominator_ = 0.; /* sum of smoothed numerators */
+
+ public:
+	BatchSession() = default;
+
+	void Clear() {
+		sums_.clear();
+		counts_.Clear();
+		denominator_ = 0.;
+	}
+
+	bool IsEmpty() const { return sums_.empty(); }
+};
+
+/* Result of BatchScorer::GetBestEarly. */
+struct EarlyExitResult {
+	size_t type = 0;
+	size_t consumed = 0;	 /* bytes of the input which were scored */
+	bool is_early = false; /* stopped before the end of the input */
+};
+
+/* Scores one sample by all types at once. Values of the types are laid out
+   cell-major: all types of a cell side by side, padded to kCountLanes, so
+   every non-zero cell of the sample is visited once and its contribution
+   is added to all types by vector lanes. Metrics of schemes are expanded
+   to sums over the non-zero cells and constants of types, since the
+   smoothed sample is the same at all zero cells. */
+class BatchScorer {
+ public:
+	/* doubles in an AVX-512 register */
+	static constexpr size_t kCountLanes = 8;
+	/* Payloads up to this length are scored pair by pair: building and
+	   walking a histogram costs more than adding a row per pair. */
+	static constexpr size_t kMaxLenPairsWalk = 1536;
+	/* pairs scored between checks of bounds by GetBestEarly */
+	static constexpr size_t kSizeEarlyExitChunk = 4096;
+
+ private:
+	BatchMetric metric_ = BatchMetric::kLikelihood;
+	size_t count_types_ = 0;
+	size_t stride_ = 0;
+	size_t size_scheme_ = 0;
+	double koef_ = 1.;
+	std::vector<double, AlignedAllocator<double>> table_; /* [cell * stride_ + type] */
+	std::vector<double> constants_;	 /* parts of metrics which don't depend on a sample */
+	std::vector<double> sums_;			 /* sums of probabilities of types for kInfoDistance */
+	std::vector<double> min_logs_;	 /* bounds of a pair of types for kLikelihood */
+	std::vector<double> max_logs_;
+
+	void Resize(BatchMetric metric, size_t count_types, size_t size_scheme);
+
+	/* Visits only @touched cells if @use_touched. */
+	void ScoreCells(HistogramKernel kernel, std::span<const uint32_t> frequencies,
+									std::span<const uint32_t> touched, bool use_touched,
+									std::span<double> scores) const;
+
+	size_t GetBestOfScores(std::span<const double> scores) const;
+
+	/* True if no type can overtake the leader of @sums within @count_rest
+	   pairs. */
+	bool IsDecided(const double *sums, size_t count_rest) const;
+
+	/* Turns sums of cells into the metric of every type. */
+	void FinishScores(const double *sums, double denominator,
+										std::span<double> scores) const;
+
+ public:
+	BatchScorer() = default;
+
+	void Create(std::span<const LikelihoodModel> models);
+
+	/* @koef is the koef of useAdditiveSmoothing of samples. Schemes of types
+	   must have deep 2, for kChi2 they must be smoothed: cells with zero
+	   numerators aren't skipped as GetChi2 does. */
+	template <class Real>
+	void Create(BatchMetric metric,
+							std::span<const BasicProbabilisticScheme<Real>> schemes, double koef);
+
+	/* @scores gets the metric of every type. */
+	void Score(std::span<const uint32_t> frequencies, std::span<double> scores) const;
+
+	void Score(HistogramKernel kernel, std::span<const uint32_t> frequencies,
+						 std::span<double> scores) const;
+
+	/* Visits only the touched cells while the histogram isn't dense. */
+	void Score(const TouchedHistogram &histogram, std::span<double> scores) const;
+
+	/* Scores pairs of raw @data of deep 2 (without the EOF sentinel): short
+	   payloads of kLikelihood are walked pair by pair, others are counted to
+	   a histogram first. */
+	void Score(const uint8_t *data, size_t len, std::span<double> scores) const;
+
+	/* Likelihood of pairs of @data added straight from the table. */
+	void ScorePairs(const uint8_t *data, size_t len, std::span<double> scores) const;
+
+	void ScorePairs(HistogramKernel kernel, const uint8_t *data, size_t len,
+									std::span<double> scores) const;
+
+	/* Likelihood of pairs of @data by chunks of @size_chunk pairs, stops once
+	   the leader can't be overtaken: a pair changes the score of a type by
+	   no less than the min and no more than the max log-probability of its
+	   model. The type is the one which the whole @data gets; @is_file adds
+	   the EOF sentinel pair, as ReaderBytes does at the end of a file. */
+	EarlyExitResult GetBestEarly(const uint8_t *data, size_t len,
+															 size_t size_chunk = kSizeEarlyExitChunk,
+															 bool is_file = false) const;
+
+	/* Adds pairs of @data to @session, which is started by the first call,
+	   pairs across the border of segments aren't counted. The cost is
+	   O(len * types) and doesn't depend on the data seen before. */
+	void AddToSession(BatchSession &session, const uint8_t *data, size_t len) const;
+
+	void Score(const BatchSession &session, std::span<double> scores) const;
+
+	/* Index of the type with the best score. */
+	size_t GetBest(std::span<const uint32_t> frequencies) const;
+
+	size_t GetBest(const TouchedHistogram &histogram) const;
+
+	size_t GetBest(const uint8_t *data, size_t len) const;
+
+	size_t GetBest(const BatchSession &session) const;
+
+	BatchMetric GetMetric() const { return metric_; }
+
+	size_t GetCountTypes() const { return count_types_; }
+};
+
+extern template void BatchScorer::Create(BatchMetric,
+																				 std::span<const BasicProbabilisticScheme<float>>,
+																				 double);
+extern template void BatchScorer::Create(BatchMetric,
+																				 std::span<const BasicProbabilisticScheme<double>>,
+																				 double);
+extern template void BatchScorer::Create(
+		BatchMetric, std::span<const BasicProbabilisticScheme<long double>>, double);
+
+}	 // namespace ptrid
@@ -0,0 +1,132 @@
+#include "cascade_classifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+namespace ptrid {
+
+double GetEntropyOfBytes(const uint32_t *counts, size_t len) {
+	if (len == 0) return 0.;
+	/* -sum c/n log2 (c/n) = log2 n - sum c log2 c / n */
+	double sum = 0.;
+	for (size_t byte = 0; byte < 256; byte++) {
+		if (counts[byte] > 1) sum += counts[byte] * std::log2((double)counts[byte]);
+	}
+	return std::log2((double)len) - sum / len;
+}
+
+void CascadeClassifier::Create(std::span<const LikelihoodModel> models,
+															 std::span<const std::vector<uint32_t>> unigrams,
+															 size_t random_type) {
+	if (models.size() != unigrams.size())
+		throw std::invalid_argument(
+				"ptrid::CascadeClassifier::Create: numbers of models and unigrams differ.");
+	count_types_ = models.size();
+	random_type_ = std::min(random_type, count_types_);
+	models_.assign(models.begin(), models.end());
+	unigrams_.assign(256 * count_types_, 0.);
+	for (size_t type = 0; type < count_types_; type++) {
+		if (models_[type].GetSizeSet() != 256 || unigrams[type].size() != 256)
+			throw std::invalid_argument(
+					"ptrid::CascadeClassifier::Create: types must be of bytes of deep 2 and 1.");
+		double denominator =
+				std::accumulate(unigrams[type].begin(), unigrams[type].end(), 0.) + 256.;
+		for (size_t byte = 0; byte < 256; byte++)
+			unigrams_[byte * count_types_ + type] =
+					std::log10((unigrams[type][byte] + 1.) / denominator);
+	}
+	count_candidates_ = count_types_;
+	max_entropy_ = std::numeric_limits<double>::infinity();
+	entropies_.clear();
+	count_ranks_.assign(count_types_, 0);
+	count_above_entropy_ = 0;
+	count_beyond_candidates_ = 0;
+}
+
+void CascadeClassifier::ScoreBytes(const uint32_t *counts, std::span<double> scores) const {
+	std::fill(scores.begin(), scores.end(), 0.);
+	for (size_t byte = 0; byte < 256; byte++) {
+		if (counts[byte] == 0) continue;
+		const double *row = unigrams_.data() + byte * count_types_;
+		for (size_t type = 0; type < count_types_; type++)
+			scores[type] += counts[byte] * row[type];
+	}
+}
+
+void CascadeClassifier::Learn(size_t type, const uint8_t *data, size_t len) {
+	assert((type < count_types_) && "ptrid::CascadeClassifier::Learn: @type is out of bounds.");
+	if (type == random_type_ || len == 0) return;
+
+	std::vector<double> scores(count_types_);
+	for (size_t begin = 0; begin < len; begin += kSizeWindow) {
+		size_t size_window = std::min(kSizeWindow, len - begin);
+		/* a short tail is a part of the previous window */
+		if (size_window < kSizeWindow && begin > 0) break;
+		uint32_t counts[256] = {0};
+		for (size_t i = begin; i < begin + size_window; i++) counts[data[i]] += 1;
+		entropies_.push_back(GetEntropyOfBytes(counts, size_window));
+
+		ScoreBytes(counts, scores);
+		size_t rank = 0;
+		for (size_t other = 0; other < count_types_; other++)
+			rank += scores[other] > scores[type];
+		count_ranks_[rank] += 1;
+	}
+}
+
+void CascadeClassifier::Fit(double coverage) {
+	if (!(coverage > 0. && coverage <= 1.))
+		throw std::invalid_argument("ptrid::CascadeClassifier::Fit: @coverage must be in (0, 1].");
+	if (entropies_.empty()) return;
+	size_t count_covered =
+			std::max<size_t>(std::ceil(coverage * entropies_.size() - 1e-9), 1);
+
+	std::vector<double> entropies = entropies_;
+	std::nth_element(entropies.begin(), entropies.begin() + count_covered - 1, entropies.end());
+	max_entropy_ = entropies[count_covered - 1];
+	count_above_entropy_ = std::count_if(entropies_.begin(), entropies_.end(),
+																			 [this](double entropy) { return entropy > max_entropy_; });
+
+	size_t count_ranked = 0;
+	count_candidates_ = 0;
+	while (count_ranked < count_covered) count_ranked += count_ranks_[count_candidates_++];
+	count_beyond_candidates_ = entropies_.size() - count_ranked;
+}
+
+size_t CascadeClassifier::GetBest(const uint8_t *data, size_t len) const {
+	uint32_t counts[256] = {0};
+	for (size_t i = 0; i < len; i++) counts[data[i]] += 1;
+	if (random_type_ < count_types_ && GetEntropyOfBytes(counts, len) > max_entropy_)
+		return random_type_;
+
+	thread_local std::vector<size_t> candidates;
+	candidates.resize(count_types_);
+	std::iota(candidates.begin(), candidates.end(), 0);
+	if (count_candidates_ < count_types_) {
+		thread_local std::vector<double> scores;
+		scores.resize(count_types_);
+		ScoreBytes(counts, scores);
+		std::partial_sort(candidates.begin(), candidates.begin() + count_candidates_,
+											candidates.end(),
+											[](size_t a, size_t b) { return scores[a] > scores[b]; });
+		candidates.resize(count_candidates_);
+	}
+
+	/* ties go to the least index, as by BatchScorer */
+	size_t best = candidates[0];
+	double best_score = -std::numeric_limits<double>::infinity();
+	for (size_t type : candidates) {
+		const double *logs = models_[type].GetLogProbabilities().data();
+		double score = 0.;
+		for (size_t i = 1; i < len; i++) score += logs[data[i - 1] + data[i] * 256];
+		if (score > best_score || (score == best_score && type < best)) {
+			best = type;
+			best_score = score;
+		}
+	}
+	return best;
+}
+
+}	 // namespace ptrid
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "likelihood_model.h"
+
+namespace ptrid {
+
+/* Classifies payloads in three stages: the entropy of bytes sends payloads
+   which are more random than the training windows straight to the random
+   type, likelihood of bytes (depth 1) shortlists candidates, and only
+   they are scored by pairs (depth 2). The number of candidates and the
+   bound of entropy are fitted to windows of training samples, until then
+   every type is a candidate and nothing is short-circuited. */
+class CascadeClassifier {
+ public:
+	/* payload of a full TCP segment */
+	static constexpr size_t kSizeWindow = 1460;
+
+ private:
+	size_t count_types_ = 0;
+	size_t random_type_ = 0;					/* count_types_ - none */
+	std::vector<LikelihoodModel> models_;
+	std::vector<double> unigrams_;		/* [byte * count_types_ + type], log10 */
+	size_t count_candidates_ = 0;
+	double max_entropy_ = std::numeric_limits<double>::infinity();
+
+	std::vector<double> entropies_;		/* of learned windows */
+	std::vector<size_t> count_ranks_;	/* [rank] learned windows of their type of the rank by bytes */
+	size_t count_above_entropy_ = 0;
+	size_t count_beyond_candidates_ = 0;
+
+	/* log10 of the likelihood of bytes of @counts by every type */
+	void ScoreBytes(const uint32_t *counts, std::span<double> scores) const;
+
+ public:
+	CascadeClassifier() = default;
+
+	/* @unigrams are frequencies of bytes of types (ReaderBytes(1)), they are
+	   smoothed by one, so a byte never seen doesn't veto a type. */
+	void Create(std::span<const LikelihoodModel> models,
+							std::span<const std::vector<uint32_t>> unigrams, size_t random_type);
+
+	/* Windows of kSizeWindow bytes of @data of @type are kept for Fit.
+	   Samples of the random type are ignored. */
+	void Learn(size_t type, const uint8_t *data, size_t len);
+
+	/* The bound of entropy and the number of candidates are set to cover
+	   @coverage of the learned windows each (1 - the maxima), so a few odd
+	   windows don't set them. Without learned windows nothing changes. */
+	void Fit(double coverage = 1.);
+
+	size_t GetBest(const uint8_t *data, size_t len) const;
+
+	size_t GetCountCandidates() const { return count_candidates_; }
+
+	double GetMaxEntropy() const { return max_entropy_; }
+
+	size_t GetCountWindows() const { return entropies_.size(); }
+
+	/* Learned windows left out by Fit: they are sent to the random type or
+	   their type isn't a candidate. */
+	size_t GetCountAboveEntropy() const { return count_above_entropy_; }
+
+	size_t GetCountBeyondCandidates() const { return count_beyond_candidates_; }
+
+	size_t GetCountTypes() const { return count_types_; }
+};
+
+/* Entropy in bits of bytes of a payload with @counts of 256 bytes. */
+double GetEntropyOfBytes(const uint32_t *counts, size_t len);
+
+}	 // namespace ptrid
@@ -0,0 +1,337 @@
+#include "corpus_index.h"
+
+#include <string.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+namespace ptrid {
+
+namespace {
+
+void AppendVarint(std::string &dst, uint64_t value) {
+	while (value >= 0x80) {
+		dst.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	dst.push_back((char)value);
+}
+
+bool ReadVarint(const uint8_t *&data, const uint8_t *end, uint64_t &value) {
+	value = 0;
+	for (int shift = 0; data < end && shift < 64; shift += 7) {
+		uint8_t byte = *data++;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+/* Checks that @cells decode into indexes below @count_frequencies. */
+bool CheckCells(const uint8_t *data, const uint8_t *end, size_t count_frequencies) {
+	uint64_t index = 0, distance = 0, frequency = 0;
+	for (bool first = true; data < end; first = false) {
+		if (!ReadVarint(data, end, distance) || !ReadVarint(data, end, frequency))
+			return false;
+		index += first ? distance : distance + 1;
+		if (index >= count_frequencies || frequency > UINT32_MAX) return false;
+	}
+	return true;
+}
+
+/* Parses an entry at @data, returns nullptr if it goes beyond @end. */
+const uint8_t *ParseEntry(const uint8_t *data, const uint8_t *end,
+													size_t count_frequencies, std::string &relative_path,
+													CorpusIndex::Entry &entry) {
+	CorpusIndex::EntryHeader header;
+	if ((size_t)(end - data) < sizeof(header)) return nullptr;
+	memcpy(&header, data, sizeof(header));
+	data += sizeof(header);
+	if ((size_t)(end - data) < (uint64_t)header.length_path + header.size_cells)
+		return nullptr;
+	if (!CheckCells(data + header.length_path,
+									data + header.length_path + header.size_cells,
+									count_frequencies))
+		return nullptr;
+
+	relative_path.assign((const char *)data, header.length_path);
+	data += header.length_path;
+	entry.source.size = header.source_size;
+	entry.source.mtime = header.source_mtime;
+	entry.source.checksum = header.source_checksum;
+	entry.cells.assign((const char *)data, header.size_cells);
+	return data + header.size_cells;
+}
+
+void AppendEntry(std::string &dst, const std::string &relative_path,
+								 const CorpusIndex::Entry &entry) {
+	CorpusIndex::EntryHeader header = {};
+	header.source_size = entry.source.size;
+	header.source_mtime = entry.source.mtime;
+	header.source_checksum = entry.source.checksum;
+	header.length_path = relative_path.size();
+	header.size_cells = entry.cells.size();
+	dst.append((const char *)&header, sizeof(header));
+	dst.append(relative_path);
+	dst.append(entry.cells);
+}
+
+uint64_t GetChecksum(const void *data, size_t len) {
+	Checksum checksum;
+	checksum.Update((const uint8_t *)data, len);
+	return checksum.Get();
+}
+
+}	 // namespace
+
+CorpusIndex::CorpusIndex(const std::string &path_to_index, int8_t deep,
+												 size_t count_frequencies)
+		: path_to_index_(path_to_index), deep_(deep) {
+	std::filesystem::path path{path_to_index};
+	path_to_journal_ =
+			(path.parent_path() / (path.stem().string() + ".journal.dmp")).string();
+	frequencies_.resize(count_frequencies, 0);
+}
+
+CorpusIndex::Header CorpusIndex::MakeHeader(const char *magic) const {
+	Header header = {};
+	memcpy(header.magic, magic, sizeof(header.magic));
+	header.version = Header::kVersion;
+	header.deep = deep_;
+	header.byte_order = DumpHeader::kByteOrder;
+	header.count_frequencies = frequencies_.size();
+	return header;
+}
+
+bool CorpusIndex::CheckHeader(const Header &header, const char *magic) const {
+	return memcmp(header.magic, magic, sizeof(header.magic)) == 0 &&
+				 header.version == Header::kVersion && header.deep == deep_ &&
+				 header.byte_order == DumpHeader::kByteOrder &&
+				 header.count_frequencies == frequencies_.size();
+}
+
+void CorpusIndex::AddCells(const std::string &cells) {
+	DecodeCells(cells, [this](size_t index, uint32_t frequency) {
+		frequencies_[index] += frequency;
+	});
+}
+
+void CorpusIndex::SubtractCells(const std::string &cells) {
+	DecodeCells(cells, [this](size_t index, uint32_t frequency) {
+		frequencies_[index] -= frequency;
+	});
+}
+
+void CorpusIndex::ApplyPut(const std::string &relative_path, Entry &&entry) {
+	auto it = entries_.find(relative_path);
+	if (it != entries_.end()) {
+		SubtractCells(it->second.cells);
+		it->second = std::move(entry);
+		AddCells(it->second.cells);
+	} else {
+		AddCells(entry.cells);
+		entries_.emplace(relative_path, std::move(entry));
+	}
+	modified_ = true;
+}
+
+void CorpusIndex::ApplyRemove(const std::string &relative_path) {
+	auto it = entries_.find(relative_path);
+	if (it == entries_.end()) return;
+	SubtractCells(it->second.cells);
+	entries_.erase(it);
+	modified_ = true;
+}
+
+bool CorpusIndex::LoadIndex() {
+	if (!std::filesystem::is_regular_file(path_to_index_)) return true;
+
+	MappedFile file(path_to_index_);
+	Header header;
+	size_t size_frequencies = frequencies_.size() * sizeof(uint32_t);
+	if (!file.IsMapped() || file.GetSize() < sizeof(header) + size_frequencies)
+		return false;
+	memcpy(&header, file.GetData(), sizeof(header));
+	const uint8_t *data = file.GetData() + sizeof(header);
+	const uint8_t *end = file.GetData() + file.GetSize();
+	if (!CheckHeader(header, Header::kMagicIndex) ||
+			GetChecksum(data, end - data) != header.checksum)
+		return false;
+
+	memcpy(frequencies_.data(), data, size_frequencies);
+	data += size_frequencies;
+	std::string relative_path;
+	for (uint64_t i = 0; i < header.count_entries; i++) {
+		Entry entry;
+		data = ParseEntry(data, end, frequencies_.size(), relative_path, entry);
+		if (!data) return false;
+		entries_.emplace(relative_path, std::move(entry));
+	}
+	return data == end;
+}
+
+void CorpusIndex::ReplayJournal() {
+	if (!std::filesystem::is_regular_file(path_to_journal_)) return;
+
+	MappedFile file(path_to_journal_);
+	Header header;
+	if (file.IsMapped() && file.GetSize() >= sizeof(header))
+		memcpy(&header, file.GetData(), sizeof(header));
+	if (!file.IsMapped() || file.GetSize() < sizeof(header) ||
+			!CheckHeader(header, Header::kMagicJournal)) {
+		std::cout << "Dropping damaged journal: " + path_to_journal_ + "\n";
+		std::filesystem::remove(path_to_journal_);
+		return;
+	}
+
+	std::cout << "Resuming from journal: " + path_to_journal_ + "\n";
+	const uint8_t *data = file.GetData() + sizeof(header);
+	const uint8_t *end = file.GetData() + file.GetSize();
+	size_t count_records = 0;
+	/* a record cut by interruption ends the journal */
+	while ((size_t)(end - data) >= sizeof(RecordHeader)) {
+		RecordHeader record;
+		memcpy(&record, data, sizeof(record));
+		const uint8_t *payload = data + sizeof(record);
+		if ((size_t)(end - payload) < record.size_payload ||
+				GetChecksum(payload, record.size_payload) != record.checksum)
+			break;
+
+		std::string relative_path;
+		Entry entry;
+		if (!ParseEntry(payload, payload + record.size_payload, frequencies_.size(),
+										relative_path, entry))
+			break;
+		if (record.type == kRecordPut)
+			ApplyPut(relative_path, std::move(entry));
+		else if (record.type == kRecordRemove)
+			ApplyRemove(relative_path);
+		data = payload + record.size_payload;
+		count_records += 1;
+	}
+	/* the replayed changes are rewritten by Commit() even if they are none */
+	modified_ = true;
+	if (data != end) {
+		std::cout << "Journal is cut after " + std::to_string(count_records) +
+										 " records: " + path_to_journal_ + "\n";
+		std::filesystem::resize_file(path_to_journal_, data - file.GetData());
+	}
+}
+
+void CorpusIndex::Load() {
+	entries_.clear();
+	frequencies_.assign(frequencies_.size(), 0);
+	modified_ = false;
+	if (!LoadIndex()) {
+		std::cout << "Damaged index: " + path_to_index_ + "\n";
+		entries_.clear();
+		frequencies_.assign(frequencies_.size(), 0);
+		modified_ = true;
+	}
+	ReplayJournal();
+}
+
+const CorpusIndex::Entry *CorpusIndex::Find(const std::string &relative_path) const {
+	auto it = entries_.find(relative_path);
+	return (it != entries_.end()) ? &it->second : nullptr;
+}
+
+void CorpusIndex::AppendRecord(RecordType type, const std::string &relative_path,
+															 const Entry &entry) {
+	if (!journal_.is_open()) {
+		bool exists = std::filesystem::is_regular_file(path_to_journal_);
+		journal_.open(path_to_journal_, std::ofstream::binary | std::ofstream::app);
+		if (!exists) {
+			Header header = MakeHeader(Header::kMagicJournal);
+			journal_.write((const char *)&header, sizeof(header));
+		}
+	}
+
+	std::string payload;
+	AppendEntry(payload, relative_path, entry);
+	RecordHeader record = {type, (uint32_t)payload.size(),
+												 GetChecksum(payload.data(), payload.size())};
+	journal_.write((const char *)&record, sizeof(record));
+	journal_.write(payload.data(), payload.size());
+	if (!journal_.good())
+		throw std::runtime_error("ptrid::CorpusIndex::AppendRecord: Error of write journal - " +
+														 path_to_journal_);
+}
+
+void CorpusIndex::Put(const std::string &relative_path, Entry &&entry) {
+	AppendRecord(kRecordPut, relative_path, entry);
+	ApplyPut(relative_path, std::move(entry));
+}
+
+void CorpusIndex::Remove(const std::string &relative_path) {
+	if (!Find(relative_path)) return;
+	AppendRecord(kRecordRemove, relative_path, Entry());
+	ApplyRemove(relative_path);
+}
+
+void CorpusIndex::Flush() {
+	if (journal_.is_open()) journal_.flush();
+}
+
+void CorpusIndex::Commit() {
+	if (!modified_) return;
+
+	std::string body((const char *)frequencies_.data(),
+									 frequencies_.size() * sizeof(uint32_t));
+	for (const auto &[relative_path, entry] : entries_)
+		AppendEntry(body, relative_path, entry);
+	Header header = MakeHeader(Header::kMagicIndex);
+	header.count_entries = entries_.size();
+	header.checksum = GetChecksum(body.data(), body.size());
+
+	std::cout << "Writing index: " + path_to_index_ + "\n";
+	std::string path_to_temporary = path_to_index_ + ".tmp.dmp";
+	{
+		std::ofstream ofs(path_to_temporary, std::ofstream::binary | std::ofstream::trunc);
+		ofs.write((const char *)&header, sizeof(header));
+		ofs.write(body.data(), body.size());
+		if (!ofs.good())
+			throw std::runtime_error("ptrid::CorpusIndex::Commit: Error of write index - " +
+															 path_to_index_);
+	}
+	if (std::rename(path_to_temporary.c_str(), path_to_index_.c_str()) != 0)
+		throw std::runtime_error("ptrid::CorpusIndex::Commit: Error of rename index - " +
+														 path_to_index_);
+
+	/* replaying the journal over the new index changes nothing, so an
+	   interruption here loses nothing */
+	if (journal_.is_open()) journal_.close();
+	std::filesystem::remove(path_to_journal_);
+	modified_ = false;
+}
+
+std::string CorpusIndex::EncodeCells(const std::vector<uint32_t> &frequencies) {
+	std::string cells;
+	size_t previous = 0;
+	bool first = true;
+	for (size_t i = 0; i < frequencies.size(); i++) {
+		if (frequencies[i] == 0) continue;
+		AppendVarint(cells, first ? i : i - previous - 1);
+		AppendVarint(cells, frequencies[i]);
+		previous = i;
+		first = false;
+	}
+	return cells;
+}
+
+void CorpusIndex::DecodeCells(const std::string &cells,
+															const std::function<void(size_t, uint32_t)> &action) {
+	const uint8_t *data = (const uint8_t *)cells.data();
+	const uint8_t *end = data + cells.size();
+	uint64_t index = 0, distance = 0, frequency = 0;
+	for (bool first = true; data < end; first = false) {
+		ReadVarint(data, end, distance);
+		ReadVarint(data, end, frequency);
+		index += first ? distance : distance + 1;
+		action(index, frequency);
+	}
+}
+
+}	 // namespace ptrid
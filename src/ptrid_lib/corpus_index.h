@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dumps.h"
+
+namespace ptrid {
+
+/* Index of a type directory: the total histogram of its samples and a
+   manifest with the size, time, checksum and histogram of every sample, so
+   adding, changing and removing samples updates the total without reading
+   other samples. Changes are appended to a journal first and are moved to
+   the index by Commit(), so training interrupted halfway resumes from the
+   journal. */
+class CorpusIndex {
+ public:
+	struct Entry {
+		SourceInfo source;
+		std::string cells; /* nonzero frequencies, see EncodeCells() */
+	};
+
+	/* Header of the index and of the journal. The index holds
+	   count_frequencies uint32_t totals and count_entries entries after it,
+	   @checksum covers everything after the header. The journal holds
+	   records, every one with its own checksum. */
+	struct Header {
+		static constexpr char kMagicIndex[4] = {'P', 'T', 'R', 'I'};
+		static constexpr char kMagicJournal[4] = {'P', 'T', 'R', 'J'};
+		static constexpr uint16_t kVersion = 1;
+
+		char magic[4];
+		uint16_t version;
+		uint8_t deep;
+		uint8_t reserved;
+		uint32_t byte_order;
+		uint32_t count_frequencies;
+		uint64_t count_entries;
+		uint64_t checksum;
+		uint8_t padding[32];
+	};
+
+	/* An entry is the header, the relative path and the encoded cells. */
+	struct EntryHeader {
+		uint64_t source_size;
+		int64_t source_mtime;
+		uint64_t source_checksum;
+		uint32_t length_path;
+		uint32_t size_cells;
+	};
+
+	enum RecordType : uint32_t { kRecordPut = 1, kRecordRemove = 2 };
+
+	struct RecordHeader {
+		uint32_t type;
+		uint32_t size_payload;
+		uint64_t checksum;
+	};
+
+ private:
+	static_assert(sizeof(Header) == 64, "ptrid::CorpusIndex::Header must take 64 bytes.");
+	static_assert(sizeof(EntryHeader) == 32, "ptrid::CorpusIndex::EntryHeader must take 32 bytes.");
+	static_assert(sizeof(RecordHeader) == 16, "ptrid::CorpusIndex::RecordHeader must take 16 bytes.");
+
+	std::string path_to_index_;
+	std::string path_to_journal_;
+	int8_t deep_;
+	std::vector<uint32_t> frequencies_;
+	std::map<std::string, Entry> entries_;
+	std::ofstream journal_;
+	bool modified_ = false;
+
+	Header MakeHeader(const char *magic) const;
+
+	bool CheckHeader(const Header &header, const char *magic) const;
+
+	void AddCells(const std::string &cells);
+
+	void SubtractCells(const std::string &cells);
+
+	void ApplyPut(const std::string &relative_path, Entry &&entry);
+
+	void ApplyRemove(const std::string &relative_path);
+
+	bool LoadIndex();
+
+	void ReplayJournal();
+
+	void AppendRecord(RecordType type, const std::string &relative_path,
+										const Entry &entry);
+
+ public:
+	CorpusIndex(const std::string &path_to_index, int8_t deep,
+							size_t count_frequencies);
+
+	CorpusIndex(const CorpusIndex &) = delete;
+
+	CorpusIndex &operator=(const CorpusIndex &) = delete;
+
+	/* Reads the index and replays the journal left by an interrupted run.
+	   A damaged index is dropped and the directory is read again. */
+	void Load();
+
+	const Entry *Find(const std::string &relative_path) const;
+
+	const std::map<std::string, Entry> &GetEntries() const { return entries_; }
+
+	const std::vector<uint32_t> &GetFrequencies() const { return frequencies_; }
+
+	bool IsModified() const { return modified_; }
+
+	/* Adds or replaces the sample and journals the change. */
+	void Put(const std::string &relative_path, Entry &&entry);
+
+	void Remove(const std::string &relative_path);
+
+	/* Makes journaled changes durable against interruption of the process. */
+	void Flush();
+
+	/* Writes the index with all changes and removes the journal. */
+	void Commit();
+
+	/* Nonzero frequencies as LEB128 pairs (distance from the previous
+	   nonzero index, frequency). */
+	static std::string EncodeCells(const std::vector<uint32_t> &frequencies);
+
+	static void DecodeCells(const std::string &cells,
+													const std::function<void(size_t, uint32_t)> &action);
+};
+
+}	 // namespace ptrid
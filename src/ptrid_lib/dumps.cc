@@ -0,0 +1,217 @@
+#include "dumps.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/serialization/vector.hpp>
+
+namespace ptrid {
+
+namespace {
+
+/* primes and rounds of xxHash64 */
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t LoadLittleEndian64(const uint8_t *data) {
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	if constexpr (std::endian::native == std::endian::big)
+		value = __builtin_bswap64(value);
+	return value;
+}
+
+inline uint64_t Round(uint64_t lane, uint64_t value) {
+	return std::rotl(lane + value * kPrime2, 31) * kPrime1;
+}
+
+inline uint64_t Merge(uint64_t hash, uint64_t lane) {
+	return (hash ^ Round(0, lane)) * kPrime1 + kPrime4;
+}
+
+}	 // namespace
+
+MappedFile::MappedFile(const std::string &path) : data_(MAP_FAILED) {
+	fd_ = open(path.c_str(), O_RDONLY);
+	struct stat settings;
+	if (fd_ < 0 || fstat(fd_, &settings) != 0 || !S_ISREG(settings.st_mode) ||
+			settings.st_size == 0)
+		return;
+	size_ = settings.st_size;
+	data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+}
+
+MappedFile::~MappedFile() {
+	if (data_ != MAP_FAILED) munmap(data_, size_);
+	if (fd_ >= 0) close(fd_);
+}
+
+bool MappedFile::IsMapped() const { return data_ != MAP_FAILED; }
+
+Checksum::Checksum() {
+	lanes_[0] = kPrime1 + kPrime2;
+	lanes_[1] = kPrime2;
+	lanes_[2] = 0;
+	lanes_[3] = -kPrime1;
+}
+
+void Checksum::UpdateStripe(const uint8_t *stripe) {
+	for (size_t i = 0; i < kCountLanes; i++)
+		lanes_[i] = Round(lanes_[i], LoadLittleEndian64(stripe + i * sizeof(uint64_t)));
+}
+
+void Checksum::Update(const uint8_t *data, size_t len) {
+	count_bytes_ += len;
+	if (size_stripe_ != 0) {
+		size_t count_copied = std::min(len, kSizeStripe - size_stripe_);
+		memcpy(stripe_ + size_stripe_, data, count_copied);
+		size_stripe_ += count_copied;
+		data += count_copied;
+		len -= count_copied;
+		if (size_stripe_ < kSizeStripe) return;
+		UpdateStripe(stripe_);
+		size_stripe_ = 0;
+	}
+	for (; len >= kSizeStripe; data += kSizeStripe, len -= kSizeStripe)
+		UpdateStripe(data);
+	memcpy(stripe_, data, len);
+	size_stripe_ = len;
+}
+
+uint64_t Checksum::Get() const {
+	uint64_t hash = std::rotl(lanes_[0], 1) + std::rotl(lanes_[1], 7) +
+									std::rotl(lanes_[2], 12) + std::rotl(lanes_[3], 18);
+	for (size_t i = 0; i < kCountLanes; i++)
+		hash = Merge(hash, lanes_[i]);
+	hash += count_bytes_;
+
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size_stripe_; i += sizeof(uint64_t))
+		hash = std::rotl(hash ^ Round(0, LoadLittleEndian64(stripe_ + i)), 27) *
+							 kPrime1 + kPrime4;
+	for (; i < size_stripe_; i++)
+		hash = std::rotl(hash ^ (stripe_[i] * kPrime5), 11) * kPrime1;
+
+	hash ^= hash >> 33;
+	hash *= kPrime2;
+	hash ^= hash >> 29;
+	hash *= kPrime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+SourceInfo GetSourceInfo(const std::string &path) {
+	struct stat settings;
+	if (stat(path.c_str(), &settings) != 0)
+		throw std::invalid_argument(
+				"ptrid::GetSourceInfo: file don't exist: " + path);
+	SourceInfo source;
+	source.size = settings.st_size;
+	source.mtime = settings.st_mtim.tv_sec * 1000000000LL + settings.st_mtim.tv_nsec;
+	return source;
+}
+
+uint64_t GetChecksumOfFile(const std::string &path) {
+	Checksum checksum;
+	MappedFile file(path);
+	if (file.IsMapped()) {
+		checksum.Update(file.GetData(), file.GetSize());
+		return checksum.Get();
+	}
+
+	std::ifstream ifs(path, std::ifstream::binary);
+	if (!ifs.is_open())
+		throw std::runtime_error("ptrid::GetChecksumOfFile: Error of read file: " + path);
+	char block[65536];
+	while (ifs.read(block, sizeof(block)) || ifs.gcount() > 0)
+		checksum.Update((const uint8_t *)block, ifs.gcount());
+	return checksum.Get();
+}
+
+bool IsBinaryDump(const std::string &path_to_dump) {
+	std::ifstream ifs(path_to_dump, std::ifstream::binary);
+	char magic[sizeof(DumpHeader::kMagic)] = {};
+	ifs.read(magic, sizeof(magic));
+	return ifs.good() && memcmp(magic, DumpHeader::kMagic, sizeof(magic)) == 0;
+}
+
+bool ReadBinaryDump(const std::string &path_to_dump, int8_t deep,
+										size_t count_frequencies, std::vector<uint32_t> &dst,
+										SourceInfo &source) {
+	MappedFile file(path_to_dump);
+	if (!file.IsMapped() || file.GetSize() < sizeof(DumpHeader)) return false;
+
+	DumpHeader header;
+	memcpy(&header, file.GetData(), sizeof(header));
+	size_t size_frequencies = count_frequencies * sizeof(uint32_t);
+	if (memcmp(header.magic, DumpHeader::kMagic, sizeof(header.magic)) != 0 ||
+			header.version != DumpHeader::kVersion ||
+			header.byte_order != DumpHeader::kByteOrder || header.deep != deep ||
+			header.count_frequencies != count_frequencies ||
+			file.GetSize() != sizeof(DumpHeader) + size_frequencies)
+		return false;
+
+	const uint8_t *frequencies = file.GetData() + sizeof(DumpHeader);
+	Checksum checksum;
+	checksum.Update(frequencies, size_frequencies);
+	if (checksum.Get() != header.frequencies_checksum) return false;
+
+	dst.resize(count_frequencies);
+	memcpy(dst.data(), frequencies, size_frequencies);
+	source.size = header.source_size;
+	source.mtime = header.source_mtime;
+	source.checksum = header.source_checksum;
+	return true;
+}
+
+void WriteBinaryDump(const std::string &path_to_dump, int8_t deep,
+										 const SourceInfo &source, const std::vector<uint32_t> &src) {
+	DumpHeader header = {};
+	memcpy(header.magic, DumpHeader::kMagic, sizeof(header.magic));
+	header.version = DumpHeader::kVersion;
+	header.deep = deep;
+	header.byte_order = DumpHeader::kByteOrder;
+	header.count_frequencies = src.size();
+	header.source_size = source.size;
+	header.source_mtime = source.mtime;
+	header.source_checksum = source.checksum;
+	Checksum checksum;
+	checksum.Update((const uint8_t *)src.data(), src.size() * sizeof(uint32_t));
+	header.frequencies_checksum = checksum.Get();
+
+	/* the temporary name keeps extension .dmp, so it is never read as a sample */
+	std::string path_to_temporary = path_to_dump + ".tmp.dmp";
+	{
+		std::ofstream ofs(path_to_temporary, std::ofstream::binary | std::ofstream::trunc);
+		ofs.write((const char *)&header, sizeof(header));
+		ofs.write((const char *)src.data(), src.size() * sizeof(uint32_t));
+		if (!ofs.good())
+			throw std::runtime_error("ptrid::WriteBinaryDump: Error of write dump - " +
+															 path_to_dump);
+	}
+	if (std::rename(path_to_temporary.c_str(), path_to_dump.c_str()) != 0)
+		throw std::runtime_error("ptrid::WriteBinaryDump: Error of rename dump - " +
+														 path_to_dump);
+}
+
+void ReadTextDump(const std::string &path_to_dump, std::vector<uint32_t> &dst) {
+	std::ifstream ifs(path_to_dump, std::ifstream::binary);
+	boost::archive::text_iarchive input_archive(ifs);
+	input_archive >> dst;
+}
+
+}	 // namespace ptrid
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace ptrid {
+
+/* Streaming 64-bit checksum of data, fast but not cryptographic. The
+   result doesn't depend on how the data is split between Update() calls. */
+class Checksum {
+ private:
+	static constexpr size_t kCountLanes = 4;
+	static constexpr size_t kSizeStripe = kCountLanes * sizeof(uint64_t);
+
+	uint64_t lanes_[kCountLanes];
+	uint8_t stripe_[kSizeStripe];
+	size_t size_stripe_ = 0;
+	uint64_t count_bytes_ = 0;
+
+	void UpdateStripe(const uint8_t *stripe);
+
+ public:
+	Checksum();
+
+	void Update(const uint8_t *data, size_t len);
+
+	uint64_t Get() const;
+};
+
+/* What a dump was built from. For a directory the size and the time are
+   the total size and the latest modification time of its samples and the
+   checksum is the sum of their checksums. */
+struct SourceInfo {
+	uint64_t size = 0;
+	int64_t mtime = 0; /* nanoseconds */
+	uint64_t checksum = 0;
+};
+
+/* Read-only mapping of a regular file, unmapped when leaving the scope.
+   Empty files and files which can't be mapped aren't mapped. */
+class MappedFile {
+ private:
+	int fd_ = -1;
+	void *data_;
+	size_t size_ = 0;
+
+ public:
+	MappedFile(const std::string &path);
+
+	MappedFile(const MappedFile &) = delete;
+
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	~MappedFile();
+
+	bool IsMapped() const;
+
+	const uint8_t *GetData() const { return (const uint8_t *)data_; }
+
+	size_t GetSize() const { return size_; }
+};
+
+/* Size and modification time of a file, the checksum is left zero. */
+SourceInfo GetSourceInfo(const std::string &path);
+
+uint64_t GetChecksumOfFile(const std::string &path);
+
+/* Binary dump: DumpHeader followed by DumpHeader::count_frequencies
+   uint32_t frequencies in the byte order of the writer. */
+struct DumpHeader {
+	static constexpr char kMagic[4] = {'P', 'T', 'R', 'D'};
+	static constexpr uint16_t kVersion = 1;
+	static constexpr uint32_t kByteOrder = 0x01020304;
+
+	char magic[4];
+	uint16_t version;
+	uint8_t deep;
+	uint8_t reserved;
+	uint32_t byte_order;
+	uint32_t count_frequencies;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_checksum;
+	uint64_t frequencies_checksum;
+	uint8_t padding[16];
+};
+
+static_assert(sizeof(DumpHeader) == 64, "ptrid::DumpHeader must take 64 bytes.");
+
+/* kActual - the dump matches its source, kMigrated - the dump has the old
+   text format and must be rewritten, kStale - the dump is missing, damaged
+   or was built from other data. */
+enum class DumpState { kActual, kMigrated, kStale };
+
+bool IsBinaryDump(const std::string &path_to_dump);
+
+/* Maps the dump and copies its frequencies to @dst. Returns false if the
+   dump is damaged, was written on a machine with other byte order or
+   doesn't hold @count_frequencies frequencies of depth @deep. */
+bool ReadBinaryDump(const std::string &path_to_dump, int8_t deep,
+										size_t count_frequencies, std::vector<uint32_t> &dst,
+										SourceInfo &source);
+
+/* Writes to a temporary file and renames it, so readers never see a half
+   written dump. */
+void WriteBinaryDump(const std::string &path_to_dump, int8_t deep,
+										 const SourceInfo &source, const std::vector<uint32_t> &src);
+
+/* Boost text archive of the old format, read only for migration. */
+void ReadTextDump(const std::string &path_to_dump, std::vector<uint32_t> &dst);
+
+}	 // namespace ptrid
@@ -0,0 +1,328 @@
+#include "histogram.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PTRID_X86
+#include <immintrin.h>
+#endif
+
+namespace ptrid {
+
+namespace {
+
+constexpr size_t kCountBanks = 4;
+constexpr size_t kSizeSet = 256;
+constexpr size_t kSizePairs = 65536;
+/* below these lengths zeroing and merging of banks costs more than it saves */
+constexpr size_t kMinLenBanked1 = 1024;
+constexpr size_t kMinLenBanked2 = 65536;
+
+void CountScalar(int8_t deep, const uint8_t *data, size_t len,
+								 uint32_t *frequencies) {
+	if (deep == 1) {
+		for (size_t i = 0; i < len; i++)
+			frequencies[data[i]] += 1;
+	} else {
+		for (size_t i = 0, j = 1; j < len; i++, j++)
+			frequencies[data[i] + data[j] * 256] += 1;
+	}
+}
+
+inline uint64_t LoadLittleEndian64(const uint8_t *data) {
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	if constexpr (std::endian::native == std::endian::big)
+		value = __builtin_bswap64(value);
+	return value;
+}
+
+/* Banks of pairs are big, so they are kept per thread between calls and
+   left zeroed after every merge. The first bank is @frequencies itself. */
+uint32_t *GetExtraPairBanks() {
+	thread_local std::vector<uint32_t> banks((kCountBanks - 1) * kSizePairs, 0);
+	return banks.data();
+}
+
+__attribute__((always_inline)) inline void CountBanked1(const uint8_t *data,
+																												size_t len,
+																												uint32_t *frequencies) {
+	uint32_t banks[kCountBanks][kSizeSet] = {};
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t word = LoadLittleEndian64(data + i);
+		banks[0][word & 0xFF] += 1;
+		banks[1][(word >> 8) & 0xFF] += 1;
+		banks[2][(word >> 16) & 0xFF] += 1;
+		banks[3][(word >> 24) & 0xFF] += 1;
+		banks[0][(word >> 32) & 0xFF] += 1;
+		banks[1][(word >> 40) & 0xFF] += 1;
+		banks[2][(word >> 48) & 0xFF] += 1;
+		banks[3][word >> 56] += 1;
+	}
+	for (; i < len; i++)
+		banks[0][data[i]] += 1;
+
+	for (size_t k = 0; k < kSizeSet; k++)
+		frequencies[k] += banks[0][k] + banks[1][k] + banks[2][k] + banks[3][k];
+}
+
+/* Pair data[i] + data[i + 1] * 256 is the little-endian 16-bit word at
+   data + i, so one 64-bit load gives four consecutive pairs. */
+__attribute__((always_inline)) inline void CountBanked2(const uint8_t *data,
+																												size_t len,
+																												uint32_t *frequencies) {
+	uint32_t *extra_banks = GetExtraPairBanks();
+	uint32_t *bank1 = extra_banks;
+	uint32_t *bank2 = extra_banks + kSizePairs;
+	uint32_t *bank3 = extra_banks + 2 * kSizePairs;
+	size_t i = 0;
+	for (; i + 8 <= len; i += 4) {
+		uint64_t word = LoadLittleEndian64(data + i);
+		frequencies[word & 0xFFFF] += 1;
+		bank1[(word >> 8) & 0xFFFF] += 1;
+		bank2[(word >> 16) & 0xFFFF] += 1;
+		bank3[(word >> 24) & 0xFFFF] += 1;
+	}
+	for (size_t j = i + 1; j < len; i++, j++)
+		frequencies[data[i] + data[j] * 256] += 1;
+
+	for (size_t k = 0; k < kSizePairs; k++) {
+		frequencies[k] += bank1[k] + bank2[k] + bank3[k];
+		bank1[k] = 0;
+		bank2[k] = 0;
+		bank3[k] = 0;
+	}
+}
+
+__attribute__((always_inline)) inline void CountBanked(int8_t deep,
+																											 const uint8_t *data,
+																											 size_t len,
+																											 uint32_t *frequencies) {
+	if (deep == 1) {
+		if (len < kMinLenBanked1)
+			CountScalar(deep, data, len, frequencies);
+		else
+			CountBanked1(data, len, frequencies);
+	} else {
+		if (len < kMinLenBanked2)
+			CountScalar(deep, data, len, frequencies);
+		else
+			CountBanked2(data, len, frequencies);
+	}
+}
+
+#if defined(PTRID_X86)
+
+/* SSE2 and AVX2 kernels are the banked kernel compiled for the wider ISA:
+   the difference is in the vectorized merge of banks. */
+__attribute__((target("sse2"))) void CountSse2(int8_t deep,
+																							 const uint8_t *data, size_t len,
+																							 uint32_t *frequencies) {
+	CountBanked(deep, data, len, frequencies);
+}
+
+__attribute__((target("avx2"))) void CountAvx2(int8_t deep,
+																							 const uint8_t *data, size_t len,
+																							 uint32_t *frequencies) {
+	CountBanked(deep, data, len, frequencies);
+}
+
+/* Population count of 16-bit masks in every 32-bit lane. */
+__attribute__((target("avx512f"))) inline __m512i PopCount16(__m512i v) {
+	v = _mm512_sub_epi32(
+			v, _mm512_and_si512(_mm512_srli_epi32(v, 1), _mm512_set1_epi32(0x5555)));
+	v = _mm512_add_epi32(
+			_mm512_and_si512(v, _mm512_set1_epi32(0x3333)),
+			_mm512_and_si512(_mm512_srli_epi32(v, 2), _mm512_set1_epi32(0x3333)));
+	v = _mm512_and_si512(_mm512_add_epi32(v, _mm512_srli_epi32(v, 4)),
+											 _mm512_set1_epi32(0x0F0F));
+	return _mm512_and_si512(_mm512_add_epi32(v, _mm512_srli_epi32(v, 8)),
+													_mm512_set1_epi32(0x1F));
+}
+
+/* Sixteen pairs are counted at once: equal indexes of a vector are found by
+   vpconflictd, the highest lane of every group gets the size of the group
+   and wins the scatter. Consecutive vectors go to different banks, so a
+   gather doesn't wait for the scatter before it. Depth 1 data is counted
+   by the banked kernel. */
+__attribute__((target("avx512f,avx512cd"))) void CountAvx512(
+		int8_t deep, const uint8_t *data, size_t len, uint32_t *frequencies) {
+	if (deep == 1 || len < kMinLenBanked2) {
+		CountBanked(deep, data, len, frequencies);
+		return;
+	}
+
+	uint32_t *extra_banks = GetExtraPairBanks();
+	uint32_t *banks[kCountBanks] = {frequencies, extra_banks,
+																	extra_banks + kSizePairs,
+																	extra_banks + 2 * kSizePairs};
+	const __m512i ones = _mm512_set1_epi32(1);
+	size_t i = 0;
+	for (size_t bank = 0; i + 17 <= len; i += 16, bank = (bank + 1) % kCountBanks) {
+		__m512i first =
+				_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(data + i)));
+		__m512i second =
+				_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(data + i + 1)));
+		__m512i indexes = _mm512_or_si512(first, _mm512_slli_epi32(second, 8));
+		__m512i counts =
+				_mm512_add_epi32(PopCount16(_mm512_conflict_epi32(indexes)), ones);
+		__m512i values = _mm512_i32gather_epi32(indexes, banks[bank], 4);
+		_mm512_i32scatter_epi32(banks[bank], indexes,
+														_mm512_add_epi32(values, counts), 4);
+	}
+	CountScalar(deep, data + i, len - i, frequencies);
+
+	for (size_t k = 0; k < kSizePairs; k++) {
+		frequencies[k] += banks[1][k] + banks[2][k] + banks[3][k];
+		banks[1][k] = 0;
+		banks[2][k] = 0;
+		banks[3][k] = 0;
+	}
+}
+
+#endif
+
+using CountFunction = void (*)(int8_t, const uint8_t *, size_t, uint32_t *);
+
+CountFunction GetCountFunction(HistogramKernel kernel) {
+	switch (kernel) {
+#if defined(PTRID_X86)
+		case HistogramKernel::kSse2:
+			return CountSse2;
+		case HistogramKernel::kAvx2:
+			return CountAvx2;
+		case HistogramKernel::kAvx512:
+			return CountAvx512;
+#endif
+		default:
+			return CountScalar;
+	}
+}
+
+}	 // namespace
+
+bool IsSupportedHistogramKernel(HistogramKernel kernel) {
+#if defined(PTRID_X86)
+	__builtin_cpu_init();
+	switch (kernel) {
+		case HistogramKernel::kScalar:
+			return true;
+		case HistogramKernel::kSse2:
+			return __builtin_cpu_supports("sse2");
+		case HistogramKernel::kAvx2:
+			return __builtin_cpu_supports("avx2");
+		case HistogramKernel::kAvx512:
+			return __builtin_cpu_supports("avx512f") &&
+						 __builtin_cpu_supports("avx512cd");
+	}
+	return false;
+#else
+	return kernel == HistogramKernel::kScalar;
+#endif
+}
+
+/* Gather and scatter of the AVX-512 kernel are slower than banked scalar
+   increments on the cores we measured, so AVX2 is preferred to it. */
+HistogramKernel GetBestHistogramKernel() {
+	static const HistogramKernel best = []() {
+		for (HistogramKernel kernel :
+				 {HistogramKernel::kAvx2, HistogramKernel::kAvx512,
+					HistogramKernel::kSse2})
+			if (IsSupportedHistogramKernel(kernel)) return kernel;
+		return HistogramKernel::kScalar;
+	}();
+	return best;
+}
+
+HistogramKernel GetBestScoringKernel() {
+	static const HistogramKernel best = []() {
+		for (HistogramKernel kernel :
+				 {HistogramKernel::kAvx512, HistogramKernel::kAvx2})
+			if (IsSupportedHistogramKernel(kernel)) return kernel;
+		return HistogramKernel::kScalar;
+	}();
+	return best;
+}
+
+const char *GetHistogramKernelName(HistogramKernel kernel) {
+	switch (kernel) {
+		case HistogramKernel::kSse2:
+			return "sse2";
+		case HistogramKernel::kAvx2:
+			return "avx2";
+		case HistogramKernel::kAvx512:
+			return "avx512";
+		default:
+			return "scalar";
+	}
+}
+
+void CountFrequencies(int8_t deep, const uint8_t *data, size_t len,
+											uint32_t *frequencies) {
+	static const CountFunction count = GetCountFunction(GetBestHistogramKernel());
+	assert((deep == 1 || deep == 2) && "ptrid::CountFrequencies: Unsupported deep.");
+	count(deep, data, len, frequencies);
+}
+
+void CountFrequencies(HistogramKernel kernel, int8_t deep, const uint8_t *data,
+											size_t len, uint32_t *frequencies) {
+	if (!IsSupportedHistogramKernel(kernel))
+		throw std::invalid_argument(
+				"ptrid::CountFrequencies: kernel isn't supported by CPU - " +
+				std::string(GetHistogramKernelName(kernel)));
+	assert((deep == 1 || deep == 2) && "ptrid::CountFrequencies: Unsupported deep.");
+	GetCountFunction(kernel)(deep, data, len, frequencies);
+}
+
+void TouchedHistogram::Count(int8_t deep, const uint8_t *data, size_t len) {
+	assert(((deep == 1 && counts_.size() == 256) || (deep == 2 && counts_.size() == 65536)) &&
+				 "ptrid::TouchedHistogram::Count: Unsupported deep.");
+	/* every byte may touch a new cell, long data goes to the dense kernels */
+	if (dense_ || touched_.size() + len > counts_.size() / kDenseDivisor) {
+		CountFrequencies(deep, data, len, GetDenseCounts().data());
+	} else if (deep == 1) {
+		for (size_t i = 0; i < len; i++)
+			Add(data[i]);
+	} else {
+		for (size_t i = 0, j = 1; j < len; i++, j++)
+			Add(data[i] + data[j] * 256);
+	}
+}
+
+void TouchedHistogram::Merge(const TouchedHistogram &other) {
+	assert((counts_.size() == other.counts_.size()) &&
+				 "ptrid::TouchedHistogram::Merge: sizes of histograms differ.");
+	if (other.dense_) {
+		std::vector<uint32_t> &counts = GetDenseCounts();
+		for (size_t cell = 0; cell < counts.size(); cell++)
+			counts[cell] += other.counts_[cell];
+	} else {
+		for (uint32_t cell : other.touched_)
+			Add(cell, other.counts_[cell]);
+	}
+}
+
+void TouchedHistogram::Clean() {
+	if (dense_)
+		std::fill(counts_.begin(), counts_.end(), 0);
+	else
+		for (uint32_t cell : touched_) counts_[cell] = 0;
+	touched_.clear();
+	dense_ = false;
+}
+
+uint64_t TouchedHistogram::GetCountElements() const {
+	uint64_t count = 0;
+	ForEach([&count](size_t, uint32_t count_cell) { count += count_cell; });
+	return count;
+}
+
+}	 // namespace ptrid
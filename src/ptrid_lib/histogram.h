@@ -0,0 +1,110 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+namespace ptrid {
+
+/* Variants of the counting kernel. kScalar is the reference loop, other
+   kernels spread increments over several sub-histograms (banks), so runs
+   of one byte or pair don't serialize on store-to-load forwarding. */
+enum class HistogramKernel { kScalar, kSse2, kAvx2, kAvx512 };
+
+/* Best kernel supported by the running CPU, chosen once. */
+HistogramKernel GetBestHistogramKernel();
+
+/* Best kernel for scoring by models: unlike counting it has no scatter, so
+   AVX-512 is preferred. */
+HistogramKernel GetBestScoringKernel();
+
+bool IsSupportedHistogramKernel(HistogramKernel kernel);
+
+const char *GetHistogramKernelName(HistogramKernel kernel);
+
+/* Adds bytes (deep 1) or overlapping pairs data[i] + data[i + 1] * 256
+   (deep 2) of @data to @frequencies. The EOF sentinel isn't added. */
+void CountFrequencies(int8_t deep, const uint8_t *data, size_t len,
+											uint32_t *frequencies);
+
+void CountFrequencies(HistogramKernel kernel, int8_t deep, const uint8_t *data,
+											size_t len, uint32_t *frequencies);
+
+/* Histogram which keeps the list of its non-zero cells while they are few,
+   so clearing, merging, counting and walking it cost O(non-zero cells).
+   When more than size / kDenseDivisor cells are touched, the list is
+   dropped and the histogram works as a dense one until Clean(). */
+class TouchedHistogram {
+ private:
+	static constexpr size_t kDenseDivisor = 16;
+
+	std::vector<uint32_t> counts_;
+	std::vector<uint32_t> touched_; /* non-zero cells, while not dense */
+	bool dense_ = false;
+
+	void Touch(size_t cell) {
+		if (touched_.size() < counts_.size() / kDenseDivisor)
+			touched_.push_back(cell);
+		else
+			SetDense();
+	}
+
+	void SetDense() {
+		dense_ = true;
+		touched_.clear();
+	}
+
+ public:
+	TouchedHistogram() = default;
+
+	explicit TouchedHistogram(size_t size) : counts_(size, 0) {
+		touched_.reserve(size / kDenseDivisor);
+	}
+
+	void Add(size_t cell, uint32_t count = 1) {
+		assert((cell < counts_.size()) && "ptrid::TouchedHistogram::Add: @cell is out of bounds.");
+		if (counts_[cell] == 0 && count != 0 && !dense_) Touch(cell);
+		counts_[cell] += count;
+	}
+
+	/* Adds bytes (deep 1) or pairs (deep 2) of @data as CountFrequencies. */
+	void Count(int8_t deep, const uint8_t *data, size_t len);
+
+	void Merge(const TouchedHistogram &other);
+
+	void Clean();
+
+	uint64_t GetCountElements() const;
+
+	/* Calls @action(cell, count) for non-zero cells. */
+	template <class Function>
+	void ForEach(Function action) const {
+		if (dense_) {
+			for (size_t cell = 0; cell < counts_.size(); cell++)
+				if (counts_[cell] != 0) action(cell, counts_[cell]);
+		} else {
+			for (uint32_t cell : touched_) action(cell, counts_[cell]);
+		}
+	}
+
+	const std::vector<uint32_t> &GetCounts() const { return counts_; }
+
+	/* For writers which don't report the cells they touch, the histogram
+	   becomes dense. */
+	std::vector<uint32_t> &GetDenseCounts() {
+		SetDense();
+		return counts_;
+	}
+
+	/* Non-zero cells in the order of touching, valid if !IsDense(). */
+	std::span<const uint32_t> GetTouched() const { return touched_; }
+
+	bool IsDense() const { return dense_; }
+
+	size_t GetSize() const { return counts_.size(); }
+};
+
+}	 // namespace ptrid
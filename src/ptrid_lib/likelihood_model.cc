@@ -0,0 +1,32 @@
+#include "likelihood_model.h"
+
+#include <cmath>
+
+namespace ptrid {
+
+template <class Real>
+void LikelihoodModel::Create(const BasicMarkovChain<Real> &chain) {
+	size_base_set_ = chain.GetSizeSet();
+	std::span<const Real> transitions = chain.GetTransitions();
+	log_probabilities_.resize(transitions.size());
+	for (size_t i = 0; i < transitions.size(); i++)
+		log_probabilities_[i] = std::log10((long double)transitions[i]);
+}
+
+double LikelihoodModel::Score(std::span<const uint32_t> frequencies) const {
+	assert((frequencies.size() == log_probabilities_.size()) &&
+				 "ptrid::LikelihoodModel::Score: sizes of @frequencies and the model differ.");
+	const uint32_t *counts = frequencies.data();
+	const double *logs = log_probabilities_.data();
+	double score = 0.;
+	/* absent pairs are skipped, so -inf of them doesn't give NaN */
+	for (size_t i = 0; i < log_probabilities_.size(); i++)
+		score += counts[i] != 0 ? counts[i] * logs[i] : 0.;
+	return score;
+}
+
+template void LikelihoodModel::Create(const BasicMarkovChain<float> &);
+template void LikelihoodModel::Create(const BasicMarkovChain<double> &);
+template void LikelihoodModel::Create(const BasicMarkovChain<long double> &);
+
+}	 // namespace ptrid
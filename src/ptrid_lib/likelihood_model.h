@@ -0,0 +1,54 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+#include "aligned_allocator.h"
+#include "markov_chain.h"
+
+namespace ptrid {
+
+/* Markov chain compiled for scoring: log10 of its transition probabilities
+   are taken once, in the order of histograms of ReaderBytes (from + to *
+   size of the set), so scoring a histogram is a dot product. */
+class LikelihoodModel {
+ private:
+	std::vector<double, AlignedAllocator<double>> log_probabilities_;
+	size_t size_base_set_ = 0;
+
+ public:
+	LikelihoodModel() = default;
+
+	template <class Real>
+	explicit LikelihoodModel(const BasicMarkovChain<Real> &chain) {
+		Create(chain);
+	}
+
+	template <class Real>
+	void Create(const BasicMarkovChain<Real> &chain);
+
+	/* log10 of the likelihood of a sample with pairs @frequencies, -inf if
+	   the sample has a pair which the chain never gives. */
+	double Score(std::span<const uint32_t> frequencies) const;
+
+	double GetLogProbability(size_t from, size_t to) const {
+		assert((from < size_base_set_ && to < size_base_set_) &&
+					 "ptrid::LikelihoodModel::GetLogProbability: @from or @to is out of bounds.");
+		return log_probabilities_[from + to * size_base_set_];
+	}
+
+	/* The whole table, indexes are the same as of a histogram of pairs. */
+	std::span<const double> GetLogProbabilities() const { return log_probabilities_; }
+
+	size_t GetSizeSet() const { return size_base_set_; }
+};
+
+extern template void LikelihoodModel::Create(const BasicMarkovChain<float> &);
+extern template void LikelihoodModel::Create(const BasicMarkovChain<double> &);
+extern template void LikelihoodModel::Create(const BasicMarkovChain<long double> &);
+
+}	 // namespace ptrid
@@ -3,33 +3,45 @@
 
 namespace ptrid {
 
-void MarkovChain::Create(const ptrid::ProbabilisticScheme &scheme_deep_2) {
+template <class Real>
+void BasicMarkovChain<Real>::Create(const BasicProbabilisticScheme<Real> &scheme_deep_2) {
+	Create(BasicProbabilisticScheme<Real>(scheme_deep_2));
+}
+
+template <class Real>
+void BasicMarkovChain<Real>::Create(BasicProbabilisticScheme<Real> &&scheme_deep_2) {
 	if (scheme_deep_2.GetDeep() != 2)
 		throw std::invalid_argument(
 				"ptrid::MarkovChain::Create: @scheme_deep_2 must has deep equal 2");
 
-	original_scheme_ = scheme_deep_2;
-	auto size_base_set = scheme_deep_2.GetSizeSet();
-	matrix_.resize(size_base_set);
-	for (size_t i = 0; i < size_base_set; i++) {
-		matrix_[i].resize(size_base_set);
-		for (int j = 0; j < 256; j++) {
-			if (scheme_deep_2.GetProbability(i, j) < 1e-10) {
-				matrix_[i][j] = 0;
-				continue;
-			}
-			matrix_[i][j] =
-					scheme_deep_2.GetProbability(i, j) / scheme_deep_2.GetProbability(i);
+	original_scheme_ = std::move(scheme_deep_2);
+	size_t size_base_set = original_scheme_.GetSizeSet();
+	matrix_.resize(size_base_set * size_base_set);
+	/* the scheme has the same order, both tables are walked linearly */
+	for (size_t to = 0; to < size_base_set; to++)
+		for (size_t from = 0; from < size_base_set; from++) {
+			Real probability = original_scheme_.GetProbability(from, to);
+			if (probability < 1e-10)
+				matrix_[from + to * size_base_set] = 0;
+			else
+				matrix_[from + to * size_base_set] =
+						probability / original_scheme_.GetProbability(from);
 		}
-	}
 }
 
-void MarkovChain::useAdditiveSmoothing(long double koef) {
+template <class Real>
+void BasicMarkovChain<Real>::useAdditiveSmoothing(Real koef) {
 	original_scheme_.useAdditiveSmoothing(koef);
-	for (int i = 0; i < original_scheme_.GetSizeSet(); i++)
-		for (int j = 0; j < original_scheme_.GetSizeSet(); j++)
-			matrix_[i][j] = original_scheme_.GetProbability(i, j) /
-											original_scheme_.GetProbability(i);
+	size_t size_base_set = original_scheme_.GetSizeSet();
+	for (size_t to = 0; to < size_base_set; to++)
+		for (size_t from = 0; from < size_base_set; from++)
+			matrix_[from + to * size_base_set] =
+					original_scheme_.GetProbability(from, to) /
+					original_scheme_.GetProbability(from);
 }
 
+template class BasicMarkovChain<float>;
+template class BasicMarkovChain<double>;
+template class BasicMarkovChain<long double>;
+
 }	 // namespace ptrid
@@ -4,68 +4,97 @@
 #include <stdint.h>
 
 #include <iostream>
+#include <span>
 #include <vector>
 
+#include "aligned_allocator.h"
 #include "probabilistic_scheme.h"
 
 namespace ptrid {
 
-class MarkovChain {
+/* Transition probabilities are kept in one aligned table in the order of
+   histograms of ReaderBytes: P(to | from) is matrix_[from + to * size]. */
+template <class Real>
+class BasicMarkovChain {
  private:
-	std::vector<std::vector<long double>> matrix_;
-	ptrid::ProbabilisticScheme original_scheme_;
+	std::vector<Real, AlignedAllocator<Real>> matrix_;
+	BasicProbabilisticScheme<Real> original_scheme_;
 
  public:
-	MarkovChain() {
-		ptrid::ProbabilisticScheme scheme(2, 1, std::vector<uint32_t>({1}));
+	using Value = Real;
+
+	BasicMarkovChain() {
+		BasicProbabilisticScheme<Real> scheme(2, 1, std::vector<uint32_t>({1}));
 		original_scheme_ = std::move(scheme);
-		matrix_.push_back(std::vector<long double>({1.}));
+		matrix_.push_back(1.);
 	}
 
-	MarkovChain(const ptrid::ProbabilisticScheme &scheme_deep_2) {
+	BasicMarkovChain(const BasicProbabilisticScheme<Real> &scheme_deep_2) {
 		Create(scheme_deep_2);
 	}
 
-	MarkovChain(const MarkovChain &other) {
+	BasicMarkovChain(BasicProbabilisticScheme<Real> &&scheme_deep_2) {
+		Create(std::move(scheme_deep_2));
+	}
+
+	BasicMarkovChain(const BasicMarkovChain &other) {
 		matrix_ = other.matrix_;
 		original_scheme_ = other.original_scheme_;
 	}
 
-	MarkovChain(const MarkovChain &&other) {
-		matrix_ = std::move(other.matrix_);
-		original_scheme_ = std::move(other.original_scheme_);
-	}
+	BasicMarkovChain(BasicMarkovChain &&other) noexcept
+			: matrix_(std::move(other.matrix_)),
+				original_scheme_(std::move(other.original_scheme_)) {}
 
-	MarkovChain &operator=(const MarkovChain &other) {
+	BasicMarkovChain &operator=(const BasicMarkovChain &other) {
 		matrix_ = other.matrix_;
 		original_scheme_ = other.original_scheme_;
 		return *this;
 	}
 
-	MarkovChain &operator=(const MarkovChain &&other) {
+	BasicMarkovChain &operator=(BasicMarkovChain &&other) noexcept {
 		matrix_ = std::move(other.matrix_);
 		original_scheme_ = std::move(other.original_scheme_);
 		return *this;
 	}
 
-	void Create(const ptrid::ProbabilisticScheme &scheme_deep_2);
+	void Create(const BasicProbabilisticScheme<Real> &scheme_deep_2);
 
-	long double GetProbability(size_t from, size_t to)  const {
+	/* Takes the scheme instead of copying it. */
+	void Create(BasicProbabilisticScheme<Real> &&scheme_deep_2);
+
+	Real GetProbability(size_t from, size_t to)  const {
 		assert(
-				(from < matrix_.size() && to < matrix_.size()) &&
+				(from < GetSizeSet() && to < GetSizeSet()) &&
 				"ptrid::MarkovChain::GetProbability: @from or @to is out of bounds.");
-		return matrix_[from][to];
+		return matrix_[from + to * GetSizeSet()];
 	}
 
-	long double GetProbability(size_t condition)  const {
-		assert((condition < matrix_.size()) &&
+	Real GetProbability(size_t condition)  const {
+		assert((condition < GetSizeSet()) &&
 					 "ptrid::MarkovChain::GetProbability: @condition is out of bounds.");
 		return original_scheme_.GetProbability(condition);
 	}
 
-	size_t GetSizeSet()  const { return matrix_.size(); }
+	/* P(to | from) for all @from, contiguous. */
+	std::span<const Real> GetColumn(size_t to) const {
+		assert((to < GetSizeSet()) &&
+					 "ptrid::MarkovChain::GetColumn: @to is out of bounds.");
+		return std::span<const Real>(matrix_).subspan(to * GetSizeSet(), GetSizeSet());
+	}
+
+	/* The whole table, indexes are the same as of a histogram of pairs. */
+	std::span<const Real> GetTransitions() const { return matrix_; }
 
-	void useAdditiveSmoothing(long double koef = 10.);
+	size_t GetSizeSet()  const { return original_scheme_.GetSizeSet(); }
+
+	void useAdditiveSmoothing(Real koef = 10.);
 };
 
+extern template class BasicMarkovChain<float>;
+extern template class BasicMarkovChain<double>;
+extern template class BasicMarkovChain<long double>;
+
+using MarkovChain = BasicMarkovChain<long double>;
+
 }	 // namespace ptrid
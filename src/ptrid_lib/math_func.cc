@@ -1,9 +1,266 @@
 #include "math_func.h"
 
+#include <cmath>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 namespace ptrid {
 
-long double GetInfoDistance(const ProbabilisticScheme &scheme_numerator,
-														const ProbabilisticScheme &scheme_denominator) {
+/* Cells of schemes are read as flat arrays, which are the same for both
+   deeps: the loops don't branch on the deep and don't call accessors with
+   checks per cell. */
+
+namespace {
+
+/* type of sums of cells of @Real, as of the vector kernels */
+template <class Real>
+using Sum = std::conditional_t<std::is_same_v<Real, long double>, long double, double>;
+
+/* Sum of @w * x * log2 (@x / @y) over cells with positive x and y, @w and
+   @y are ones if they aren't used. The scalar reference. */
+template <bool kWeights, bool kDivisor, class Real>
+Sum<Real> SumXLog2Scalar(const Real *w, const Real *x, const Real *y, size_t size) {
+	Sum<Real> sum = 0.;
+	for (size_t i = 0; i < size; i++) {
+		if (!(x[i] > 0)) continue;
+		Sum<Real> term = 0.;
+		if constexpr (kDivisor) {
+			if (!(y[i] > 0)) continue;
+			term = x[i] * std::log2((Sum<Real>)x[i] / y[i]);
+		} else {
+			term = x[i] * std::log2((Sum<Real>)x[i]);
+		}
+		if constexpr (kWeights) term *= w[i];
+		sum += term;
+	}
+	return sum;
+}
+
+/* Sum of (@test - @theory)^2 / @theory over cells with positive theory. */
+template <class Real>
+Sum<Real> SumChi2Scalar(const Real *test, const Real *theory, size_t size) {
+	Sum<Real> xi2 = 0.;
+	for (size_t i = 0; i < size; i++)
+		if (theory[i] > 0)
+			xi2 += ((Sum<Real>)test[i] - theory[i]) * ((Sum<Real>)test[i] - theory[i]) / theory[i];
+	return xi2;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* 2 / (k ln 2) for odd k, the series of 2 atanh t / ln 2 */
+constexpr double kLog2Series[6] = {2.8853900817779268, 0.9617966939259757,
+																	 0.5770780163555853, 0.41219858311113244,
+																	 0.3205988979753252, 0.2623081892525388};
+
+__attribute__((target("avx2,fma"))) inline __m256d LoadAvx2(const double *values) {
+	return _mm256_loadu_pd(values);
+}
+
+__attribute__((target("avx2,fma"))) inline __m256d LoadAvx2(const float *values) {
+	return _mm256_cvtps_pd(_mm_loadu_ps(values));
+}
+
+__attribute__((target("avx2,fma"))) inline __m256d SeriesAvx2(__m256d m) {
+	__m256d t = _mm256_div_pd(_mm256_sub_pd(m, _mm256_set1_pd(1.)),
+														_mm256_add_pd(m, _mm256_set1_pd(1.)));
+	__m256d t2 = _mm256_mul_pd(t, t);
+	__m256d poly = _mm256_set1_pd(kLog2Series[5]);
+	for (int k = 4; k >= 0; k--)
+		poly = _mm256_fmadd_pd(poly, t2, _mm256_set1_pd(kLog2Series[k]));
+	return _mm256_mul_pd(poly, t);
+}
+
+/* FastLog2: x = m * 2^e with m in [sqrt(1/2), sqrt(2)), log2 m is
+   2 atanh(t) / ln 2 with t = (m - 1) / (m + 1), |t| < 0.1716. The series is
+   cut after t^11, so the absolute error is below 2.6e-11 plus rounding,
+   kMaxErrorFastLog2. Only positive normal numbers are valid, callers mask
+   the rest. */
+__attribute__((target("avx2,fma"))) inline __m256d Log2Avx2(__m256d x) {
+	__m256i bits = _mm256_castpd_si256(x);
+	__m256d m = _mm256_castsi256_pd(
+			_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000fffffffffffffLL)),
+											_mm256_set1_epi64x(0x3ff0000000000000LL)));
+	/* the biased exponent is put in the mantissa of 2^52 */
+	__m256i exponent =
+			_mm256_and_si256(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(0x7ff));
+	__m256d e = _mm256_sub_pd(
+			_mm256_castsi256_pd(_mm256_or_si256(exponent, _mm256_set1_epi64x(0x4330000000000000LL))),
+			_mm256_set1_pd(4503599627370496. + 1023.));
+	__m256d is_big = _mm256_cmp_pd(m, _mm256_set1_pd(M_SQRT2), _CMP_GT_OQ);
+	m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), is_big);
+	e = _mm256_add_pd(e, _mm256_and_pd(is_big, _mm256_set1_pd(1.)));
+	return _mm256_add_pd(e, SeriesAvx2(m));
+}
+
+__attribute__((target("avx2,fma"))) inline double SumLanesAvx2(__m256d sum) {
+	__m128d half = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+/* Masked cells add zero bits, whatever the log of them is. */
+template <bool kWeights, bool kDivisor, class Real>
+__attribute__((target("avx2,fma"))) double SumXLog2Avx2(const Real *w, const Real *x,
+																											 const Real *y, size_t size) {
+	const __m256d zero = _mm256_setzero_pd();
+	__m256d sum = zero;
+	size_t i = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m256d vx = LoadAvx2(x + i);
+		__m256d mask = _mm256_cmp_pd(vx, zero, _CMP_GT_OQ);
+		__m256d ratio = vx;
+		if constexpr (kDivisor) {
+			__m256d vy = LoadAvx2(y + i);
+			mask = _mm256_and_pd(mask, _mm256_cmp_pd(vy, zero, _CMP_GT_OQ));
+			ratio = _mm256_div_pd(vx, vy);
+		}
+		__m256d term = _mm256_mul_pd(vx, Log2Avx2(ratio));
+		if constexpr (kWeights) term = _mm256_mul_pd(term, LoadAvx2(w + i));
+		sum = _mm256_add_pd(sum, _mm256_and_pd(mask, term));
+	}
+	return SumLanesAvx2(sum) + SumXLog2Scalar<kWeights, kDivisor, Real>(
+																 kWeights ? w + i : nullptr, x + i,
+																 kDivisor ? y + i : nullptr, size - i);
+}
+
+template <class Real>
+__attribute__((target("avx2,fma"))) double SumChi2Avx2(const Real *test,
+																											const Real *theory, size_t size) {
+	const __m256d zero = _mm256_setzero_pd();
+	__m256d sum = zero;
+	size_t i = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m256d vtest = LoadAvx2(test + i);
+		__m256d vtheory = LoadAvx2(theory + i);
+		__m256d mask = _mm256_cmp_pd(vtheory, zero, _CMP_GT_OQ);
+		__m256d diff = _mm256_sub_pd(vtest, vtheory);
+		__m256d term = _mm256_div_pd(_mm256_mul_pd(diff, diff), vtheory);
+		sum = _mm256_add_pd(sum, _mm256_and_pd(mask, term));
+	}
+	return SumLanesAvx2(sum) + SumChi2Scalar(test + i, theory + i, size - i);
+}
+
+__attribute__((target("avx512f"))) inline __m512d LoadAvx512(const double *values) {
+	return _mm512_loadu_pd(values);
+}
+
+__attribute__((target("avx512f"))) inline __m512d LoadAvx512(const float *values) {
+	return _mm512_cvtps_pd(_mm256_loadu_ps(values));
+}
+
+/* The same FastLog2, getmant and getexp split the number. */
+__attribute__((target("avx512f"))) inline __m512d Log2Avx512(__m512d x) {
+	__m512d m = _mm512_getmant_pd(x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero);
+	__m512d e = _mm512_getexp_pd(x);
+	__mmask8 is_big = _mm512_cmp_pd_mask(m, _mm512_set1_pd(M_SQRT2), _CMP_GT_OQ);
+	m = _mm512_mask_mul_pd(m, is_big, m, _mm512_set1_pd(0.5));
+	e = _mm512_mask_add_pd(e, is_big, e, _mm512_set1_pd(1.));
+	__m512d t = _mm512_div_pd(_mm512_sub_pd(m, _mm512_set1_pd(1.)),
+														_mm512_add_pd(m, _mm512_set1_pd(1.)));
+	__m512d t2 = _mm512_mul_pd(t, t);
+	__m512d poly = _mm512_set1_pd(kLog2Series[5]);
+	for (int k = 4; k >= 0; k--)
+		poly = _mm512_fmadd_pd(poly, t2, _mm512_set1_pd(kLog2Series[k]));
+	return _mm512_fmadd_pd(poly, t, e);
+}
+
+template <bool kWeights, bool kDivisor, class Real>
+__attribute__((target("avx512f"))) double SumXLog2Avx512(const Real *w, const Real *x,
+																												const Real *y, size_t size) {
+	const __m512d zero = _mm512_setzero_pd();
+	__m512d sum = zero;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		__m512d vx = LoadAvx512(x + i);
+		__mmask8 mask = _mm512_cmp_pd_mask(vx, zero, _CMP_GT_OQ);
+		__m512d ratio = vx;
+		if constexpr (kDivisor) {
+			__m512d vy = LoadAvx512(y + i);
+			mask &= _mm512_cmp_pd_mask(vy, zero, _CMP_GT_OQ);
+			ratio = _mm512_div_pd(vx, vy);
+		}
+		__m512d term = _mm512_mul_pd(vx, Log2Avx512(ratio));
+		if constexpr (kWeights) term = _mm512_mul_pd(term, LoadAvx512(w + i));
+		sum = _mm512_mask_add_pd(sum, mask, sum, term);
+	}
+	return _mm512_reduce_add_pd(sum) + SumXLog2Scalar<kWeights, kDivisor, Real>(
+																					kWeights ? w + i : nullptr, x + i,
+																					kDivisor ? y + i : nullptr, size - i);
+}
+
+template <class Real>
+__attribute__((target("avx512f"))) double SumChi2Avx512(const Real *test,
+																												 const Real *theory, size_t size) {
+	const __m512d zero = _mm512_setzero_pd();
+	__m512d sum = zero;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		__m512d vtest = LoadAvx512(test + i);
+		__m512d vtheory = LoadAvx512(theory + i);
+		__mmask8 mask = _mm512_cmp_pd_mask(vtheory, zero, _CMP_GT_OQ);
+		__m512d diff = _mm512_sub_pd(vtest, vtheory);
+		sum = _mm512_mask_add_pd(sum, mask, sum,
+														 _mm512_div_pd(_mm512_mul_pd(diff, diff), vtheory));
+	}
+	return _mm512_reduce_add_pd(sum) + SumChi2Scalar(test + i, theory + i, size - i);
+}
+
+#endif
+
+void CheckKernel(HistogramKernel kernel, const char *name_func) {
+	if (!IsSupportedHistogramKernel(kernel))
+		throw std::invalid_argument(std::string("ptrid::") + name_func +
+																": kernel isn't supported by CPU - " +
+																GetHistogramKernelName(kernel));
+}
+
+/* long double has no vector kernels and is summed by the reference. */
+template <bool kWeights, bool kDivisor, class Real>
+Sum<Real> SumXLog2(HistogramKernel kernel, const Real *w, const Real *x, const Real *y,
+									 size_t size) {
+#if defined(__x86_64__) || defined(__i386__)
+	if constexpr (!std::is_same_v<Real, long double>) {
+		if (kernel == HistogramKernel::kAvx2)
+			return SumXLog2Avx2<kWeights, kDivisor, Real>(w, x, y, size);
+		if (kernel == HistogramKernel::kAvx512)
+			return SumXLog2Avx512<kWeights, kDivisor, Real>(w, x, y, size);
+	}
+#endif
+	return SumXLog2Scalar<kWeights, kDivisor, Real>(w, x, y, size);
+}
+
+template <class Real>
+Sum<Real> SumChi2(HistogramKernel kernel, const Real *test, const Real *theory, size_t size) {
+#if defined(__x86_64__) || defined(__i386__)
+	if constexpr (!std::is_same_v<Real, long double>) {
+		if (kernel == HistogramKernel::kAvx2)
+			return SumChi2Avx2(test, theory, size);
+		if (kernel == HistogramKernel::kAvx512)
+			return SumChi2Avx512(test, theory, size);
+	}
+#endif
+	return SumChi2Scalar(test, theory, size);
+}
+
+}	 // namespace
+
+template <class Real>
+Real GetInfoDistance(const BasicProbabilisticScheme<Real> &scheme_numerator,
+										 const BasicProbabilisticScheme<Real> &scheme_denominator) {
+	return GetInfoDistance(GetBestScoringKernel(), scheme_numerator, scheme_denominator);
+}
+
+template <class Real>
+Real GetInfoDistance(HistogramKernel kernel,
+										 const BasicProbabilisticScheme<Real> &scheme_numerator,
+										 const BasicProbabilisticScheme<Real> &scheme_denominator) {
 	assert(
 			(scheme_numerator.GetDeep() == scheme_denominator.GetDeep()) &&
 			"ptrid::GetInfoDistance: probabilistic schemes must have equal deeps.");
@@ -11,93 +268,105 @@ long double GetInfoDistance(const ProbabilisticScheme &scheme_numerator,
 			(scheme_numerator.GetSizeScheme() ==
 			 scheme_denominator.GetSizeScheme()) &&
 			"ptrid::GetInfoDistance: probabilistic schemes must have equal sizes.");
+	CheckKernel(kernel, "GetInfoDistance");
 
-	long double info_distance = 0.;
-	if (scheme_numerator.GetDeep() == 1) {
-		for (size_t i = 0; i < scheme_numerator.GetSizeSet(); i++)
-			if (scheme_numerator.GetProbability(i) > 0 &&
-					scheme_denominator.GetProbability(i) > 0)
-				info_distance += scheme_numerator.GetProbability(i) *
-												 (log2l(scheme_numerator.GetProbability(i) /
-												 				scheme_denominator.GetProbability(i)));
-	} else if (scheme_numerator.GetDeep() == 2) {
-		for (size_t i = 0; i < scheme_numerator.GetSizeSet(); i++)
-			for (size_t j = 0; j < scheme_numerator.GetSizeSet(); j++)
-				if (scheme_numerator.GetProbability(i, j) > 0 &&
-						scheme_denominator.GetProbability(i, j) > 0)
-					info_distance += scheme_numerator.GetProbability(i, j) *
-													 (log2l(scheme_numerator.GetProbability(i, j) /
-																	scheme_denominator.GetProbability(i, j)));
-	}
-	return info_distance;
+	std::span<const Real> numerator = scheme_numerator.GetProbabilities();
+	std::span<const Real> denominator = scheme_denominator.GetProbabilities();
+	return SumXLog2<false, true, Real>(kernel, nullptr, numerator.data(), denominator.data(),
+																		 numerator.size());
+}
+
+template <class Real>
+Real GetChi2(const BasicProbabilisticScheme<Real> &scheme_test,
+						 const BasicProbabilisticScheme<Real> &scheme_theory) {
+	return GetChi2(GetBestScoringKernel(), scheme_test, scheme_theory);
 }
 
-long double GetChi2(const ProbabilisticScheme &scheme_test,
-										const ProbabilisticScheme &scheme_theory) {
+template <class Real>
+Real GetChi2(HistogramKernel kernel, const BasicProbabilisticScheme<Real> &scheme_test,
+						 const BasicProbabilisticScheme<Real> &scheme_theory) {
 	assert((scheme_test.GetDeep() == scheme_theory.GetDeep()) &&
 				 "GetChi2: probabilistic schemes must have equal deeps.");
 	assert((scheme_test.GetSizeScheme() == scheme_theory.GetSizeScheme()) &&
 				 "GetChi2: probabilistic schemes must have equal sizes.");
+	CheckKernel(kernel, "GetChi2");
 
-	long double xi2 = 0.;
-	if (scheme_test.GetDeep() == 1) {
-		for (size_t i = 0; i < scheme_test.GetSizeSet(); i++)
-			if (scheme_theory.GetNumerator(i) > 0)
-				xi2 += powl(scheme_test.GetNumerator(i) - scheme_theory.GetNumerator(i),
-										2) /
-							 scheme_theory.GetNumerator(i);
-	} else if (scheme_test.GetDeep() == 2) {
-		for (size_t i = 0; i < scheme_test.GetSizeSet(); i++)
-			for (size_t j = 0; j < scheme_test.GetSizeSet(); j++)
-				if (scheme_theory.GetNumerator(i, j) > 0)
-					xi2 += powl(scheme_test.GetNumerator(i, j) -
-													scheme_theory.GetNumerator(i, j),
-											2) /
-								 scheme_theory.GetNumerator(i, j);
-	}
-	return xi2;
+	std::span<const Real> test = scheme_test.GetNumerators();
+	std::span<const Real> theory = scheme_theory.GetNumerators();
+	return SumChi2(kernel, test.data(), theory.data(), test.size());
 }
 
-long double GetEntropy(const ProbabilisticScheme &PS) {
-		long double entropy = 0.;
-		if (PS.GetDeep() == 1) {
-			for (int i = 0; i < 256; i++) {
-				if (PS.GetProbability(i) > 0)
-					entropy += PS.GetProbability(i) * log2l(PS.GetProbability(i));
-				else 
-					continue;
-			}
-		} else if (PS.GetDeep() == 2) {
-			for (int i = 0; i < 256; i++)
-				for (int j = 0; j < 256; j++)
-					if (PS.GetProbability(i, j) > 0)
-						entropy += PS.GetProbability(i, j) * log2l(PS.GetProbability(i, j));
-					else
-						continue;
-		}
+template <class Real>
+Real GetEntropy(const BasicProbabilisticScheme<Real> &PS) {
+	return GetEntropy(GetBestScoringKernel(), PS);
+}
 
-		return entropy * -1.;
-	}
+template <class Real>
+Real GetEntropy(HistogramKernel kernel, const BasicProbabilisticScheme<Real> &PS) {
+	CheckKernel(kernel, "GetEntropy");
+	std::span<const Real> probabilities = PS.GetProbabilities();
+	return SumXLog2<false, false, Real>(kernel, nullptr, probabilities.data(), nullptr,
+																			probabilities.size()) * -1.;
+}
 
-long double GetEntropy(const MarkovChain &MC) {
-		long double entropy = 0.;
-		for (int i = 0; i < MC.GetSizeSet(); i++) {
-			long double condition_entropy = 0.;
-			if (MC.GetProbability(i) > 0) {
-				for (int j = 0; j < MC.GetSizeSet(); j++) {
-					if (MC.GetProbability(i, j) > 0)
-						condition_entropy += MC.GetProbability(i, j) *
-																log2l(MC.GetProbability(i, j));
-					else
-						continue;
-				}
-
-				entropy += MC.GetProbability(i) * condition_entropy;
-			}
-			
-		}
+template <class Real>
+Real GetEntropy(const BasicMarkovChain<Real> &MC) {
+	return GetEntropy(GetBestScoringKernel(), MC);
+}
 
-		return entropy * -1.;
+template <class Real>
+Real GetEntropy(HistogramKernel kernel, const BasicMarkovChain<Real> &MC) {
+	CheckKernel(kernel, "GetEntropy");
+	size_t size_set = MC.GetSizeSet();
+	std::vector<Real> conditions(size_set);
+	for (size_t from = 0; from < size_set; from++)
+		conditions[from] = MC.GetProbability(from);
+
+	/* columns of the table are contiguous, P(from) weights every cell */
+	Sum<Real> entropy = 0.;
+	for (size_t to = 0; to < size_set; to++)
+		entropy += SumXLog2<true, false, Real>(kernel, conditions.data(), MC.GetColumn(to).data(),
+																					 nullptr, size_set);
+	return entropy * -1.;
 }
 
+template float GetInfoDistance(const BasicProbabilisticScheme<float> &,
+															const BasicProbabilisticScheme<float> &);
+template float GetInfoDistance(HistogramKernel, const BasicProbabilisticScheme<float> &,
+															const BasicProbabilisticScheme<float> &);
+template float GetChi2(const BasicProbabilisticScheme<float> &,
+											const BasicProbabilisticScheme<float> &);
+template float GetChi2(HistogramKernel, const BasicProbabilisticScheme<float> &,
+											const BasicProbabilisticScheme<float> &);
+template float GetEntropy(const BasicProbabilisticScheme<float> &);
+template float GetEntropy(HistogramKernel, const BasicProbabilisticScheme<float> &);
+template float GetEntropy(const BasicMarkovChain<float> &);
+template float GetEntropy(HistogramKernel, const BasicMarkovChain<float> &);
+
+template double GetInfoDistance(const BasicProbabilisticScheme<double> &,
+															const BasicProbabilisticScheme<double> &);
+template double GetInfoDistance(HistogramKernel, const BasicProbabilisticScheme<double> &,
+															const BasicProbabilisticScheme<double> &);
+template double GetChi2(const BasicProbabilisticScheme<double> &,
+											const BasicProbabilisticScheme<double> &);
+template double GetChi2(HistogramKernel, const BasicProbabilisticScheme<double> &,
+											const BasicProbabilisticScheme<double> &);
+template double GetEntropy(const BasicProbabilisticScheme<double> &);
+template double GetEntropy(HistogramKernel, const BasicProbabilisticScheme<double> &);
+template double GetEntropy(const BasicMarkovChain<double> &);
+template double GetEntropy(HistogramKernel, const BasicMarkovChain<double> &);
+
+template long double GetInfoDistance(const BasicProbabilisticScheme<long double> &,
+															const BasicProbabilisticScheme<long double> &);
+template long double GetInfoDistance(HistogramKernel, const BasicProbabilisticScheme<long double> &,
+															const BasicProbabilisticScheme<long double> &);
+template long double GetChi2(const BasicProbabilisticScheme<long double> &,
+											const BasicProbabilisticScheme<long double> &);
+template long double GetChi2(HistogramKernel, const BasicProbabilisticScheme<long double> &,
+											const BasicProbabilisticScheme<long double> &);
+template long double GetEntropy(const BasicProbabilisticScheme<long double> &);
+template long double GetEntropy(HistogramKernel, const BasicProbabilisticScheme<long double> &);
+template long double GetEntropy(const BasicMarkovChain<long double> &);
+template long double GetEntropy(HistogramKernel, const BasicMarkovChain<long double> &);
+
 }	 // namespace ptrid
@@ -7,19 +7,48 @@
 #include <iostream>
 #include <vector>
 
+#include "histogram.h"
 #include "markov_chain.h"
 #include "probabilistic_scheme.h"
 
 namespace ptrid {
 
-long double GetInfoDistance(const ProbabilisticScheme &scheme_numerator,
-														const ProbabilisticScheme &scheme_denominator);
+/* Absolute error of log2 of the vector kernels, see FastLog2 of
+   math_func.cc. */
+constexpr double kMaxErrorFastLog2 = 3e-11;
 
-long double GetChi2(const ProbabilisticScheme &scheme_test,
-										const ProbabilisticScheme &scheme_theory);
+/* Sums are taken in @Real for long double and in double for float and
+   double. kScalar is the exact reference with std::log2, kAvx2 and kAvx512
+   use a polynomial log2, so every term p * log2 x has an absolute error
+   below p * kMaxErrorFastLog2. Schemes of long double are always summed by
+   the reference. */
+template <class Real>
+Real GetInfoDistance(const BasicProbabilisticScheme<Real> &scheme_numerator,
+										 const BasicProbabilisticScheme<Real> &scheme_denominator);
 
-long double GetEntropy(const ProbabilisticScheme &PS);
+template <class Real>
+Real GetInfoDistance(HistogramKernel kernel,
+										 const BasicProbabilisticScheme<Real> &scheme_numerator,
+										 const BasicProbabilisticScheme<Real> &scheme_denominator);
 
-long double GetEntropy(const MarkovChain &MC);
+template <class Real>
+Real GetChi2(const BasicProbabilisticScheme<Real> &scheme_test,
+						 const BasicProbabilisticScheme<Real> &scheme_theory);
 
-}
\ No newline at end of file
+template <class Real>
+Real GetChi2(HistogramKernel kernel, const BasicProbabilisticScheme<Real> &scheme_test,
+						 const BasicProbabilisticScheme<Real> &scheme_theory);
+
+template <class Real>
+Real GetEntropy(const BasicProbabilisticScheme<Real> &PS);
+
+template <class Real>
+Real GetEntropy(HistogramKernel kernel, const BasicProbabilisticScheme<Real> &PS);
+
+template <class Real>
+Real GetEntropy(const BasicMarkovChain<Real> &MC);
+
+template <class Real>
+Real GetEntropy(HistogramKernel kernel, const BasicMarkovChain<Real> &MC);
+
+}
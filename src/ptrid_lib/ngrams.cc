@@ -0,0 +1,124 @@
+#include "ngrams.h"
+
+#include <bit>
+#include <stdexcept>
+#include <string>
+
+namespace ptrid {
+
+void NGramTable::Grow() {
+	size_t capacity = cells_.empty() ? kMinCapacity : cells_.size() * 2;
+	std::vector<Cell> old_cells(capacity, Cell{0, 0});
+	old_cells.swap(cells_);
+	shift_ = 64 - std::countr_zero(capacity);
+	size_t mask = cells_.size() - 1;
+	for (const Cell &cell : old_cells) {
+		if (cell.count == 0) continue;
+		size_t position = GetPosition(cell.key);
+		while (cells_[position].count != 0)
+			position = (position + 1) & mask;
+		cells_[position] = cell;
+	}
+}
+
+uint32_t NGramTable::Add(uint64_t key, uint32_t count) {
+	if (count == 0) return Get(key);
+	/* the load factor is kept below 1/2 */
+	if ((count_keys_ + 1) * 2 > cells_.size())
+		Grow();
+
+	size_t mask = cells_.size() - 1;
+	size_t position = GetPosition(key);
+	while (cells_[position].count != 0 && cells_[position].key != key)
+		position = (position + 1) & mask;
+	if (cells_[position].count == 0) {
+		cells_[position].key = key;
+		count_keys_ += 1;
+	}
+	cells_[position].count += count;
+	return cells_[position].count;
+}
+
+uint32_t NGramTable::Get(uint64_t key) const {
+	if (cells_.empty()) return 0;
+	size_t mask = cells_.size() - 1;
+	for (size_t position = GetPosition(key); cells_[position].count != 0;
+			 position = (position + 1) & mask)
+		if (cells_[position].key == key) return cells_[position].count;
+	return 0;
+}
+
+void NGramTable::Merge(const NGramTable &other) {
+	other.ForEach([this](uint64_t key, uint32_t count) { Add(key, count); });
+}
+
+void NGramTable::Clear() {
+	cells_ = std::vector<Cell>();
+	count_keys_ = 0;
+	shift_ = 64;
+}
+
+uint64_t NGramTable::GetCountElements() const {
+	uint64_t count = 0;
+	ForEach([&count](uint64_t, uint32_t count_key) { count += count_key; });
+	return count;
+}
+
+void NGramCounter::Feed(const uint8_t *block, size_t len) {
+	const int shift = 8 * (deep_ - 1);
+	size_t i = 0;
+	/* the first bytes of data only fill the key */
+	for (; i < len && count_bytes_ + 1 < (uint64_t)deep_; i++, count_bytes_++)
+		key_ = (key_ >> 8) | ((uint64_t)block[i] << shift);
+	count_bytes_ += len - i;
+	for (; i < len; i++) {
+		key_ = (key_ >> 8) | ((uint64_t)block[i] << shift);
+		ngrams_.Add(key_);
+	}
+}
+
+void NGramMarkovChain::Create(int8_t deep, const NGramTable &ngrams) {
+	if (deep < 1 || deep > kMaxDeep)
+		throw std::invalid_argument("ptrid::NGramMarkovChain::Create: Unsupported deep - " +
+																std::to_string(deep));
+
+	deep_ = deep;
+	ngrams_.assign(deep, NGramTable());
+	contexts_.assign(deep, NGramTable());
+	followers_.assign(deep, NGramTable());
+	ngrams_[deep - 1] = ngrams;
+	for (int8_t n = deep; n >= 2; n--) {
+		uint64_t mask_context = GetMaskOfNGram(n - 1);
+		ngrams_[n - 1].ForEach([&](uint64_t key, uint32_t count) {
+			ngrams_[n - 2].Add(key >> 8, count);
+			contexts_[n - 1].Add(key & mask_context, count);
+			followers_[n - 1].Add(key & mask_context, 1);
+		});
+	}
+	count_elements_ = ngrams_[0].GetCountElements();
+}
+
+long double NGramMarkovChain::GetProbability(uint64_t ngram) const {
+	long double probability =
+			(ngrams_[0].Get(ngram >> (8 * (deep_ - 1))) + 1.L) / (count_elements_ + 256.L);
+	for (int8_t n = 2; n <= deep_; n++) {
+		uint64_t key = ngram >> (8 * (deep_ - n));
+		uint64_t context = key & GetMaskOfNGram(n - 1);
+		uint32_t count_context = contexts_[n - 1].Get(context);
+		/* longer contexts containing an unseen one are unseen too */
+		if (count_context == 0) break;
+		long double count_followers = followers_[n - 1].Get(context);
+		probability = (ngrams_[n - 1].Get(key) + count_followers * probability) /
+									(count_context + count_followers);
+	}
+	return probability;
+}
+
+size_t NGramMarkovChain::GetCountKeys() const {
+	size_t count = 0;
+	for (int8_t n = 0; n < deep_; n++)
+		count += ngrams_[n].GetCountKeys() + contexts_[n].GetCountKeys();
+	return count;
+}
+
+}	 // namespace ptrid
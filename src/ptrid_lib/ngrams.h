@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace ptrid {
+
+/* Sequences of more than kMaxDeepDense bytes are counted by NGramTable,
+   shorter ones by dense histograms. */
+constexpr int8_t kMaxDeepDense = 2;
+constexpr int8_t kMaxDeep = 8;
+
+/* Key of the n-gram data[0..n-1]: data[0] + data[1] * 256 + ... , the same
+   order as indexes of dense histograms. */
+inline uint64_t GetMaskOfNGram(int8_t n) {
+	return (n >= 8) ? UINT64_MAX : ((uint64_t)1 << (8 * n)) - 1;
+}
+
+/* Counts of n-grams in an open addressing hash table, so the memory is
+   bounded by the number of distinct n-grams seen and not by 256^n. */
+class NGramTable {
+ public:
+	/* A cell with zero count is free. */
+	struct Cell {
+		uint64_t key;
+		uint32_t count;
+	};
+
+ private:
+	static constexpr size_t kMinCapacity = 64;
+
+	std::vector<Cell> cells_; /* allocated by the first Add() */
+	size_t count_keys_ = 0;
+	int shift_ = 64; /* 64 - log2(capacity) */
+
+	size_t GetPosition(uint64_t key) const {
+		return (key * 0x9E3779B97F4A7C15ULL) >> shift_;
+	}
+
+	void Grow();
+
+ public:
+	NGramTable() = default;
+
+	/* Returns the count of @key after adding. */
+	uint32_t Add(uint64_t key, uint32_t count = 1);
+
+	uint32_t Get(uint64_t key) const;
+
+	void Merge(const NGramTable &other);
+
+	void Clear();
+
+	size_t GetCountKeys() const { return count_keys_; }
+
+	uint64_t GetCountElements() const;
+
+	const std::vector<Cell> &GetCells() const { return cells_; }
+
+	template <class Function>
+	void ForEach(Function action) const {
+		for (const Cell &cell : cells_)
+			if (cell.count != 0) action(cell.key, cell.count);
+	}
+};
+
+/* Counts n-grams of data delivered by consecutive blocks, n-grams crossing
+   the borders of blocks are counted too. */
+class NGramCounter {
+ private:
+	int8_t deep_;
+	uint64_t key_ = 0;
+	uint64_t count_bytes_ = 0;
+	NGramTable &ngrams_;
+
+ public:
+	NGramCounter(int8_t deep, NGramTable &ngrams) : deep_(deep), ngrams_(ngrams) {}
+
+	void Feed(const uint8_t *block, size_t len);
+};
+
+/* Markov chain of order deep - 1 over bytes, built from counts of n-grams
+   of length @deep. Contexts which were seen rarely or not at all back off
+   to shorter contexts by Witten-Bell interpolation:
+   P(w | h) = (c(hw) + u(h) * P(w | h')) / (c(h) + u(h)),
+   where u(h) is the number of distinct bytes seen after h and h' is h
+   without its first byte. Order 0 uses add-one smoothing. Tables of all
+   orders are derived from the counts of the longest n-grams. */
+class NGramMarkovChain {
+ private:
+	int8_t deep_ = 1;
+	std::vector<NGramTable> ngrams_;		 /* ngrams_[n - 1] - n-grams */
+	std::vector<NGramTable> contexts_;	 /* contexts_[n - 1] - c(h) of n-grams */
+	std::vector<NGramTable> followers_;	 /* followers_[n - 1] - u(h) of n-grams */
+	uint64_t count_elements_ = 0;
+
+ public:
+	NGramMarkovChain() : ngrams_(1), contexts_(1), followers_(1) {}
+
+	NGramMarkovChain(int8_t deep, const NGramTable &ngrams) { Create(deep, ngrams); }
+
+	void Create(int8_t deep, const NGramTable &ngrams);
+
+	/* Probability of the last byte of @ngram after its first deep - 1 bytes. */
+	long double GetProbability(uint64_t ngram) const;
+
+	int8_t GetDeep() const { return deep_; }
+
+	/* Number of distinct n-grams of all orders kept by the chain. */
+	size_t GetCountKeys() const;
+};
+
+}	 // namespace ptrid
@@ -2,49 +2,80 @@
 
 namespace ptrid {
 
-ProbabilisticScheme::ProbabilisticScheme(const ProbabilisticScheme &other) {
+template <class Real>
+BasicProbabilisticScheme<Real>::BasicProbabilisticScheme(
+		const BasicProbabilisticScheme &other) {
 	deep_ = other.deep_;
 	scheme_ = other.scheme_;
 	numerators_ = other.numerators_;
 	denominator_ = other.denominator_;
 	size_base_set_ = other.size_base_set_;
+	marginals_ = other.marginals_;
+	marginal_numerators_ = other.marginal_numerators_;
 }
 
-ProbabilisticScheme::ProbabilisticScheme(const ProbabilisticScheme &&other) {
-	deep_ = other.deep_;
-	scheme_ = std::move(other.scheme_);
-	numerators_ = std::move(other.numerators_);
-	denominator_ = other.denominator_;
-	size_base_set_ = other.size_base_set_;
-}
+template <class Real>
+BasicProbabilisticScheme<Real>::BasicProbabilisticScheme(
+		BasicProbabilisticScheme &&other) noexcept
+		: deep_(other.deep_),
+			scheme_(std::move(other.scheme_)),
+			numerators_(std::move(other.numerators_)),
+			denominator_(other.denominator_),
+			size_base_set_(other.size_base_set_),
+			marginals_(std::move(other.marginals_)),
+			marginal_numerators_(std::move(other.marginal_numerators_)) {}
 
-ProbabilisticScheme &ProbabilisticScheme::operator=(
-		const ProbabilisticScheme &other) {
+template <class Real>
+BasicProbabilisticScheme<Real> &BasicProbabilisticScheme<Real>::operator=(
+		const BasicProbabilisticScheme &other) {
 	deep_ = other.deep_;
 	scheme_ = other.scheme_;
 	numerators_ = other.numerators_;
 	denominator_ = other.denominator_;
 	size_base_set_ = other.size_base_set_;
+	marginals_ = other.marginals_;
+	marginal_numerators_ = other.marginal_numerators_;
 	return *this;
 }
 
-ProbabilisticScheme &ProbabilisticScheme::operator=(
-		const ProbabilisticScheme &&other) {
+template <class Real>
+BasicProbabilisticScheme<Real> &BasicProbabilisticScheme<Real>::operator=(
+		BasicProbabilisticScheme &&other) noexcept {
 	deep_ = other.deep_;
 	scheme_ = std::move(other.scheme_);
 	numerators_ = std::move(other.numerators_);
 	denominator_ = other.denominator_;
 	size_base_set_ = other.size_base_set_;
+	marginals_ = std::move(other.marginals_);
+	marginal_numerators_ = std::move(other.marginal_numerators_);
 	return *this;
 }
 
-void ProbabilisticScheme::Create(uint8_t deep, size_t size_base_set,
-																 std::vector<uint32_t> frequencies) {
+template <class Real>
+void BasicProbabilisticScheme<Real>::CreateMarginals() {
+	if (deep_ != 2) {
+		marginals_.clear();
+		marginal_numerators_.clear();
+		return;
+	}
+	marginals_.assign(size_base_set_, 0.);
+	marginal_numerators_.assign(size_base_set_, 0.);
+	/* one linear pass, each row is summed in the same order as before */
+	for (size_t j = 0; j < size_base_set_; j++)
+		for (size_t i = 0; i < size_base_set_; i++) {
+			marginals_[i] += scheme_[i + j * size_base_set_];
+			marginal_numerators_[i] += numerators_[i + j * size_base_set_];
+		}
+}
+
+template <class Real>
+void BasicProbabilisticScheme<Real>::Create(uint8_t deep, size_t size_base_set,
+																						std::span<const uint32_t> frequencies) {
 	deep_ = deep;
 	size_base_set_ = size_base_set;
 	scheme_.resize(frequencies.size());
 	numerators_.resize(frequencies.size());
-	uint32_t sum = 0;
+	uint64_t sum = 0;
 	for (int i = 0; i < frequencies.size(); i++) {
 		numerators_[i] = frequencies[i];
 		sum += frequencies[i];
@@ -53,7 +84,8 @@ void ProbabilisticScheme::Create(uint8_t deep, size_t size_base_set,
 	CreateProbabilities();
 }
 
-long double ProbabilisticScheme::GetProbability(size_t i, size_t j) const {
+template <class Real>
+Real BasicProbabilisticScheme<Real>::GetProbability(size_t i, size_t j) const {
 	assert((i < size_base_set_ && j < size_base_set_) &&
 				 "ptrid::ProbabilisticScheme::GetProbability: indexes out of bounds.");
 	if (deep_ == 2)
@@ -65,20 +97,18 @@ long double ProbabilisticScheme::GetProbability(size_t i, size_t j) const {
 				"size_t) need have deep equal of two");
 }
 
-long double ProbabilisticScheme::GetProbability(size_t i) const {
+template <class Real>
+Real BasicProbabilisticScheme<Real>::GetProbability(size_t i) const {
 	assert((i < size_base_set_) &&
 				 "ptrid::ProbabilisticScheme::GetProbability: indexes out of bounds.");
-	if (deep_ == 1) {
+	if (deep_ == 1)
 		return scheme_[i];
-	} else {
-		long double prob = 0.;
-		for (int j = 0; j < size_base_set_; j++)
-			prob += scheme_[i + j * size_base_set_];
-		return prob;
-	}
+	else
+		return marginals_[i];
 }
 
-long double ProbabilisticScheme::GetNumerator(size_t i, size_t j) const {
+template <class Real>
+Real BasicProbabilisticScheme<Real>::GetNumerator(size_t i, size_t j) const {
 	assert((i < size_base_set_ && j < size_base_set_) &&
 				 "ptrid::ProbabilisticScheme::GetProbability: indexes out of bounds.");
 	if (deep_ == 2)
@@ -89,30 +119,33 @@ long double ProbabilisticScheme::GetNumerator(size_t i, size_t j) const {
 				"size_t) need have deep equal of two");
 }
 
-long double ProbabilisticScheme::GetNumerator(size_t i) const {
+template <class Real>
+Real BasicProbabilisticScheme<Real>::GetNumerator(size_t i) const {
 	assert((i < size_base_set_) &&
 				 "ptrid::ProbabilisticScheme::GetProbability: indexes out of bounds.");
-	if (deep_ == 1) {
+	if (deep_ == 1)
 		return numerators_[i];
-	} else {
-		long double num = 0.;
-		for (int j = 0; j < size_base_set_; j++)
-			num += numerators_[i + j * size_base_set_];
-		return num;
-	}
+	else
+		return marginal_numerators_[i];
 }
 
-void ProbabilisticScheme::useAdditiveSmoothing(long double koef) {
-	denominator_ = 0;
+template <class Real>
+void BasicProbabilisticScheme<Real>::useAdditiveSmoothing(Real koef) {
+	/* the sum is kept in long double, so float schemes don't lose it */
+	long double denominator = 0;
 	for (int i = 0; i < scheme_.size(); i++) {
 		if (numerators_[i] > 0)
 			numerators_[i] *= koef;
 		else
 			numerators_[i] += 1;
-		denominator_ += numerators_[i];
+		denominator += numerators_[i];
 	}
-	for (int i = 0; i < scheme_.size(); i++)
-		scheme_[i] = numerators_[i] / denominator_;
+	denominator_ = denominator;
+	CreateProbabilities();
 }
 
+template class BasicProbabilisticScheme<float>;
+template class BasicProbabilisticScheme<double>;
+template class BasicProbabilisticScheme<long double>;
+
 }	 // namespace ptrid
@@ -4,25 +4,39 @@
 #include <stdint.h>
 
 #include <iostream>
+#include <span>
 #include <vector>
 
 namespace ptrid {
 
-class ProbabilisticScheme {
+/* @Real is the type of stored probabilities: float and double take 4 and 8
+   bytes per cell against 16 of long double and can be vectorized. */
+template <class Real>
+class BasicProbabilisticScheme {
  protected:
 	uint8_t deep_ = 0;
-	std::vector<long double> scheme_;
-	std::vector<long double> numerators_;
-	long double denominator_ = 0.;
+	std::vector<Real> scheme_;
+	std::vector<Real> numerators_;
+	Real denominator_ = 0.;
 	size_t size_base_set_ = 0;
+	/* sums over the second index for deep 2, empty for deep 1 */
+	std::vector<Real> marginals_;
+	std::vector<Real> marginal_numerators_;
 
 	void CreateProbabilities() {
 		for (int i = 0; i < scheme_.size(); i++)
 			scheme_[i] = numerators_[i] / denominator_;
+		CreateMarginals();
 	}
 
+	/* Called by every function that changes numerators, so
+	   GetProbability(i) and GetNumerator(i) don't sum a row. */
+	void CreateMarginals();
+
  public:
-	ProbabilisticScheme() {
+	using Value = Real;
+
+	BasicProbabilisticScheme() {
 		deep_ = 1;
 		size_base_set_ = 1;
 		scheme_.push_back(1.);
@@ -30,23 +44,25 @@ class ProbabilisticScheme {
 		denominator_ = 1.;
 	}
 
-	ProbabilisticScheme(uint8_t deep, size_t size_base_set,
-											std::vector<uint32_t> frequencies) {
+	BasicProbabilisticScheme(uint8_t deep, size_t size_base_set,
+													 std::span<const uint32_t> frequencies) {
 		Create(deep, size_base_set, frequencies);
 	}
 
-	ProbabilisticScheme(const ProbabilisticScheme &other);
+	BasicProbabilisticScheme(const BasicProbabilisticScheme &other);
 
-	ProbabilisticScheme(const ProbabilisticScheme &&other);
+	BasicProbabilisticScheme(BasicProbabilisticScheme &&other) noexcept;
 
-	ProbabilisticScheme &operator=(const ProbabilisticScheme &other);
+	BasicProbabilisticScheme &operator=(const BasicProbabilisticScheme &other);
 
-	ProbabilisticScheme &operator=(const ProbabilisticScheme &&other);
+	BasicProbabilisticScheme &operator=(BasicProbabilisticScheme &&other) noexcept;
 
+	/* @frequencies are only read, a vector of a reader is passed without
+	   copying. */
 	void Create(uint8_t deep, size_t size_base_set,
-							std::vector<uint32_t> frequencies);
+							std::span<const uint32_t> frequencies);
 
-	long double GetDenominator() const { return denominator_; }
+	Real GetDenominator() const { return denominator_; }
 
 	uint8_t GetDeep() const { return deep_; }
 
@@ -54,15 +70,27 @@ class ProbabilisticScheme {
 
 	size_t GetSizeSet() const { return size_base_set_; }
 
-	long double GetProbability(size_t i, size_t j) const;
+	Real GetProbability(size_t i, size_t j) const;
+
+	Real GetProbability(size_t i) const;
 
-	long double GetProbability(size_t i) const;
+	Real GetNumerator(size_t i, size_t j) const;
 
-	long double GetNumerator(size_t i, size_t j) const;
+	Real GetNumerator(size_t i) const;
 
-	long double GetNumerator(size_t i) const;
+	/* All cells in the order of histograms of ReaderBytes, for both deeps,
+	   so loops over them don't depend on the deep. */
+	std::span<const Real> GetProbabilities() const { return scheme_; }
 
-	void useAdditiveSmoothing(long double koef = 10.);
+	std::span<const Real> GetNumerators() const { return numerators_; }
+
+	void useAdditiveSmoothing(Real koef = 10.);
 };
 
+extern template class BasicProbabilisticScheme<float>;
+extern template class BasicProbabilisticScheme<double>;
+extern template class BasicProbabilisticScheme<long double>;
+
+using ProbabilisticScheme = BasicProbabilisticScheme<long double>;
+
 }	 // namespace ptrid
@@ -0,0 +1,176 @@
+#include "quantized_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PTRID_X86
+#include <immintrin.h>
+#endif
+
+namespace ptrid {
+
+namespace {
+
+/* Products of counts and codes take at most 48 bits, so sums of a table
+   of 65536 cells fit in 64 bits. */
+template <class Code>
+uint64_t DotScalar(const uint32_t *counts, const Code *codes, size_t len) {
+	uint64_t sum = 0;
+	for (size_t i = 0; i < len; i++)
+		sum += (uint64_t)counts[i] * codes[i];
+	return sum;
+}
+
+#if defined(PTRID_X86)
+
+/* Codes are widened to 32-bit lanes, vpmuludq multiplies even lanes into
+   64-bit sums, odd lanes are shifted down to be multiplied too. */
+template <class Code>
+__attribute__((target("avx2"))) uint64_t DotAvx2(const uint32_t *counts,
+																								 const Code *codes, size_t len) {
+	__m256i sum_even = _mm256_setzero_si256();
+	__m256i sum_odd = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		__m256i count = _mm256_loadu_si256((const __m256i *)(counts + i));
+		__m256i code;
+		if constexpr (sizeof(Code) == 2)
+			code = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(codes + i)));
+		else
+			code = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(codes + i)));
+		sum_even = _mm256_add_epi64(sum_even, _mm256_mul_epu32(count, code));
+		sum_odd = _mm256_add_epi64(
+				sum_odd, _mm256_mul_epu32(_mm256_srli_epi64(count, 32),
+																	_mm256_srli_epi64(code, 32)));
+	}
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(sum_even, sum_odd));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+				 DotScalar(counts + i, codes + i, len - i);
+}
+
+template <class Code>
+__attribute__((target("avx512f"))) uint64_t DotAvx512(const uint32_t *counts,
+																										 const Code *codes,
+																										 size_t len) {
+	__m512i sum_even = _mm512_setzero_si512();
+	__m512i sum_odd = _mm512_setzero_si512();
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m512i count = _mm512_loadu_si512((const void *)(counts + i));
+		__m512i code;
+		if constexpr (sizeof(Code) == 2)
+			code = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(codes + i)));
+		else
+			code = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(codes + i)));
+		sum_even = _mm512_add_epi64(sum_even, _mm512_mul_epu32(count, code));
+		sum_odd = _mm512_add_epi64(
+				sum_odd, _mm512_mul_epu32(_mm512_srli_epi64(count, 32),
+																	_mm512_srli_epi64(code, 32)));
+	}
+	return _mm512_reduce_add_epi64(_mm512_add_epi64(sum_even, sum_odd)) +
+				 DotScalar(counts + i, codes + i, len - i);
+}
+
+#endif
+
+template <class Code>
+uint64_t Dot(HistogramKernel kernel, const uint32_t *counts, const Code *codes,
+						 size_t len) {
+	switch (kernel) {
+#if defined(PTRID_X86)
+		case HistogramKernel::kAvx2:
+			return DotAvx2(counts, codes, len);
+		case HistogramKernel::kAvx512:
+			return DotAvx512(counts, codes, len);
+#endif
+		default:
+			return DotScalar(counts, codes, len);
+	}
+}
+
+template <class Code>
+void Quantize(std::span<const double> logs, double step, Code *codes) {
+	constexpr double max_code = (Code)~0;
+	for (size_t i = 0; i < logs.size(); i++)
+		codes[i] = (Code)std::min(std::round(-logs[i] / step), max_code);
+}
+
+/* The largest -log10 P, which isn't infinite. */
+double GetMaxMagnitude(std::span<const double> logs) {
+	double max = 0.;
+	for (double log : logs)
+		if (std::isfinite(log)) max = std::max(max, -log);
+	return max;
+}
+
+}	 // namespace
+
+void QuantizedModel::Create(const LikelihoodModel &model, QuantizedWidth width) {
+	width_ = width;
+	size_base_set_ = model.GetSizeSet();
+	std::span<const double> logs = model.GetLogProbabilities();
+	codes16_.clear();
+	codes8_.clear();
+	steps_.clear();
+	if (width_ == QuantizedWidth::k16) {
+		double max = GetMaxMagnitude(logs);
+		steps_.push_back(max > 0. ? max / UINT16_MAX : 1.);
+		codes16_.resize(logs.size());
+		Quantize(logs, steps_[0], codes16_.data());
+	} else {
+		codes8_.resize(logs.size());
+		for (size_t to = 0; to < size_base_set_; to++) {
+			std::span<const double> column = logs.subspan(to * size_base_set_, size_base_set_);
+			double max = GetMaxMagnitude(column);
+			steps_.push_back(max > 0. ? max / UINT8_MAX : 1.);
+			Quantize(column, steps_.back(), codes8_.data() + to * size_base_set_);
+		}
+	}
+}
+
+double QuantizedModel::Score(std::span<const uint32_t> frequencies) const {
+	return Score(GetBestScoringKernel(), frequencies);
+}
+
+double QuantizedModel::Score(HistogramKernel kernel,
+														 std::span<const uint32_t> frequencies) const {
+	assert((frequencies.size() == size_base_set_ * size_base_set_) &&
+				 "ptrid::QuantizedModel::Score: sizes of @frequencies and the model differ.");
+	if (!IsSupportedHistogramKernel(kernel))
+		throw std::invalid_argument(
+				"ptrid::QuantizedModel::Score: kernel isn't supported by CPU - " +
+				std::string(GetHistogramKernelName(kernel)));
+	if (width_ == QuantizedWidth::k16)
+		return -(double)Dot(kernel, frequencies.data(), codes16_.data(),
+												codes16_.size()) * steps_[0];
+
+	double score = 0.;
+	for (size_t to = 0; to < size_base_set_; to++)
+		score -= (double)Dot(kernel, frequencies.data() + to * size_base_set_,
+												 codes8_.data() + to * size_base_set_, size_base_set_) *
+						 steps_[to];
+	return score;
+}
+
+double QuantizedModel::GetLogProbability(size_t from, size_t to) const {
+	assert((from < size_base_set_ && to < size_base_set_) &&
+				 "ptrid::QuantizedModel::GetLogProbability: @from or @to is out of bounds.");
+	size_t i = from + to * size_base_set_;
+	if (width_ == QuantizedWidth::k16)
+		return -(double)codes16_[i] * steps_[0];
+	else
+		return -(double)codes8_[i] * steps_[to];
+}
+
+QuantizedWidth GetQuantizedWidth(const std::string &name) {
+	if (name == "16")
+		return QuantizedWidth::k16;
+	else if (name == "8")
+		return QuantizedWidth::k8;
+	throw std::invalid_argument("ptrid::GetQuantizedWidth: Unsupported width - " + name);
+}
+
+}	 // namespace ptrid
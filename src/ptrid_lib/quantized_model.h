@@ -0,0 +1,68 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include "aligned_allocator.h"
+#include "histogram.h"
+#include "likelihood_model.h"
+
+namespace ptrid {
+
+/* k16 keeps one step for the whole table, k8 keeps a step for every
+   column (size of the set of cells with the same second byte). */
+enum class QuantizedWidth { k16, k8 };
+
+/* LikelihoodModel with log-probabilities rounded to unsigned fixed-point
+   codes: log10 P = -code * step. A table of 256x256 pairs takes 128 KiB
+   (k16) or 64 KiB (k8) against 512 KiB of doubles, and scoring is an
+   integer multiply-accumulate with the histogram. Zero probabilities can't
+   be coded and get the largest code, so the model should be built from a
+   smoothed chain. */
+class QuantizedModel {
+ private:
+	QuantizedWidth width_ = QuantizedWidth::k16;
+	size_t size_base_set_ = 0;
+	std::vector<uint16_t, AlignedAllocator<uint16_t>> codes16_;
+	std::vector<uint8_t, AlignedAllocator<uint8_t>> codes8_;
+	std::vector<double> steps_; /* one for k16, one per column for k8 */
+
+ public:
+	QuantizedModel() = default;
+
+	QuantizedModel(const LikelihoodModel &model, QuantizedWidth width) {
+		Create(model, width);
+	}
+
+	void Create(const LikelihoodModel &model, QuantizedWidth width);
+
+	/* log10 of the likelihood of a sample with pairs @frequencies, scored by
+	   the best kernel of the running CPU. */
+	double Score(std::span<const uint32_t> frequencies) const;
+
+	/* kSse2 uses the scalar loop, integer products of 32-bit lanes come
+	   with AVX2. */
+	double Score(HistogramKernel kernel, std::span<const uint32_t> frequencies) const;
+
+	double GetLogProbability(size_t from, size_t to) const;
+
+	/* The largest error of a log-probability of the cells of @to, an error of
+	   a score is bounded by the sum of counts times it. */
+	double GetMaxError(size_t to) const {
+		return steps_[width_ == QuantizedWidth::k16 ? 0 : to] / 2;
+	}
+
+	QuantizedWidth GetWidth() const { return width_; }
+
+	size_t GetSizeSet() const { return size_base_set_; }
+};
+
+/* Parses "16" and "8" for options of executables. */
+QuantizedWidth GetQuantizedWidth(const std::string &name);
+
+}	 // namespace ptrid
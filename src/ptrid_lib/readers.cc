@@ -1,12 +1,151 @@
 #include "readers.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "dumps.h"
+#include "histogram.h"
+
 namespace ptrid {
 
+namespace {
+
+/* Counts a file delivered by consecutive blocks. The last byte of a block is
+   carried to the next one, so the result equals to reading byte by byte,
+   including the EOF sentinel added by Finish(). The checksum of the data is
+   taken on the way for the dump. */
+class BlockCounter {
+ private:
+	int8_t deep_;
+	std::vector<uint32_t> &frequencies_;
+	Checksum checksum_;
+	uint64_t count_bytes_ = 0;
+	uint8_t last_byte_ = 0;
+
+ public:
+	BlockCounter(int8_t deep, std::vector<uint32_t> &frequencies)
+			: deep_(deep), frequencies_(frequencies) {}
+
+	void Feed(const uint8_t *block, size_t len) {
+		if (len == 0) return;
+
+		if (deep_ == 2 && count_bytes_ != 0)
+			frequencies_[last_byte_ + block[0] * 256] += 1;
+		CountFrequencies(deep_, block, len, frequencies_.data());
+		checksum_.Update(block, len);
+		last_byte_ = block[len - 1];
+		count_bytes_ += len;
+	}
+
+	void Finish() {
+		if (deep_ == 1)
+			frequencies_[(uint8_t)EOF] += 1;
+		else if (count_bytes_ < 2)
+			frequencies_[(uint8_t)EOF + ((uint8_t)EOF) * 256] += 1;
+		else
+			frequencies_[last_byte_ + ((uint8_t)EOF) * 256] += 1;
+	}
+
+	uint64_t GetChecksum() const { return checksum_.Get(); }
+};
+
+/* Puts samples to the index on its own thread, so workers reading files
+   don't wait for the journal. Every batch of puts is flushed to the journal
+   at once. Push() blocks only when kMaxCountPending samples are queued. */
+class IndexWriter {
+ private:
+	static constexpr size_t kMaxCountPending = 256;
+
+	struct PendingSample {
+		std::string relative_path;
+		CorpusIndex::Entry entry;
+	};
+
+	CorpusIndex &index_;
+	std::deque<PendingSample> pending_;
+	std::mutex mutex_;
+	std::condition_variable pushed_;
+	std::condition_variable popped_;
+	bool finished_ = false;
+	std::exception_ptr error_;
+	std::thread thread_;
+
+	void Run() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true) {
+			pushed_.wait(lock, [this]() { return finished_ || !pending_.empty(); });
+			if (pending_.empty()) return;
+			std::vector<PendingSample> batch(std::make_move_iterator(pending_.begin()),
+																			 std::make_move_iterator(pending_.end()));
+			pending_.clear();
+			popped_.notify_all();
+			lock.unlock();
+			try {
+				if (!error_) {
+					for (auto &sample : batch)
+						index_.Put(sample.relative_path, std::move(sample.entry));
+					index_.Flush();
+				}
+			} catch (...) {
+				error_ = std::current_exception();
+			}
+			lock.lock();
+		}
+	}
+
+ public:
+	IndexWriter(CorpusIndex &index) : index_(index), thread_(&IndexWriter::Run, this) {}
+
+	~IndexWriter() {
+		if (thread_.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				finished_ = true;
+			}
+			pushed_.notify_one();
+			thread_.join();
+		}
+	}
+
+	void Push(std::string relative_path, CorpusIndex::Entry &&entry) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		popped_.wait(lock, [this]() { return pending_.size() < kMaxCountPending; });
+		pending_.push_back({std::move(relative_path), std::move(entry)});
+		pushed_.notify_one();
+	}
+
+	/* Puts the rest of samples and rethrows the first error of writing. */
+	void Finish() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			finished_ = true;
+		}
+		pushed_.notify_one();
+		thread_.join();
+		if (error_)
+			std::rethrow_exception(error_);
+	}
+};
+
+}	 // namespace
+
 std::string ReaderBytes::GetNameOfDump(const std::string &path, uint32_t type) {
 	if (type == S_IFREG)
 		return path + "_" + std::to_string(deep_) + ".dmp";	
 	else if (type == S_IFDIR)
-		return path + "/dir_" + std::to_string(deep_) + ".dmp";
+		return path + "/index_" + std::to_string(deep_) + ".dmp";
 	else
 		return "";
 }
@@ -15,60 +154,179 @@ bool ReaderBytes::IsDump(const std::string &path) {
 	return std::filesystem::path(path).extension() == ".dmp";
 }
 
-bool ReaderBytes::CheckExistingDump(const std::string &path_to_dump) {
-	return std::filesystem::is_regular_file(path_to_dump);	
+DumpState ReaderBytes::ReadFrequenciesFromDump(const std::string &path_to_dump,
+																							 SourceInfo &source,
+																							 const std::function<uint64_t()> &get_checksum,
+																							 std::vector<uint32_t> &dst) {
+	if (!std::filesystem::is_regular_file(path_to_dump))
+		return DumpState::kStale;
+
+	if (IsBinaryDump(path_to_dump)) {
+		SourceInfo dumped;
+		if (!ReadBinaryDump(path_to_dump, deep_, frequencies_.GetSize(), dst, dumped)) {
+			std::cout << "Damaged dump: " + path_to_dump + "\n";
+			return DumpState::kStale;
+		}
+		/* a copied or checked out source keeps its data but not its time */
+		if (dumped.size != source.size ||
+				(dumped.mtime != source.mtime && get_checksum() != dumped.checksum)) {
+			std::cout << "Stale dump: " + path_to_dump + "\n";
+			return DumpState::kStale;
+		}
+		std::cout << "Reading frequencies from dump: " + path_to_dump + "\n";
+		source.checksum = dumped.checksum;
+		return DumpState::kActual;
+	}
+
+	try {
+		ReadTextDump(path_to_dump, dst);
+	} catch (std::exception &e) {
+		std::cout << "Unreadable dump: " + path_to_dump + "\n";
+		return DumpState::kStale;
+	}
+	if (dst.size() != frequencies_.GetSize())
+		return DumpState::kStale;
+	std::cout << "Migrating text dump: " + path_to_dump + "\n";
+	source.checksum = get_checksum();
+	return DumpState::kMigrated;
 }
 
-void ReaderBytes::ReadFrequenciesFromDump(const std::string &path_to_dump, std::vector<uint32_t> &dst) {
-	std::cout << "Reading frequencies from dump: " << path_to_dump << std::endl;
-	std::ifstream ifs(path_to_dump, std::ifstream::binary);
-	boost::archive::text_iarchive input_archive(ifs);
-	input_archive >> dst;
+void ReaderBytes::WriteFrequenciesToDump(const std::string &path_to_dump, const SourceInfo &source,
+																				 std::vector<uint32_t> &src) {
+	std::cout << "Writing frequencies to dump: " + path_to_dump + "\n";
+	WriteBinaryDump(path_to_dump, deep_, source, src);
 }
 
-void ReaderBytes::WriteFrequenciesToDump(const std::string &path_to_dump, std::vector<uint32_t> &src) {
-	std::cout << "Writing frequencies to dump: " << path_to_dump << std::endl;
-	std::ofstream ofs(path_to_dump, std::ofstream::binary);
-	boost::archive::text_oarchive output_archive(ofs);
-	output_archive << src;
+bool ReaderBytes::LoadFile(const std::string &path, std::vector<uint32_t> &frequencies_from_file,
+													 SourceInfo &source) {
+	std::cout << "Reading file: " + path + "\n";
+	std::string path_to_dump = GetNameOfDump(path, S_IFREG);
+	source = GetSourceInfo(path);
+	DumpState state = ReadFrequenciesFromDump(
+			path_to_dump, source, [&path]() { return GetChecksumOfFile(path); },
+			frequencies_from_file);
+	if (state == DumpState::kStale) {
+		frequencies_from_file.assign(frequencies_.GetSize(), 0);
+		source.checksum = ReadData(path, frequencies_from_file);
+	}
+	return state != DumpState::kActual;
 }
 
 void ReaderBytes::ReadFile(const std::string &path, std::vector<uint32_t> &dst_frequencies) {
-	std::cout << "Reading file: " << path << std::endl;
 	std::vector<uint32_t> frequencies_from_file;
-	std::string path_to_dump = GetNameOfDump(path, S_IFREG);
-	if (!CheckExistingDump(path_to_dump)) {
-		frequencies_from_file.resize(frequencies_.size(), 0);
-		ReadData(path, frequencies_from_file);
-		WriteFrequenciesToDump(path_to_dump, frequencies_from_file);
-	}	else {
-		ReadFrequenciesFromDump(path_to_dump, frequencies_from_file);
-	}
-	for (size_t i = 0; i < frequencies_.size(); i++)
+	SourceInfo source;
+	if (LoadFile(path, frequencies_from_file, source))
+		WriteFrequenciesToDump(GetNameOfDump(path, S_IFREG), source, frequencies_from_file);
+	for (size_t i = 0; i < dst_frequencies.size(); i++)
 			dst_frequencies[i] += frequencies_from_file[i];
 }
 
+void ReaderBytes::LoadSample(const Sample &sample, std::vector<uint32_t> &frequencies_from_file,
+														 CorpusIndex::Entry &entry) {
+	entry.source = sample.source;
+	if (sample.check_checksum && GetChecksumOfFile(sample.path) == sample.checksum) {
+		/* the next run skips it by the time */
+		entry.source.checksum = sample.checksum;
+		entry.cells = sample.cells;
+		return;
+	}
+
+	/* samples indexed first time reuse dumps written before the index */
+	std::cout << "Reading file: " + sample.path + "\n";
+	DumpState state = ReadFrequenciesFromDump(
+			GetNameOfDump(sample.path, S_IFREG), entry.source,
+			[&sample]() { return GetChecksumOfFile(sample.path); }, frequencies_from_file);
+	if (state == DumpState::kStale) {
+		frequencies_from_file.assign(frequencies_.GetSize(), 0);
+		entry.source.checksum = ReadData(sample.path, frequencies_from_file);
+	}
+	entry.cells = CorpusIndex::EncodeCells(frequencies_from_file);
+}
+
+void ReaderBytes::ReadSamples(const std::vector<Sample> &samples, CorpusIndex &index) {
+	size_t count_workers = std::max<size_t>(1, std::min<size_t>(count_threads_, samples.size()));
+	std::atomic<size_t> next_sample = 0;
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	IndexWriter index_writer(index);
+
+	auto work = [&]() {
+		try {
+			std::vector<uint32_t> frequencies_from_file;
+			for (size_t i = next_sample++; i < samples.size(); i = next_sample++) {
+				CorpusIndex::Entry entry;
+				LoadSample(samples[i], frequencies_from_file, entry);
+				index_writer.Push(samples[i].relative_path, std::move(entry));
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error) error = std::current_exception();
+			next_sample = samples.size();
+		}
+	};
+
+	if (count_workers == 1) {
+		work();
+	} else {
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < count_workers; i++)
+			workers.emplace_back(work);
+		for (auto &worker : workers)
+			worker.join();
+	}
+	/* samples read before an error stay in the journal for the next run */
+	index_writer.Finish();
+	if (error)
+		std::rethrow_exception(error);
+}
+
 void ReaderBytes::ReadDirectory(const std::string &path) {
-	std::filesystem::path path_to_directory{path};
 	std::cout << "Reading directory:" << path << ":" << std::endl;
-	std::string path_to_dump = GetNameOfDump(path, S_IFDIR);
-	std::vector<uint32_t> frequencies_from_dir;
-	if (!CheckExistingDump(path_to_dump)) {
-		frequencies_from_dir.resize(frequencies_.size(), 0);
-
-		for (const std::filesystem::directory_entry &entry :
-				 std::filesystem::directory_iterator(path_to_directory)) {
-			std::string path_to_file = entry.path().string();
-			if (entry.is_regular_file() && !IsDump(path_to_file))
-				ReadFile(path_to_file, frequencies_from_dir);
+	CorpusIndex index(GetNameOfDump(path, S_IFDIR), deep_, frequencies_.GetSize());
+	index.Load();
+
+	/* samples with the same size and time as their entries are skipped, with
+	   the same size and other time are compared by checksums */
+	std::vector<Sample> samples;
+	std::unordered_set<std::string> relative_paths;
+	for (const std::filesystem::directory_entry &entry :
+			 std::filesystem::recursive_directory_iterator(
+					 path, std::filesystem::directory_options::skip_permission_denied)) {
+		std::string path_to_file = entry.path().string();
+		if (!entry.is_regular_file() || IsDump(path_to_file)) continue;
+
+		Sample sample;
+		sample.path = path_to_file;
+		sample.relative_path = entry.path().lexically_relative(path).generic_string();
+		sample.source = GetSourceInfo(path_to_file);
+		relative_paths.insert(sample.relative_path);
+		const CorpusIndex::Entry *indexed = index.Find(sample.relative_path);
+		if (indexed && indexed->source.size == sample.source.size) {
+			if (indexed->source.mtime == sample.source.mtime) continue;
+			sample.check_checksum = true;
+			sample.checksum = indexed->source.checksum;
+			sample.cells = indexed->cells;
 		}
-		WriteFrequenciesToDump(path_to_dump, frequencies_from_dir);
-	} else {
-		std::cout << "\tRead dump: " << path_to_dump << std::endl;
-		ReadFrequenciesFromDump(path_to_dump, frequencies_from_dir);
+		samples.push_back(std::move(sample));
+	}
+
+	std::vector<std::string> removed;
+	for (const auto &[relative_path, entry] : index.GetEntries())
+		if (relative_paths.count(relative_path) == 0)
+			removed.push_back(relative_path);
+	for (const std::string &relative_path : removed) {
+		std::cout << "Removing from index: " + relative_path + "\n";
+		index.Remove(relative_path);
 	}
-	for (size_t i = 0; i < frequencies_.size(); i++)
-			frequencies_[i] += frequencies_from_dir[i];
+
+	if (!samples.empty())
+		ReadSamples(samples, index);
+	index.Commit();
+
+	const std::vector<uint32_t> &frequencies_from_dir = index.GetFrequencies();
+	std::vector<uint32_t> &frequencies = frequencies_.GetDenseCounts();
+	for (size_t i = 0; i < frequencies.size(); i++)
+			frequencies[i] += frequencies_from_dir[i];
 }
 
 int32_t ReaderBytes::CheckTypeOfFile(const std::string &name_source) {
@@ -85,8 +343,15 @@ int32_t ReaderBytes::CheckTypeOfFile(const std::string &name_source) {
 void ReaderBytes::Read(const std::string &name_source) {
 	try {
 		int32_t result = CheckTypeOfFile(name_source);
-		if (result == S_IFREG)
-			ReadFile(name_source, frequencies_);
+		if (deep_ > kMaxDeepDense) {
+			if (result == S_IFREG) {
+				std::cout << "Reading file: " + name_source + "\n";
+				ReadNGrams(name_source, ngrams_);
+			} else if (result == S_IFDIR) {
+				ReadNGramsDirectory(name_source);
+			}
+		} else if (result == S_IFREG)
+			ReadFile(name_source, frequencies_.GetDenseCounts());
 		else if (result == S_IFDIR)
 			ReadDirectory(name_source);
 	} catch (std::exception &e) {
@@ -98,20 +363,152 @@ void ReaderBytes::Read(const uint8_t *data, size_t len) {
 	if (!data)
 		throw std::runtime_error("ptrid::ReaderBytes::Read: @data is nullptr");
 
-	if (deep_ == 1) {
-		for(size_t i = 0; i < len; i++)
-			frequencies_[data[i]] += 1;
+	if (deep_ > kMaxDeepDense)
+		NGramCounter(deep_, ngrams_).Feed(data, len);
+	else
+		frequencies_.Count(deep_, data, len);
+}
+
+uint64_t ReaderBytes::ReadData(const std::string &name_file, std::vector<uint32_t> &frequencies) {
+	if (reading_mode_ == ReadingMode::kStream)
+		return ReadDataStream(name_file, frequencies);
+	else
+		return ReadDataMapped(name_file, frequencies);
+}
+
+bool ReaderBytes::FeedFileMapped(const std::string &name_file,
+																 const std::function<void(const uint8_t *, size_t)> &feed,
+																 bool *is_mapped) {
+	if (is_mapped) *is_mapped = false;
+	int fd = open(name_file.c_str(), O_RDONLY);
+	struct stat settings;
+	if (fd < 0 || fstat(fd, &settings) != 0) {
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	if (S_ISDIR(settings.st_mode)) {
+		close(fd);
+		errno = EISDIR;
+		return false;
+	}
+
+	if (S_ISREG(settings.st_mode) && settings.st_size > 0) {
+		void *mapping = mmap(nullptr, settings.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			madvise(mapping, settings.st_size, MADV_SEQUENTIAL);
+			if (is_mapped) *is_mapped = true;
+			feed((const uint8_t *)mapping, settings.st_size);
+			munmap(mapping, settings.st_size);
+			close(fd);
+			return true;
+		}
+	}
+
+	/* pipes, special files and files which can't be mapped */
+	std::unique_ptr<uint8_t, decltype(&free)> block(
+			(uint8_t *)aligned_alloc(kAlignmentReadingBlock, kSizeReadingBlock), &free);
+	if (!block) {
+		close(fd);
+		throw std::bad_alloc();
+	}
+	while (true) {
+		ssize_t count_read = read(fd, block.get(), kSizeReadingBlock);
+		if (count_read > 0) {
+			feed(block.get(), count_read);
+		} else if (count_read == 0) {
+			break;
+		} else if (errno != EINTR) {
+			int error = errno;
+			close(fd);
+			errno = error;
+			return false;
+		}
+	}
+	close(fd);
+	return true;
+}
+
+bool ReaderBytes::FeedFileStream(const std::string &name_file,
+																 const std::function<void(const uint8_t *, size_t)> &feed) {
+	std::ifstream f_in(name_file, std::ifstream::in | std::ifstream::binary);
+	if (!f_in.is_open())
+		return false;
+	std::vector<char> block(kSizeReadingBlock);
+	while (f_in.read(block.data(), block.size()) || f_in.gcount() > 0)
+		feed((const uint8_t *)block.data(), f_in.gcount());
+	return true;
+}
+
+uint64_t ReaderBytes::ReadDataMapped(const std::string &name_file, std::vector<uint32_t> &frequencies) {
+	BlockCounter counter(deep_, frequencies);
+	if (!FeedFileMapped(name_file, [&counter](const uint8_t *block, size_t len) {
+				counter.Feed(block, len);
+			})) {
+		std::cerr << "Error of read file: " << name_file << std::endl;
+		return Checksum().Get();
+	}
+	counter.Finish();
+	return counter.GetChecksum();
+}
+
+void ReaderBytes::ReadNGrams(const std::string &name_file, NGramTable &ngrams) {
+	NGramCounter counter(deep_, ngrams);
+	auto feed = [&counter](const uint8_t *block, size_t len) { counter.Feed(block, len); };
+	bool is_read = (reading_mode_ == ReadingMode::kStream) ? FeedFileStream(name_file, feed)
+																												 : FeedFileMapped(name_file, feed);
+	if (!is_read)
+		std::cerr << "Error of read file: " << name_file << std::endl;
+}
+
+void ReaderBytes::ReadNGramsDirectory(const std::string &path) {
+	std::cout << "Reading directory:" << path << ":" << std::endl;
+	std::vector<std::string> paths;
+	for (const std::filesystem::directory_entry &entry :
+			 std::filesystem::recursive_directory_iterator(
+					 path, std::filesystem::directory_options::skip_permission_denied))
+		if (entry.is_regular_file() && !IsDump(entry.path().string()))
+			paths.push_back(entry.path().string());
+
+	/* workers count into private tables, merged at the end */
+	size_t count_workers = std::max<size_t>(1, std::min<size_t>(count_threads_, paths.size()));
+	std::vector<NGramTable> ngrams_of_workers(count_workers);
+	std::atomic<size_t> next_path = 0;
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto work = [&](NGramTable &ngrams) {
+		try {
+			for (size_t i = next_path++; i < paths.size(); i = next_path++) {
+				std::cout << "Reading file: " + paths[i] + "\n";
+				ReadNGrams(paths[i], ngrams);
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error) error = std::current_exception();
+			next_path = paths.size();
+		}
+	};
+
+	if (count_workers == 1) {
+		work(ngrams_);
 	} else {
-		for(size_t i = 0, j = 1; j < len; i++, j++)
-			frequencies_[data[i] + data[j] * 256] += 1;
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < count_workers; i++)
+			workers.emplace_back(work, std::ref(ngrams_of_workers[i]));
+		for (auto &worker : workers)
+			worker.join();
+		for (const NGramTable &ngrams : ngrams_of_workers)
+			ngrams_.Merge(ngrams);
 	}
+	if (error)
+		std::rethrow_exception(error);
 }
 
-void ReaderBytes::ReadData(const std::string &name_file, std::vector<uint32_t> &frequencies) {
+uint64_t ReaderBytes::ReadDataStream(const std::string &name_file, std::vector<uint32_t> &frequencies) {
+	Checksum checksum;
 	std::ifstream f_in(name_file, std::ifstream::in | std::ifstream::binary);
 	if (!f_in.is_open()) {
 		std::cerr << "Error of read file: " << name_file << std::endl;
-		return;
+		return checksum.Get();
 	}
 
 	if (deep_ == 1) {
@@ -121,6 +518,7 @@ void ReaderBytes::ReadData(const std::string &name_file, std::vector<uint32_t> &
 			f_in.read((char *)&value, 1);
 			if (!f_in.eof() && !f_in.fail()) {
 				frequencies[value] += 1;
+				checksum.Update(&value, 1);
 			} else {
 				frequencies[(uint8_t)EOF] += 1;
 				break;
@@ -130,12 +528,13 @@ void ReaderBytes::ReadData(const std::string &name_file, std::vector<uint32_t> &
 		uint8_t pValue[2];
 		/* reading the first two bytes */
 		f_in.read((char *)pValue, 2);
+		checksum.Update(pValue, f_in.gcount());
 		if (!f_in.eof() && !f_in.fail()) {
 			frequencies[pValue[0] + pValue[1] * 256] += 1;
 		} else {
 			frequencies[(uint8_t)EOF + ((uint8_t)EOF) * 256] += 1;
 			f_in.close();
-			return;
+			return checksum.Get();
 		}
 		/* reading the rest part */
 		while (true) {
@@ -143,6 +542,7 @@ void ReaderBytes::ReadData(const std::string &name_file, std::vector<uint32_t> &
 			f_in.read((char *)pValue + 1, 1);
 			if (!f_in.eof() && !f_in.fail()) {
 				frequencies[pValue[0] + pValue[1] * 256] += 1;
+				checksum.Update(pValue + 1, 1);
 			} else {
 				frequencies[pValue[0] + ((uint8_t)EOF) * 256] += 1;
 				break;
@@ -151,7 +551,7 @@ void ReaderBytes::ReadData(const std::string &name_file, std::vector<uint32_t> &
 	}
 
 	f_in.close();
-	return;
+	return checksum.Get();
 }
 
 }	 // namespace ptrid
\ No newline at end of file
@@ -3,98 +3,193 @@
 #include <assert.h>
 #include <stdint.h>
 #include <sys/stat.h>
+#include <stdio.h>
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <thread>
 #include <vector>
 
-#include <boost/archive/text_oarchive.hpp>
-#include <boost/archive/text_iarchive.hpp>
-#include <boost/serialization/base_object.hpp>
-#include <boost/serialization/vector.hpp>
+#include "corpus_index.h"
+#include "dumps.h"
+#include "histogram.h"
+#include "ngrams.h"
 
 namespace ptrid {
 
+/* kMapped maps regular files into memory (or reads pipes and special files
+   by large aligned blocks), kStream reads them through std::ifstream. */
+enum class ReadingMode { kMapped, kStream };
+
 class ReaderBytes {
  protected:
+	/* A sample of a directory, which isn't in the index or may differ from
+	   its entry. */
+	struct Sample {
+		std::string path;
+		std::string relative_path;
+		SourceInfo source;
+		bool check_checksum = false; /* compare with @checksum before reading */
+		uint64_t checksum = 0;
+		std::string cells; /* cells of the entry, kept if the checksum matches */
+	};
+
+	static constexpr size_t kSizeReadingBlock = 1 << 20;
+	static constexpr size_t kAlignmentReadingBlock = 4096;
+
 	int8_t deep_ = 0;
-	std::vector<uint32_t> frequencies_;
+	ReadingMode reading_mode_ = ReadingMode::kMapped;
+	size_t count_threads_ = 1;
+	TouchedHistogram frequencies_; /* deep up to kMaxDeepDense */
+	NGramTable ngrams_;									/* longer deep */
 	
 	std::string GetNameOfDump(const std::string &path, uint32_t type);
 
-	bool IsDump(const std::string &path);
-
-	bool CheckExistingDump(const std::string &path_to_dump);
+	/* Reads the dump into @dst if it was built from @source. @get_checksum is
+	   called only when the time of the source doesn't match the dump. */
+	DumpState ReadFrequenciesFromDump(const std::string &path_to_dump, SourceInfo &source,
+																		const std::function<uint64_t()> &get_checksum,
+																		std::vector<uint32_t> &dst);
 
-	void ReadFrequenciesFromDump(const std::string &path_to_dump, std::vector<uint32_t> &dst);
+	void WriteFrequenciesToDump(const std::string &path_to_dump, const SourceInfo &source,
+															std::vector<uint32_t> &src);
 
-	void WriteFrequenciesToDump(const std::string &path_to_dump, std::vector<uint32_t> &src);
+	/* Returns true if the dump of the file must be written. */
+	bool LoadFile(const std::string &name_file, std::vector<uint32_t> &frequencies_from_file,
+								SourceInfo &source);
 
 	void ReadFile(const std::string &name_file, std::vector<uint32_t> &dst);
 
+	/* Makes the new entry of the sample. A sample with the checksum of its
+	   entry isn't read, the entry gets its new time and keeps the cells. */
+	void LoadSample(const Sample &sample, std::vector<uint32_t> &frequencies_from_file,
+									CorpusIndex::Entry &entry);
+
+	void ReadSamples(const std::vector<Sample> &samples, CorpusIndex &index);
+
+	/* Reads a directory and its subdirectories through their index. */
 	void ReadDirectory(const std::string &name_dir);
 
-	void ReadData(const std::string &name_file, std::vector<uint32_t> &frequencies);
+	/* Functions reading data return checksums of the read data. */
+	uint64_t ReadData(const std::string &name_file, std::vector<uint32_t> &frequencies);
+
+	uint64_t ReadDataMapped(const std::string &name_file, std::vector<uint32_t> &frequencies);
+
+	uint64_t ReadDataStream(const std::string &name_file, std::vector<uint32_t> &frequencies);
+
+	bool FeedFileStream(const std::string &name_file,
+											const std::function<void(const uint8_t *, size_t)> &feed);
+
+	/* N-grams longer than kMaxDeepDense are read without dumps. */
+	void ReadNGrams(const std::string &name_file, NGramTable &ngrams);
+
+	void ReadNGramsDirectory(const std::string &name_dir);
 
  public:
 	ReaderBytes(const int8_t deep) {
-		assert((deep == 1 || deep == 2) && "ptrid::ReaderBytes: Unsupported deep.");
+		assert((deep >= 1 && deep <= kMaxDeep) && "ptrid::ReaderBytes: Unsupported deep.");
 		deep_ = deep;
-		frequencies_.resize((deep_ == 2) ? 65536 : 256, 0);
+		if (deep_ <= kMaxDeepDense)
+			frequencies_ = TouchedHistogram((deep_ == 2) ? 65536 : 256);
 	}
 
 	ReaderBytes(const ReaderBytes &other) {
 		this->deep_ = other.deep_;
+		this->reading_mode_ = other.reading_mode_;
+		this->count_threads_ = other.count_threads_;
 		this->frequencies_ = other.frequencies_;
+		this->ngrams_ = other.ngrams_;
 	}
 
-	ReaderBytes(const ReaderBytes &&other) {
-		this->deep_ = other.deep_;
-		this->frequencies_ = std::move(other.frequencies_);
-	}
+	ReaderBytes(ReaderBytes &&other) noexcept
+			: deep_(other.deep_),
+				reading_mode_(other.reading_mode_),
+				count_threads_(other.count_threads_),
+				frequencies_(std::move(other.frequencies_)),
+				ngrams_(std::move(other.ngrams_)) {}
 
 	ReaderBytes &operator=(const ReaderBytes &other) {
 		this->deep_ = other.deep_;
+		this->reading_mode_ = other.reading_mode_;
+		this->count_threads_ = other.count_threads_;
 		this->frequencies_ = other.frequencies_;
+		this->ngrams_ = other.ngrams_;
 		return *this;
 	}
 
-	ReaderBytes &operator=(const ReaderBytes &&other) {
+	ReaderBytes &operator=(ReaderBytes &&other) noexcept {
 		this->deep_ = other.deep_;
+		this->reading_mode_ = other.reading_mode_;
+		this->count_threads_ = other.count_threads_;
 		this->frequencies_ = std::move(other.frequencies_);
+		this->ngrams_ = std::move(other.ngrams_);
 		return *this;
 	}
 
 	static int32_t CheckTypeOfFile(const std::string &name_file);
 
+	/* Dumps and indexes are kept beside samples, they aren't samples. */
+	static bool IsDump(const std::string &path);
+
+	/* Passes the file to @feed by large blocks, a mapped regular file is
+	   passed in one call and @is_mapped is set before it. Returns false with
+	   errno if the file can't be opened or read, directories aren't read. */
+	static bool FeedFileMapped(const std::string &name_file,
+														 const std::function<void(const uint8_t *, size_t)> &feed,
+														 bool *is_mapped = nullptr);
+
 	void Read(const std::string &name_source);
 
 	void Read(const uint8_t *data, size_t len);
 
-	std::vector<uint32_t> GetFrequencies() {
-		return frequencies_;
+	/* Borrowed until the next Read() or Clean(), empty for deep above
+	   kMaxDeepDense, see GetNGrams(). */
+	const std::vector<uint32_t> &GetFrequencies() const {
+		return frequencies_.GetCounts();
+	}
+
+	/* The same counts with the list of non-zero cells, while data are read
+	   by Read(data, len) only. */
+	const TouchedHistogram &GetHistogram() const { return frequencies_; }
+
+	const NGramTable &GetNGrams() const { return ngrams_; }
+
+	uint8_t GetDeep() const { return deep_; }
+
+	void SetReadingMode(ReadingMode mode) { reading_mode_ = mode; }
+
+	ReadingMode GetReadingMode() const { return reading_mode_; }
+
+	/* Files of a directory are read by @count_threads workers with private
+	   histograms, 0 means the number of hardware threads. */
+	void SetCountThreads(size_t count_threads) {
+		count_threads_ = count_threads ? count_threads : std::max(1u, std::thread::hardware_concurrency());
 	}
 
-	uint8_t GetDeep() { return deep_; }
+	size_t GetCountThreads() const { return count_threads_; }
 
-	uint32_t GetFrequency(size_t i) {
-		assert((i < frequencies_.size()) &&
+	uint32_t GetFrequency(size_t i) const {
+		if (deep_ > kMaxDeepDense)
+			return ngrams_.Get(i);
+		assert((i < frequencies_.GetSize()) &&
 					 "ReaderBytes: going beyond the boundaries of the std::vector.");
-		return frequencies_[i];
+		return frequencies_.GetCounts()[i];
 	}
 
-	uint64_t GetCountElements() {
-		uint64_t count = 0;
-		for (size_t i = 0; i < frequencies_.size(); i++)
-			count += frequencies_[i];
-		return count;
+	uint64_t GetCountElements() const {
+		if (deep_ > kMaxDeepDense)
+			return ngrams_.GetCountElements();
+		return frequencies_.GetCountElements();
 	}
 
-	uint32_t GetSizeSet() { return 256; }
+	uint32_t GetSizeSet() const { return 256; }
 
 	void Clean() {
-		for (size_t i = 0; i < frequencies_.size(); i++) frequencies_[i] = 0;
+		frequencies_.Clean();
+		ngrams_.Clear();
 	}
 };
 
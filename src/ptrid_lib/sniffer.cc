@@ -1,7 +1,29 @@
 #include "sniffer.h"
 
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
 namespace ptrid {
 
+/* packets of a file given to the action between calls of EndBatch */
+constexpr uint64_t kSizeReplayBatch = 256;
+/* the longest sleep of a realtime replay between checks of Stop */
+constexpr std::chrono::milliseconds kSliceReplaySleep(100);
+
+std::string GetTcpPayloadFilter(const std::vector<uint16_t> &ports) {
+	std::string filter =
+			"ip and tcp and (tcp[tcpflags] & (tcp-fin|tcp-rst) != 0 or "
+			"ip[2:2] - ((ip[0] & 0xf) << 2) - ((tcp[12] & 0xf0) >> 2) > 0)";
+	for (size_t i = 0; i < ports.size(); i++)
+		filter += (i == 0 ? " and (port " : " or port ") + std::to_string(ports[i]) +
+							(i + 1 == ports.size() ? ")" : "");
+	return filter;
+}
+
 std::vector<std::string> Sniffer::GetAvailableInterfaceNames() {
 	pcap_if_t *network_devises;		 /* pointer on linked list with information
 										 about network devises */
@@ -28,10 +50,23 @@ void Sniffer::OpenPcap() {
 		char errbuf[PCAP_ERRBUF_SIZE];
 
 		if (net_interface_name_ != "") {
-			/* open device in promiscuous mode */
-			descr_pcap_ =
-					pcap_open_live(net_interface_name_.c_str(), BUFSIZ, 1, -1, errbuf);
+			descr_pcap_ = pcap_create(net_interface_name_.c_str(), errbuf);
 			if (descr_pcap_ == NULL) throw std::runtime_error(errbuf);
+			ApplyCaptureSettings();
+
+			int result = pcap_activate(descr_pcap_);
+			if (result < 0) {
+				std::string error = pcap_statustostr(result);
+				if (result == PCAP_ERROR || result == PCAP_ERROR_NO_SUCH_DEVICE ||
+						result == PCAP_ERROR_PERM_DENIED)
+					error += std::string(" - ") + pcap_geterr(descr_pcap_);
+				ClosePcap();
+				throw std::runtime_error(error);
+			}
+			if (result > 0)
+				std::cerr << "Warning of " << net_interface_name_ << ": "
+									<< pcap_statustostr(result) << std::endl;
+			ApplyFilter();
 		} else {
 			throw std::runtime_error("Choose interface before running.");
 		}
@@ -41,6 +76,83 @@ void Sniffer::OpenPcap() {
 	}
 }
 
+void Sniffer::OpenFile(const std::string &path) {
+	char errbuf[PCAP_ERRBUF_SIZE];
+	ClosePcap();
+	descr_pcap_ = pcap_open_offline(path.c_str(), errbuf);
+	if (descr_pcap_ == NULL)
+		throw std::runtime_error("ptrid::Sniffer::OpenFile: " + path + " - " +
+														 std::string(errbuf));
+	try {
+		ApplyFilter();
+	} catch (std::exception &e) {
+		throw std::runtime_error("ptrid::Sniffer::OpenFile: " + path + " - " +
+														 std::string(e.what()));
+	}
+}
+
+std::string Sniffer::GetFilter() const {
+	std::string filter = action_->GetFilter();
+	if (settings_.filter == "") return filter;
+	if (filter == "") return settings_.filter;
+	return "(" + filter + ") and (" + settings_.filter + ")";
+}
+
+/* The filter is compiled for the link layer of the opened handle. */
+void Sniffer::ApplyFilter() {
+	std::string filter = GetFilter();
+	if (filter == "") return;
+	struct bpf_program program;
+	if (pcap_compile(descr_pcap_, &program, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) ==
+			PCAP_ERROR)
+		throw std::runtime_error("filter \"" + filter + "\" - " + pcap_geterr(descr_pcap_));
+	int result = pcap_setfilter(descr_pcap_, &program);
+	pcap_freecode(&program);
+	if (result == PCAP_ERROR)
+		throw std::runtime_error("filter \"" + filter + "\" - " + pcap_geterr(descr_pcap_));
+}
+
+/* Setters of pcap fail only on activated handles, their results aren't
+   checked except the one of the type of timestamps. */
+void Sniffer::ApplyCaptureSettings() {
+	pcap_set_snaplen(descr_pcap_, settings_.size_snapshot);
+	pcap_set_promisc(descr_pcap_, settings_.is_promisc ? 1 : 0);
+	pcap_set_timeout(descr_pcap_, settings_.timeout_ms);
+	pcap_set_immediate_mode(descr_pcap_, settings_.is_immediate ? 1 : 0);
+	if (settings_.size_buffer > 0)
+		pcap_set_buffer_size(descr_pcap_, settings_.size_buffer);
+	if (settings_.tstamp_type != "") {
+		int tstamp_type = pcap_tstamp_type_name_to_val(settings_.tstamp_type.c_str());
+		if (tstamp_type < 0) {
+			ClosePcap();
+			throw std::runtime_error("unknown type of timestamps - " + settings_.tstamp_type);
+		}
+		/* the default type is used if the interface doesn't support it */
+		int result = pcap_set_tstamp_type(descr_pcap_, tstamp_type);
+		if (result > 0)
+			std::cerr << "Warning of " << net_interface_name_ << ": "
+								<< pcap_statustostr(result) << std::endl;
+	}
+}
+
+struct pcap_stat Sniffer::GetStatistics() {
+	assert((descr_pcap_ != nullptr) &&
+				 "ptrid::Sniffer::GetStatistics: pcap descriptor is nullptr.");
+	struct pcap_stat statistics = {};
+	if (pcap_stats(descr_pcap_, &statistics) != 0)
+		throw std::runtime_error("ptrid::Sniffer::GetStatistics: " +
+														 std::string(pcap_geterr(descr_pcap_)));
+	return statistics;
+}
+
+void Sniffer::PrintStatistics() {
+	struct pcap_stat statistics = GetStatistics();
+	std::cout << "Received " << statistics.ps_recv << " packets, dropped "
+						<< statistics.ps_drop << " by the buffer and " << statistics.ps_ifdrop
+						<< " by the interface" << std::endl;
+	action_->ReportStatistics();
+}
+
 std::string Sniffer::GetDumpName() {
 		time_t t;
 		time(&t);
@@ -62,6 +174,26 @@ void Sniffer::OpenDump(const std::string &dump_name) {
 		throw std::runtime_error("ptrid::Sniffer::OpenDump: Error of open dump - " + dump_name);
 }
 
+void Sniffer::HandlePacket(u_char *sniffer, const struct pcap_pkthdr *packet_header,
+													 const u_char *packet_data) {
+	Sniffer *self = (Sniffer *)sniffer;
+	self->count_packets_ += 1;
+	self->count_bytes_ += packet_header->caplen;
+	self->action_->operator()(packet_header, packet_data);
+	pcap_dump((u_char *)self->descr_dump_, packet_header, packet_data);
+}
+
+void Sniffer::WaitPackets(int descr_selectable, std::chrono::milliseconds wait_time) {
+	if (descr_selectable < 0) {
+		std::this_thread::sleep_for(wait_time);
+		return;
+	}
+	struct pollfd descr_poll = {descr_selectable, POLLIN, 0};
+	/* signals interrupt it, EINTR is handled as a timeout */
+	if (poll(&descr_poll, 1, std::max<int>(wait_time.count(), 1)) < 0 && errno != EINTR)
+		throw std::runtime_error("poll - " + std::string(strerror(errno)));
+}
+
 void Sniffer::Run(const std::chrono::seconds sniffing_time) {
 	try {
 		if (descr_pcap_ == nullptr)
@@ -71,27 +203,91 @@ void Sniffer::Run(const std::chrono::seconds sniffing_time) {
 		std::cout << "Writing packets to " << dump_name << std::endl;
 		OpenDump(dump_name);
 
+		/* a batch is everything read by the kernel, the loop waits in poll */
+		char errbuf[PCAP_ERRBUF_SIZE];
+		if (pcap_setnonblock(descr_pcap_, 1, errbuf) == PCAP_ERROR)
+			throw std::runtime_error(errbuf);
+		int descr_selectable = pcap_get_selectable_fd(descr_pcap_);
+
+		auto start = std::chrono::steady_clock::now();
+		auto last_report = start;
+		while (!is_stopped_) {
+			int result = pcap_dispatch(descr_pcap_, -1, HandlePacket, (u_char *)this);
+			if (result == PCAP_ERROR)
+				throw std::runtime_error(pcap_geterr(descr_pcap_));
+			if (result > 0) action_->EndBatch();
+
+			auto now = std::chrono::steady_clock::now();
+			std::chrono::milliseconds wait_time(settings_.timeout_ms);
+			if (sniffing_time.count() > 0) {
+				if (now - start >= sniffing_time) break;
+				wait_time = std::min(wait_time, std::chrono::duration_cast<std::chrono::milliseconds>(
+																						start + sniffing_time - now));
+			}
+			if (settings_.stats_interval.count() > 0 &&
+					now - last_report >= settings_.stats_interval) {
+				PrintStatistics();
+				last_report = now;
+			}
+			if (result == 0) WaitPackets(descr_selectable, wait_time);
+		}
+
+		std::cout << "Sniffed " << count_packets_ << " packets (" << count_bytes_
+							<< " bytes)" << std::endl;
+		PrintStatistics();
+		CloseDump();
+		ClosePcap();
+	} catch (std::exception &e) {
+		throw std::runtime_error("ptrid::Sniffer::Run:\n" + std::string(e.what()));
+	}
+}
+
+void Sniffer::Replay(bool is_realtime) {
+	try {
+		if (descr_pcap_ == nullptr)
+			throw std::runtime_error("pcap descriptor is nullptr.");
+
 		struct pcap_pkthdr *packet_header = nullptr;
 		const u_char *packet_data = nullptr;
-		auto start = std::chrono::system_clock::now();
+		/* timestamps of packets are replayed from the first one of the file */
+		std::chrono::steady_clock::time_point start;
+		std::chrono::microseconds time_first(0);
+		bool is_first = true;
 		int reading_result = 0;
-		uint32_t packet_num = 0;
-		while (std::chrono::system_clock::now() - start < sniffing_time) {
-			reading_result = ReadPacket(&packet_header, &packet_data);
+		while (!is_stopped_ && (reading_result = ReadPacket(&packet_header, &packet_data)) !=
+					 PCAP_ERROR_BREAK) {
 			if (reading_result == 0)
 				continue;
-			std::cout << "Packet: " << ++packet_num << std::endl;
+			if (is_realtime) {
+				std::chrono::microseconds time_packet =
+						std::chrono::seconds(packet_header->ts.tv_sec) +
+						std::chrono::microseconds(packet_header->ts.tv_usec);
+				if (is_first) {
+					start = std::chrono::steady_clock::now();
+					time_first = time_packet;
+					is_first = false;
+				}
+				/* packets out of order aren't delayed */
+				if (time_packet > time_first) SleepUntil(start + (time_packet - time_first));
+				if (is_stopped_) break;
+			}
+			count_packets_ += 1;
+			count_bytes_ += packet_header->caplen;
 			action_->operator()(packet_header, packet_data);
-			pcap_dump((u_char *)descr_dump_, packet_header, packet_data);
+			if (count_packets_ % kSizeReplayBatch == 0) action_->EndBatch();
 		}
-			
-		CloseDump();
-		ClosePcap();
+		action_->EndBatch();
 	} catch (std::exception &e) {
-		throw std::runtime_error("ptrid::Sniffer::Run:\n" + std::string(e.what()));
+		throw std::runtime_error("ptrid::Sniffer::Replay:\n" + std::string(e.what()));
 	}
 }
 
+void Sniffer::SleepUntil(std::chrono::steady_clock::time_point time) {
+	while (!is_stopped_ && std::chrono::steady_clock::now() < time)
+		std::this_thread::sleep_until(
+				std::min(time, std::chrono::steady_clock::now() + kSliceReplaySleep));
+}
+
 int Sniffer::ReadPacket(struct pcap_pkthdr **packet_header, const u_char **packet_data) {
 	int result = pcap_next_ex(descr_pcap_, packet_header, packet_data);
 	if (result == PCAP_ERROR_ACTIVATED || result == PCAP_ERROR)
@@ -1,21 +1,52 @@
-#pragma one
+#pragma once
 
 #include <assert.h>
 #include <pcap.h>
 #include <stdint.h>
 #include <time.h>
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <string>
 #include <vector>
 
 namespace ptrid {
 
+/* Packets come by batches of pcap_dispatch, EndBatch is called after the
+   last packet of every batch. GetFilter is a pcap-filter(7) expression of
+   the packets the processor needs, the kernel drops others. */
 struct ProcessorTraffic {
-	virtual void operator()(struct pcap_pkthdr *packet_header,
+	virtual void operator()(const struct pcap_pkthdr *packet_header,
 													const u_char *packet_data) = 0;
+
+	virtual void EndBatch() {}
+
+	virtual std::string GetFilter() const { return ""; }
+
+	/* Called with reports of drops of the sniffer. */
+	virtual void ReportStatistics() {}
 };
 
+/* Settings of a live capture, they are applied between pcap_create and
+   pcap_activate. On Linux libpcap captures to a memory-mapped ring of
+   TPACKET_V3 (libpcap 1.5 and newer) of @size_buffer bytes. */
+struct CaptureSettings {
+	int size_snapshot = 262144; /* whole packets, including jumbo and GRO ones */
+	int size_buffer = 0;				/* 0 - the default size of libpcap */
+	int timeout_ms = 100;				/* wait of a read for packets to batch */
+	bool is_immediate = false;	/* packets are delivered without waiting */
+	bool is_promisc = true;
+	std::string tstamp_type = ""; /* a name of pcap-tstamp(7), "" - default */
+	std::string filter = "";			/* packets of the processor are filtered by it too */
+	/* seconds between reports of drops of Run, 0 - only at the end */
+	std::chrono::seconds stats_interval = std::chrono::seconds(0);
+};
+
+/* pcap-filter(7) expression of IPv4 TCP segments with payloads or FIN or
+   RST flags, of @ports if they are given. */
+std::string GetTcpPayloadFilter(const std::vector<uint16_t> &ports);
+
 class Sniffer {
  private:
 	pcap_t *descr_pcap_ = nullptr;
@@ -23,6 +54,12 @@ class Sniffer {
 	ProcessorTraffic *action_;
 	std::string net_interface_name_ = "";
 	std::string path_to_save_ = ".";
+	CaptureSettings settings_;
+	/* packets and their captured bytes given to @action_ by Replay */
+	uint64_t count_packets_ = 0;
+	uint64_t count_bytes_ = 0;
+	/* lock-free, so Stop may be called by handlers of signals */
+	std::atomic<bool> is_stopped_ = false;
 
  public:
 	Sniffer(ProcessorTraffic *action) noexcept {
@@ -46,6 +83,17 @@ class Sniffer {
 
 	std::string GetInterfaceName() noexcept { return net_interface_name_; }
 
+	/* Settings are used by the next OpenInterface. */
+	void SetCaptureSettings(const CaptureSettings &settings) { settings_ = settings; }
+
+	const CaptureSettings &GetCaptureSettings() const noexcept { return settings_; }
+
+	/* The filter of the processor and the one of settings, "" - no filter. */
+	std::string GetFilter() const;
+
+	/* Packets received and dropped since the interface was opened. */
+	struct pcap_stat GetStatistics();
+
 	int GetLinkLayerProtocol() noexcept {
 		assert((descr_pcap_ != nullptr) &&
 					 "ptrid::Sniffer::GetLinkLayer: pcap descriptor is nullptr.");
@@ -65,8 +113,30 @@ class Sniffer {
 
 	void CloseInterface() noexcept { ClosePcap(); }
 
+	/* Opens a capture file instead of an interface. */
+	void OpenFile(const std::string &path);
+
+	void CloseFile() noexcept { ClosePcap(); }
+
+	/* Sniffs for @sniffing_time or, if it's 0, until Stop. The deadline is
+	   checked once per batch and waiting for packets blocks on the
+	   descriptor of the interface. */
 	void Run(const std::chrono::seconds sniffing_time);
 
+	/* Run and Replay return after the current batch, the sniffer doesn't
+	   run after it. A realtime Replay returns without waiting for the next
+	   packet. */
+	void Stop() noexcept { is_stopped_ = true; }
+
+	/* Gives all packets of the opened file to the action without dumping
+	   them: as fast as they are read or, if @is_realtime, with the gaps
+	   between their timestamps. */
+	void Replay(bool is_realtime);
+
+	uint64_t GetCountPackets() const noexcept { return count_packets_; }
+
+	uint64_t GetCountBytes() const noexcept { return count_bytes_; }
+
  private:
 	std::string GetDumpName();
 
@@ -74,6 +144,20 @@ class Sniffer {
 
 	void OpenDump(const std::string &dump_name);
 
+	void ApplyCaptureSettings();
+
+	void ApplyFilter();
+
+	void PrintStatistics();
+
+	static void HandlePacket(u_char *sniffer, const struct pcap_pkthdr *packet_header,
+													 const u_char *packet_data);
+
+	void WaitPackets(int descr_selectable, std::chrono::milliseconds wait_time);
+
+	/* Sleeps by slices until @time or Stop. */
+	void SleepUntil(std::chrono::steady_clock::time_point time);
+
 	int ReadPacket(struct pcap_pkthdr **packet_header, const u_char **packet_data);
 
 	void ClosePcap() noexcept {
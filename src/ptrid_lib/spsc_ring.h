@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+namespace ptrid {
+
+/* Lock-free ring of one producer thread and one consumer thread. Slots are
+   written and read in place, so buffers of @T are reused: the producer
+   fills the slot of BeginPush and publishes it by EndPush, the consumer
+   reads Front and frees it by Pop. Counters are written by the producer and
+   may be read by any thread. */
+template <class T>
+class SpscRing {
+ private:
+	static constexpr size_t kSizeCacheLine = 64;
+
+	std::vector<T> slots_;
+	size_t mask_ = 0;
+
+	/* indexes only grow, the producer owns @head_ and the consumer @tail_,
+	   each keeps the last seen index of the other on its line */
+	alignas(kSizeCacheLine) std::atomic<uint64_t> head_ = 0;
+	uint64_t cached_tail_ = 0;
+	std::atomic<uint64_t> count_pushed_ = 0;
+	std::atomic<uint64_t> count_full_ = 0;
+	std::atomic<uint64_t> max_size_ = 0;
+
+	alignas(kSizeCacheLine) std::atomic<uint64_t> tail_ = 0;
+	uint64_t cached_head_ = 0;
+
+ public:
+	/* @capacity is a power of 2. */
+	explicit SpscRing(size_t capacity) {
+		if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+			throw std::invalid_argument("ptrid::SpscRing::SpscRing: capacity must be a power of 2.");
+		slots_.resize(capacity);
+		mask_ = capacity - 1;
+	}
+
+	SpscRing(const SpscRing &) = delete;
+	SpscRing &operator=(const SpscRing &) = delete;
+
+	/* nullptr if the ring is full, the attempt is counted */
+	T *BeginPush() noexcept {
+		uint64_t head = head_.load(std::memory_order_relaxed);
+		if (head - cached_tail_ == slots_.size()) {
+			cached_tail_ = tail_.load(std::memory_order_acquire);
+			if (head - cached_tail_ == slots_.size()) {
+				count_full_.store(count_full_.load(std::memory_order_relaxed) + 1,
+													std::memory_order_relaxed);
+				return nullptr;
+			}
+		}
+		return &slots_[head & mask_];
+	}
+
+	void EndPush() noexcept {
+		uint64_t head = head_.load(std::memory_order_relaxed) + 1;
+		head_.store(head, std::memory_order_release);
+		count_pushed_.store(count_pushed_.load(std::memory_order_relaxed) + 1,
+												std::memory_order_relaxed);
+		/* the tail seen by the producer may be late, so it's an upper bound */
+		if (head - cached_tail_ > max_size_.load(std::memory_order_relaxed))
+			max_size_.store(head - cached_tail_, std::memory_order_relaxed);
+	}
+
+	/* nullptr if the ring is empty */
+	T *Front() noexcept {
+		uint64_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail == cached_head_) {
+			cached_head_ = head_.load(std::memory_order_acquire);
+			if (tail == cached_head_) return nullptr;
+		}
+		return &slots_[tail & mask_];
+	}
+
+	void Pop() noexcept {
+		tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	size_t GetCapacity() const noexcept { return slots_.size(); }
+
+	/* Slots between the two threads at the moment of the call. */
+	size_t GetSize() const noexcept {
+		uint64_t tail = tail_.load(std::memory_order_acquire);
+		return head_.load(std::memory_order_acquire) - tail;
+	}
+
+	size_t GetMaxSize() const noexcept { return max_size_.load(std::memory_order_relaxed); }
+
+	uint64_t GetCountPushed() const noexcept {
+		return count_pushed_.load(std::memory_order_relaxed);
+	}
+
+	/* BeginPush which found the ring full */
+	uint64_t GetCountFull() const noexcept { return count_full_.load(std::memory_order_relaxed); }
+};
+
+}	 // namespace ptrid
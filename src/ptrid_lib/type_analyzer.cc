@@ -0,0 +1,31 @@
+#include "type_analyzer.h"
+
+namespace ptrid {
+
+size_t QuantizedTypeAnalyzer::operator()(const TouchedHistogram &frequencies) {
+	for (size_t type = 0; type < models_.size(); type++)
+		scores_[type] = models_[type].Score(frequencies.GetCounts());
+
+	size_t best = 0;
+	for (size_t type = 1; type < models_.size(); type++) {
+		if (scores_[type] > scores_[best])
+			best = type;
+	}
+	return best;
+}
+
+size_t QuantizedTypeAnalyzer::operator()(const uint8_t *data, size_t len) {
+	payload_frequencies_.Clean();
+	payload_frequencies_.Count(2, data, len);
+	return operator()(payload_frequencies_);
+}
+
+size_t QuantizedTypeAnalyzer::AddToSession(SessionSample &session, const uint8_t *data,
+																					 size_t len) {
+	if (session.frequencies.GetSize() != 65536)
+		session.frequencies = TouchedHistogram(65536);
+	session.frequencies.Count(2, data, len);
+	return operator()(session.frequencies);
+}
+
+}	 // namespace ptrid
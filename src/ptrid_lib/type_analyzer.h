@@ -0,0 +1,176 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <span>
+#include <vector>
+
+#include "batch_scorer.h"
+#include "cascade_classifier.h"
+#include "histogram.h"
+#include "likelihood_model.h"
+#include "markov_chain.h"
+#include "probabilistic_scheme.h"
+#include "quantized_model.h"
+
+namespace ptrid {
+
+/* Sample of a session which grows by segments: analyzers with running
+   scores keep @scores, others count pairs to @frequencies. */
+struct SessionSample {
+	TouchedHistogram frequencies;
+	BatchSession scores;
+};
+
+/* Analyzers classify payloads and sessions by pairs of bytes (deep 2), a
+   program chooses one at startup and calls it without virtual functions.
+   The metric is a template argument: the kernels of BatchScorer are
+   instantiated for every metric, so loops over cells don't branch on it,
+   and the type of values of models is a template argument of the
+   constructors. */
+template <BatchMetric Metric>
+class TypeAnalyzer {
+ private:
+	BatchScorer scorer_;
+	/* pairs of a payload between checks of early exit, 0 - exact scoring */
+	size_t early_exit_chunk_ = 0;
+	uint64_t count_consumed_ = 0;
+	uint64_t count_bytes_ = 0;
+
+ public:
+	static constexpr BatchMetric kMetric = Metric;
+
+	template <class Real>
+		requires(Metric == BatchMetric::kLikelihood)
+	explicit TypeAnalyzer(std::span<const BasicMarkovChain<Real>> chains) {
+		std::vector<LikelihoodModel> models;
+		for (const BasicMarkovChain<Real> &chain : chains)
+			models.emplace_back(chain);
+		scorer_.Create(models);
+	}
+
+	/* @koef is the koef of useAdditiveSmoothing of samples. */
+	template <class Real>
+		requires(Metric != BatchMetric::kLikelihood)
+	TypeAnalyzer(std::span<const BasicProbabilisticScheme<Real>> schemes, double koef) {
+		scorer_.Create(Metric, schemes, koef);
+	}
+
+	size_t operator()(const TouchedHistogram &frequencies) const {
+		return scorer_.GetBest(frequencies);
+	}
+
+	size_t operator()(const uint8_t *data, size_t len) {
+		if constexpr (Metric == BatchMetric::kLikelihood) {
+			if (early_exit_chunk_ > 0) {
+				EarlyExitResult result = scorer_.GetBestEarly(data, len, early_exit_chunk_);
+				count_consumed_ += result.consumed;
+				count_bytes_ += len;
+				return result.type;
+			}
+		}
+		return scorer_.GetBest(data, len);
+	}
+
+	/* Sessions are scored exactly, their rest isn't known. */
+	size_t AddToSession(SessionSample &session, const uint8_t *data, size_t len) const {
+		scorer_.AddToSession(session.scores, data, len);
+		return scorer_.GetBest(session.scores);
+	}
+
+	void SetEarlyExit(size_t early_exit_chunk)
+		requires(Metric == BatchMetric::kLikelihood)
+	{
+		early_exit_chunk_ = early_exit_chunk;
+	}
+
+	size_t GetEarlyExit() const { return early_exit_chunk_; }
+
+	/* Bytes of payloads scored with early exit and all their bytes. */
+	uint64_t GetCountConsumed() const { return count_consumed_; }
+
+	uint64_t GetCountBytes() const { return count_bytes_; }
+
+	/* Counters of a copy which analyzed other payloads. */
+	void AddCounts(const TypeAnalyzer &other) {
+		count_consumed_ += other.count_consumed_;
+		count_bytes_ += other.count_bytes_;
+	}
+
+	const BatchScorer &GetScorer() const { return scorer_; }
+
+	size_t GetCountTypes() const { return scorer_.GetCountTypes(); }
+};
+
+using MarkovTypeAnalyzer = TypeAnalyzer<BatchMetric::kLikelihood>;
+using InfoDistTypeAnalyzer = TypeAnalyzer<BatchMetric::kInfoDistance>;
+using ChiSqTypeAnalyzer = TypeAnalyzer<BatchMetric::kChi2>;
+
+/* Likelihood by quantized models, type by type. */
+class QuantizedTypeAnalyzer {
+ private:
+	std::vector<QuantizedModel> models_;
+	TouchedHistogram payload_frequencies_;
+	std::vector<double> scores_;
+
+ public:
+	template <class Real>
+	QuantizedTypeAnalyzer(std::span<const BasicMarkovChain<Real>> chains, QuantizedWidth width)
+			: payload_frequencies_(65536) {
+		for (const BasicMarkovChain<Real> &chain : chains)
+			models_.emplace_back(LikelihoodModel(chain), width);
+		scores_.resize(models_.size());
+	}
+
+	size_t operator()(const TouchedHistogram &frequencies);
+
+	size_t operator()(const uint8_t *data, size_t len);
+
+	/* The histogram of the session is recounted. */
+	size_t AddToSession(SessionSample &session, const uint8_t *data, size_t len);
+
+	size_t GetCountTypes() const { return models_.size(); }
+};
+
+/* Payloads go through the cascade of bytes and pairs, sessions are scored
+   by all types. */
+class CascadeTypeAnalyzer {
+ private:
+	MarkovTypeAnalyzer markov_;
+	CascadeClassifier classifier_;
+
+ public:
+	/* @unigrams are frequencies of bytes of types, @random_type gets
+	   payloads more random than the learned bound. */
+	template <class Real>
+	CascadeTypeAnalyzer(std::span<const BasicMarkovChain<Real>> chains,
+											std::span<const std::vector<uint32_t>> unigrams, size_t random_type)
+			: markov_(chains) {
+		std::vector<LikelihoodModel> models;
+		for (const BasicMarkovChain<Real> &chain : chains)
+			models.emplace_back(chain);
+		classifier_.Create(models, unigrams, random_type);
+	}
+
+	size_t operator()(const TouchedHistogram &frequencies) const {
+		return markov_(frequencies);
+	}
+
+	size_t operator()(const uint8_t *data, size_t len) const {
+		return classifier_.GetBest(data, len);
+	}
+
+	size_t AddToSession(SessionSample &session, const uint8_t *data, size_t len) const {
+		return markov_.AddToSession(session, data, len);
+	}
+
+	CascadeClassifier &GetClassifier() { return classifier_; }
+
+	const MarkovTypeAnalyzer &GetMarkov() const { return markov_; }
+
+	size_t GetCountTypes() const { return markov_.GetCountTypes(); }
+};
+
+}	 // namespace ptrid
@@ -1,11 +1,18 @@
 #include <pcap.h>
+#include <signal.h>
 #include <stdint.h>
 #include <net/ethernet.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
 #include <time.h>
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
 #include <vector>
 #include <filesystem>
 #include <unordered_map>
@@ -18,25 +25,35 @@
 #include "ptrid_lib/readers.h"
 #include "ptrid_lib/probabilistic_scheme.h"
 #include "ptrid_lib/markov_chain.h"
+#include "ptrid_lib/batch_scorer.h"
+#include "ptrid_lib/cascade_classifier.h"
+#include "ptrid_lib/likelihood_model.h"
+#include "ptrid_lib/quantized_model.h"
 #include "ptrid_lib/math_func.h"
 #include "ptrid_lib/sniffer.h"
+#include "ptrid_lib/spsc_ring.h"
+#include "ptrid_lib/type_analyzer.h"
 
 #define TCP_PROTOCOL 6
 #define ETHERNET_IPV4 0x0008
+#define SIZE_LINUX_SLL_HEADER 16
 #define TIME_WAIT 600
 #define TIME_AFTER_END 10
 
+/* models of types are kept in double: half of the memory of long double
+   with the same results of classification */
+using ProbabilisticScheme = ptrid::BasicProbabilisticScheme<double>;
+using MarkovChain = ptrid::BasicMarkovChain<double>;
+
 struct HttpSessionInfo {
-	std::vector<uint32_t> frequencies;
+	ptrid::SessionSample sample; /* segments seen after the request */
 	std::string get_request;
 
 	HttpSessionInfo() = default;
 
-	HttpSessionInfo(const std::string &request, std::vector<uint32_t> &freq)
-			: get_request(request), frequencies(freq) {}
+	HttpSessionInfo(const std::string &request) : get_request(request) {}
 
-	HttpSessionInfo(const std::string &&request, std::vector<uint32_t> &&freq)
-			: get_request(request), frequencies(freq) {}
+	HttpSessionInfo(std::string &&request) : get_request(std::move(request)) {}
 };
 
 struct TcpSessionName {
@@ -82,117 +99,45 @@ bool operator==(const TcpSessionName &a, const TcpSessionName &b) noexcept {
 					a.port1 == b.port1 && a.port2 == b.port2);
 }
 
-struct TypeAnalyzer {
-	size_t count_types = 0;
-	virtual size_t operator()(const std::vector<uint32_t> &frequencies) = 0;
-};
-
-struct MarkovTypeAnalyzer : TypeAnalyzer {
-	std::vector<ptrid::MarkovChain> types;
-
-	size_t operator()(const std::vector<uint32_t> &frequencies) {
-		long double probabilities[count_types] = {0.};
-
-		for (size_t type_index = 0; type_index < count_types; type_index++)
-			for (size_t from = 0; from < 256; from++)
-				for (size_t to = 0; to < 256; to++)
-					if (frequencies[from + to * 256] != 0)
-						probabilities[type_index] +=
-								(long double)frequencies[from + to * 256] *
-								log10l(types[type_index].GetProbability(from, to));
-		
-		size_t max = 0;
-		for (size_t i = 1; i < count_types; i++) {
-			if (probabilities[i] > probabilities[max]) {
-				max = i;
-			}
-		}
-		return max;
-	}
-
-	MarkovTypeAnalyzer() = delete;
-
-	MarkovTypeAnalyzer(const std::vector<ptrid::MarkovChain> &vec) {
-		types = vec;
-		count_types = types.size();
-	}
-
-	MarkovTypeAnalyzer(const std::vector<ptrid::MarkovChain> &&vec) {
-		types = vec;
-		count_types = types.size();
-	}
-};
-
-struct InfoDistTypeAnalyzer : TypeAnalyzer {
-	std::vector<ptrid::ProbabilisticScheme> types;
-
-	size_t operator()(const std::vector<uint32_t> &frequencies) {
-		long double info_distances[count_types] = {0.};
-		ptrid::ProbabilisticScheme data_scheme(2, 256, frequencies);
-		data_scheme.useAdditiveSmoothing(1000);
-
-		for(size_t type_index = 0; type_index < types.size(); type_index++)
-			info_distances[type_index] = ptrid::GetInfoDistance(types[type_index], data_scheme);
-	
-		size_t min = 0;
-		for (size_t i = 1; i < types.size(); i++) {
-			if (info_distances[i] < info_distances[min]) {
-				min = i;
-			}
-		}
-		return min;
-	}
-
-	InfoDistTypeAnalyzer() = delete;
-
-	InfoDistTypeAnalyzer(const std::vector<ptrid::ProbabilisticScheme> &vec) {
-		types = vec;
-		count_types = types.size();
-	}
-
-	InfoDistTypeAnalyzer(const std::vector<ptrid::ProbabilisticScheme> &&vec) {
-		types = vec;
-		count_types = types.size();
-	}
-};
-
-struct ChiSqTypeAnalyzer : TypeAnalyzer {
-	std::vector<ptrid::ProbabilisticScheme> types;
-
-	size_t operator()(const std::vector<uint32_t> &frequencies) {
-		long double chi2[count_types] = {0.};
-		ptrid::ProbabilisticScheme data_scheme(2, 256, frequencies);
-		data_scheme.useAdditiveSmoothing(1000);
-
-		for(size_t type_index = 0; type_index < types.size(); type_index++)
-			chi2[type_index] = ptrid::GetChi2(data_scheme, types[type_index]);
-	
-		size_t min = 0;
-		for (size_t i = 1; i < types.size(); i++) {
-			if (chi2[i] < chi2[min]) {
-				min = i;
-			}
-		}
-		return min;
-	}
-
-	ChiSqTypeAnalyzer() = delete;
-
-	ChiSqTypeAnalyzer(const std::vector<ptrid::ProbabilisticScheme> &vec) {
-		types = vec;
-		count_types = types.size();
-	}
+/* Size of the link header of an IPv4 frame, 0 for other frames. */
+size_t GetSizeIpv4LinkHeader(int link_layer, const struct pcap_pkthdr *packet_header,
+														 const u_char *packet_data) {
+	size_t size_header = link_layer == DLT_LINUX_SLL ? SIZE_LINUX_SLL_HEADER
+																									 : sizeof(struct ethhdr);
+	if (packet_header->caplen < size_header + sizeof(struct iphdr)) return 0;
+	/* the protocol is the last field of both headers */
+	uint16_t protocol = 0;
+	memcpy(&protocol, packet_data + size_header - sizeof(protocol), sizeof(protocol));
+	return protocol == ETHERNET_IPV4 ? size_header : 0;
+}
 
-	ChiSqTypeAnalyzer(const std::vector<ptrid::ProbabilisticScheme> &&vec) {
-		types = vec;
-		count_types = types.size();
-	}
-};
+std::mutex mutex_output; /* of std::cout of checkers */
 
+/* @Analyzer is one of analyzers of ptrid_lib, it is called directly */
+template <class Analyzer>
 struct EthIpv4HttpTypeChecker : ptrid::ProcessorTraffic {
-	TypeAnalyzer *analyzer = nullptr;
+	Analyzer *analyzer = nullptr;
 	std::vector<std::string> type_names;
 	std::unordered_map<TcpSessionName, HttpSessionInfo> opened_http_sessions;
+	bool is_quiet = false; /* types of payloads aren't printed */
+	int link_layer = DLT_EN10MB; /* or DLT_LINUX_SLL of captures of "any" */
+	std::vector<uint16_t> ports; /* ports of HTTP, all ports if it's empty */
+	std::string output; /* printed by EndBatch */
+
+	/* Segments of TCP over IPv4 with payloads or closing sessions. */
+	std::string GetFilter() const { return ptrid::GetTcpPayloadFilter(ports); }
+
+	void SetLinkLayer(int link_layer_packets) { link_layer = link_layer_packets; }
+
+	/* Output of a batch is printed at once, checkers of workers don't mix
+	   their lines. */
+	void EndBatch() {
+		if (output.empty()) return;
+		std::lock_guard<std::mutex> lock(mutex_output);
+		std::cout << output;
+		std::cout.flush();
+		output.clear();
+	}
 
 	bool IsHttpGetRequest(const u_char *data) {
 		return (memcmp(data, "GET", 3) == 0);
@@ -202,16 +147,7 @@ struct EthIpv4HttpTypeChecker : ptrid::ProcessorTraffic {
 		return (memcmp(data, "HTTP", 4) == 0);
 	}
 
-	std::vector<uint32_t> &AddFrequencies(std::vector<uint32_t> &dst,
-																				std::vector<uint32_t> &src) {
-		assert((dst.size() == src.size()) && "EthIpv4HttpTypeChecker::AddFrequencies: vector sizes not equal.");
-		for (size_t i = 0; i < dst.size(); i++)
-			dst[i] += src[i];
-		
-		return dst;
-	}
-
-	void operator()(struct pcap_pkthdr *packet_header,
+	void operator()(const struct pcap_pkthdr *packet_header,
 									const u_char *packet_data) {
 		try {
 			if (!packet_header || !packet_data)
@@ -219,23 +155,25 @@ struct EthIpv4HttpTypeChecker : ptrid::ProcessorTraffic {
 			
 			std::pair<const uint8_t *, size_t> data(nullptr, 0);
 			
+			size_t size_link_header = GetSizeIpv4LinkHeader(link_layer, packet_header, packet_data);
 			struct iphdr *ip_hdr =
-					((struct ethhdr *)packet_data)->h_proto == ETHERNET_IPV4
-							? (struct iphdr *)(packet_data + sizeof(struct ethhdr))
+					size_link_header != 0
+							? (struct iphdr *)(packet_data + size_link_header)
 							: nullptr;
 			struct tcphdr *tcp_hdr = nullptr;
 			
-			if (ip_hdr && ip_hdr->protocol == TCP_PROTOCOL) {
-				tcp_hdr = (struct tcphdr *)(packet_data + sizeof(struct ethhdr) +
+			if (ip_hdr && ip_hdr->protocol == TCP_PROTOCOL &&
+					packet_header->caplen >= size_link_header + (ip_hdr->ihl) * 4 + sizeof(struct tcphdr)) {
+				tcp_hdr = (struct tcphdr *)(packet_data + size_link_header +
 																		(ip_hdr->ihl) * 4);
-				data.first = packet_data + sizeof(struct ethhdr) + (ip_hdr->ihl) * 4 +
-										tcp_hdr->th_off * 4;
-				data.second =
-						packet_header->caplen -
-						(sizeof(struct ethhdr) + (ip_hdr->ihl) * 4 + tcp_hdr->th_off * 4);
+				size_t size_headers = size_link_header + (ip_hdr->ihl) * 4 + tcp_hdr->th_off * 4;
+				if (packet_header->caplen >= size_headers) {
+					data.first = packet_data + size_headers;
+					data.second = packet_header->caplen - size_headers;
+				}
 			}
 
-			if (!data.first || !analyzer || analyzer->count_types == 0) return;
+			if (!data.first || !analyzer || analyzer->GetCountTypes() == 0) return;
 
 			boost::asio::ip::address_v4::bytes_type ipaddr_src;
 			memcpy(ipaddr_src.data(), &(ip_hdr->saddr), ipaddr_src.size());
@@ -249,42 +187,36 @@ struct EthIpv4HttpTypeChecker : ptrid::ProcessorTraffic {
 			try {
 				HttpSessionInfo &http_info = opened_http_sessions.at(tcp_name);
 
-				std::cout << http_info.get_request;
+				if (!is_quiet) output += http_info.get_request;
 
-				if ((tcp_hdr->th_flags & TH_FIN) == 1 ||
-						(tcp_hdr->th_flags & TH_RST) == 1)
-					opened_http_sessions.erase(tcp_name);
+				bool is_closed = (tcp_hdr->th_flags & TH_FIN) != 0 ||
+												 (tcp_hdr->th_flags & TH_RST) != 0;
 
-				if (data.second < 20) return;
+				if (data.second >= 20) {
+					size_t type_index = 0;
+					if (IsHttpGetResponse(data.first))
+						type_index = analyzer->operator()(data.first, data.second);
+					else
+						type_index = analyzer->AddToSession(http_info.sample, data.first, data.second);
 
-				
-				ptrid::ReaderBytes reader(2);
-				reader.Read(data.first, data.second);
-				std::vector<uint32_t> data_frequencies = reader.GetFrequencies();
-				size_t type_index = 0;
-				if (IsHttpGetResponse(data.first))
-					type_index = analyzer->operator()(data_frequencies);
-				else
-					type_index = analyzer->operator()(
-							AddFrequencies(http_info.frequencies, data_frequencies));
+					if (!is_quiet)
+						output += "Data type is " + type_names[type_index] + '\n';
+				}
 
-				std::cout << "Data type is " + type_names[type_index] << std::endl;
+				/* @http_info isn't used after it */
+				if (is_closed) opened_http_sessions.erase(tcp_name);
 
 			} catch (std::out_of_range &e) {
-				if (IsHttpGetRequest(data.first)) {
+				if (data.second >= 3 && IsHttpGetRequest(data.first)) {
 					size_t newline_pos = 0;
 					while (newline_pos != data.second && data.first[newline_pos] != '\n')
 						newline_pos += 1;
-					char get_request[newline_pos + 2];
-					memcpy(get_request, data.first, newline_pos+1);
-					get_request[newline_pos+1] = '\0';
-					
-					HttpSessionInfo http_info;
-					http_info.get_request = get_request;
-					http_info.frequencies =
-							std::move(std::vector<uint32_t>(65536, 0.));
-					std::cout << http_info.get_request << "Data type is plain_text"
-										<< std::endl;
+					if (newline_pos != data.second) newline_pos += 1;
+
+					HttpSessionInfo http_info(
+							std::string((const char *)data.first, newline_pos));
+					if (!is_quiet)
+						output += http_info.get_request + "Data type is plain_text\n";
 					opened_http_sessions[tcp_name] = std::move(http_info);
 					return;
 				}
@@ -296,10 +228,342 @@ struct EthIpv4HttpTypeChecker : ptrid::ProcessorTraffic {
 	}
 };
 
+/* the sniffer stopped by SIGINT and SIGTERM, handlers may use only
+   lock-free atomics */
+std::atomic<ptrid::Sniffer *> running_sniffer = nullptr;
+static_assert(std::atomic<ptrid::Sniffer *>::is_always_lock_free);
+
+void StopSniffing(int) {
+	if (ptrid::Sniffer *sniffer = running_sniffer.load()) sniffer->Stop();
+}
+
+/* @sniffer is stopped by signals while the guard lives, it's declared
+   after the sniffer, so it's reset before the sniffer is destroyed and
+   when sniffing throws. */
+class RunningSnifferGuard {
+ public:
+	explicit RunningSnifferGuard(ptrid::Sniffer *sniffer) noexcept { running_sniffer = sniffer; }
+
+	~RunningSnifferGuard() { running_sniffer = nullptr; }
+
+	RunningSnifferGuard(const RunningSnifferGuard &) = delete;
+	RunningSnifferGuard &operator=(const RunningSnifferGuard &) = delete;
+};
+
+/* Handlers don't restart poll of the sniffer, it sees the stop at once. */
+void SetStopHandlers() {
+	struct sigaction action = {};
+	action.sa_handler = StopSniffing;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+}
+
+struct SniffOptions {
+	std::vector<std::string> replay_paths; /* capture files, live traffic without them */
+	bool is_realtime = false;
+	bool is_quiet = false;
+	std::string interface_name; /* "" - the first interface */
+	std::vector<uint16_t> ports;
+	std::chrono::seconds time_sniffing = std::chrono::seconds(60); /* 0 - until a signal */
+	ptrid::CaptureSettings capture;
+	size_t count_workers = 0; /* 0 - packets are checked by the capturing thread */
+	size_t size_ring = 4096;	/* packets of a ring of a worker, a power of 2 */
+};
+
+template <class Analyzer>
+void SetUpChecker(EthIpv4HttpTypeChecker<Analyzer> &checker, Analyzer *analyzer,
+									const std::vector<std::string> &type_names, const SniffOptions &options) {
+	checker.analyzer = analyzer;
+	checker.type_names = type_names;
+	checker.is_quiet = options.is_quiet;
+	checker.ports = options.ports;
+}
+
+/* A packet copied out of the buffer of pcap, @data keeps its capacity
+   between packets of a slot. */
+struct CapturedPacket {
+	struct pcap_pkthdr header;
+	std::vector<u_char> data;
+};
+
+template <class Analyzer>
+struct CheckerWorker {
+	Analyzer analyzer;
+	EthIpv4HttpTypeChecker<Analyzer> checker;
+	ptrid::SpscRing<CapturedPacket> ring;
+	std::thread thread;
+
+	CheckerWorker(const Analyzer &analyzer_shared, size_t size_ring)
+			: analyzer(analyzer_shared), ring(size_ring) {}
+};
+
+/* The capturing thread hashes the session of a packet and copies it to the
+   ring of its worker, both directions of a session go to one worker. Every
+   worker has its own analyzer and table of sessions. Packets of full rings
+   are dropped and counted. */
+template <class Analyzer>
+class ShardedChecker : public ptrid::ProcessorTraffic {
+ private:
+	Analyzer &analyzer_;
+	std::vector<std::unique_ptr<CheckerWorker<Analyzer>>> workers_;
+	std::atomic<bool> is_stopped_ = false;
+	int link_layer_ = DLT_EN10MB;
+
+	/* packets checked by a worker between prints of its output, the ring
+	   of a busy worker is never empty */
+	static constexpr size_t kSizeWorkerBatch = 256;
+
+	void RunWorker(CheckerWorker<Analyzer> &worker) {
+		size_t count_idle = 0;
+		size_t count_checked = 0;
+		while (true) {
+			CapturedPacket *packet = worker.ring.Front();
+			if (!packet) {
+				/* the capturing thread doesn't push after the stop */
+				if (is_stopped_ && !worker.ring.Front()) break;
+				worker.checker.EndBatch();
+				if (++count_idle < 64)
+					std::this_thread::yield();
+				else
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+				continue;
+			}
+			count_idle = 0;
+			try {
+				worker.checker(&packet->header, packet->data.data());
+			} catch (std::exception &e) {
+				std::cerr << "Error: " << e.what() << std::endl;
+			}
+			worker.ring.Pop();
+			if (++count_checked % kSizeWorkerBatch == 0) worker.checker.EndBatch();
+		}
+		worker.checker.EndBatch();
+	}
+
+ public:
+	ShardedChecker(Analyzer &analyzer, const std::vector<std::string> &type_names,
+								 const SniffOptions &options)
+			: analyzer_(analyzer) {
+		for (size_t i = 0; i < options.count_workers; i++) {
+			workers_.push_back(
+					std::make_unique<CheckerWorker<Analyzer>>(analyzer, options.size_ring));
+			SetUpChecker(workers_.back()->checker, &workers_.back()->analyzer, type_names, options);
+		}
+		for (auto &worker : workers_)
+			worker->thread = std::thread(&ShardedChecker::RunWorker, this, std::ref(*worker));
+	}
+
+	~ShardedChecker() { Stop(); }
+
+	/* Workers check the rest of their rings and finish. */
+	void Stop() {
+		is_stopped_ = true;
+		for (auto &worker : workers_) {
+			if (!worker->thread.joinable()) continue;
+			worker->thread.join();
+			if constexpr (requires { analyzer_.AddCounts(worker->analyzer); })
+				analyzer_.AddCounts(worker->analyzer);
+		}
+	}
+
+	void SetLinkLayer(int link_layer) {
+		link_layer_ = link_layer;
+		for (auto &worker : workers_) worker->checker.SetLinkLayer(link_layer);
+	}
+
+	std::string GetFilter() const { return workers_[0]->checker.GetFilter(); }
+
+	void operator()(const struct pcap_pkthdr *packet_header, const u_char *packet_data) {
+		size_t size_link_header = GetSizeIpv4LinkHeader(link_layer_, packet_header, packet_data);
+		if (size_link_header == 0) return;
+		const struct iphdr *ip_hdr = (const struct iphdr *)(packet_data + size_link_header);
+		if (ip_hdr->protocol != TCP_PROTOCOL ||
+				packet_header->caplen < size_link_header + (ip_hdr->ihl) * 4 + sizeof(struct tcphdr))
+			return;
+		const struct tcphdr *tcp_hdr =
+				(const struct tcphdr *)(packet_data + size_link_header + (ip_hdr->ihl) * 4);
+
+		boost::asio::ip::address_v4::bytes_type ipaddr_src;
+		memcpy(ipaddr_src.data(), &(ip_hdr->saddr), ipaddr_src.size());
+		boost::asio::ip::address_v4::bytes_type ipaddr_dst;
+		memcpy(ipaddr_dst.data(), &(ip_hdr->daddr), ipaddr_dst.size());
+		TcpSessionName tcp_name(ipaddr_src, tcp_hdr->source, ipaddr_dst, tcp_hdr->dest);
+
+		CheckerWorker<Analyzer> &worker =
+				*workers_[std::hash<TcpSessionName>()(tcp_name) % workers_.size()];
+		CapturedPacket *packet = worker.ring.BeginPush();
+		if (!packet) return;
+		packet->header = *packet_header;
+		packet->data.assign(packet_data, packet_data + packet_header->caplen);
+		worker.ring.EndPush();
+	}
+
+	void ReportStatistics() override {
+		for (size_t i = 0; i < workers_.size(); i++) {
+			const ptrid::SpscRing<CapturedPacket> &ring = workers_[i]->ring;
+			std::cout << "Worker " << i << ": " << ring.GetSize() << " of " << ring.GetCapacity()
+								<< " packets in the ring (at most " << ring.GetMaxSize() << "), "
+								<< ring.GetCountPushed() << " pushed, " << ring.GetCountFull()
+								<< " dropped by the full ring" << std::endl;
+		}
+	}
+};
+
+/* Replays capture files one after another and reports the throughput. */
+template <class Processor>
+void Replay(Processor &processor, const SniffOptions &options) {
+	ptrid::Sniffer sniffer((ptrid::ProcessorTraffic *)&processor);
+	sniffer.SetCaptureSettings(options.capture);
+	auto time_start = std::chrono::steady_clock::now();
+	{
+		RunningSnifferGuard running(&sniffer);
+		for (const std::string &path : options.replay_paths) {
+			sniffer.OpenFile(path);
+			int link_layer = sniffer.GetLinkLayerProtocol();
+			if (link_layer != DLT_EN10MB && link_layer != DLT_LINUX_SLL)
+				throw std::runtime_error(path + " - doesn't capture of ethernet or linux cooked.");
+			processor.SetLinkLayer(link_layer);
+			sniffer.Replay(options.is_realtime);
+			sniffer.CloseFile();
+		}
+	}
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - time_start;
+	double seconds = std::max(duration.count(), 1e-9);
+	std::cout << "Replayed " << sniffer.GetCountPackets() << " packets ("
+						<< sniffer.GetCountBytes() << " bytes) in " << duration.count() << " s: "
+						<< sniffer.GetCountPackets() / seconds << " packets/s, "
+						<< sniffer.GetCountBytes() / seconds << " bytes/s" << std::endl;
+}
+
+/* Sniffs an interface or replays capture files. */
+template <class Processor>
+void Capture(Processor &processor, const SniffOptions &options) {
+	if (!options.replay_paths.empty()) {
+		Replay(processor, options);
+		return;
+	}
+
+	ptrid::Sniffer sniffer((ptrid::ProcessorTraffic *)&processor);
+	std::string interface_name = options.interface_name;
+	if (interface_name == "") {
+		std::vector<std::string> interfaces = sniffer.GetAvailableInterfaceNames();
+		if (interfaces.empty())
+			throw std::runtime_error("there are no interfaces for sniffing.");
+		interface_name = interfaces[0];
+	}
+	sniffer.SetInterfaceName(interface_name);
+	sniffer.SetCaptureSettings(options.capture);
+	sniffer.OpenInterface();
+	std::cout << "Filter: " << sniffer.GetFilter() << std::endl;
+	int link_layer = sniffer.GetLinkLayerProtocol();
+	if (link_layer != DLT_EN10MB && link_layer != DLT_LINUX_SLL)
+		throw std::runtime_error("Ethernet protocol doesn't using on this interface.");
+	processor.SetLinkLayer(link_layer);
+	RunningSnifferGuard running(&sniffer);
+	sniffer.Run(options.time_sniffing);
+	sniffer.CloseInterface();
+}
+
+/* Packets are checked by the capturing thread or by workers. */
+template <class Analyzer>
+void Sniff(Analyzer &analyzer, const std::vector<std::string> &type_names,
+					 const SniffOptions &options) {
+	SetStopHandlers();
+	if (options.count_workers == 0) {
+		EthIpv4HttpTypeChecker<Analyzer> checker;
+		SetUpChecker(checker, &analyzer, type_names, options);
+		Capture(checker, options);
+		return;
+	}
+	ShardedChecker<Analyzer> checker(analyzer, type_names, options);
+	Capture(checker, options);
+	checker.Stop();
+	/* the sniffer reports rings of live captures with its drops */
+	if (!options.replay_paths.empty()) checker.ReportStatistics();
+}
+
+/* Calls @feed(type, window, block, len) with windows of regular files of
+   types, windows are numbered through files of a type. */
+template <class Feed>
+void ForEachWindow(const std::vector<std::string> &paths, Feed feed) {
+	const size_t kSizeWindow = ptrid::CascadeClassifier::kSizeWindow;
+	for (size_t type = 0; type < paths.size(); type++) {
+		size_t count_windows = 0;
+		for (const std::filesystem::directory_entry &entry :
+				 std::filesystem::recursive_directory_iterator(
+						 paths[type], std::filesystem::directory_options::skip_permission_denied)) {
+			if (!entry.is_regular_file() || ptrid::ReaderBytes::IsDump(entry.path().string()))
+				continue;
+			ptrid::ReaderBytes::FeedFileMapped(
+					entry.path().string(), [&](const uint8_t *block, size_t len) {
+						for (size_t begin = 0; begin < len; begin += kSizeWindow, count_windows++)
+							feed(type, count_windows, block + begin, std::min(kSizeWindow, len - begin));
+					});
+		}
+	}
+}
+
+/* Learns the cascade on all windows of samples of types and fits it to
+   @coverage of them. */
+void LearnCascade(ptrid::CascadeTypeAnalyzer &analyzer, const std::vector<std::string> &paths,
+									double coverage) {
+	ptrid::CascadeClassifier &classifier = analyzer.GetClassifier();
+	ForEachWindow(paths, [&](size_t type, size_t, const uint8_t *window, size_t len) {
+		classifier.Learn(type, window, len);
+	});
+	classifier.Fit();
+	size_t max_count_candidates = classifier.GetCountCandidates();
+	double max_entropy = classifier.GetMaxEntropy();
+	classifier.Fit(coverage);
+	std::cout << "Cascade: " << classifier.GetCountCandidates() << " of "
+						<< classifier.GetCountTypes() << " types are candidates for all but "
+						<< classifier.GetCountBeyondCandidates() << " of " << classifier.GetCountWindows()
+						<< " windows (" << max_count_candidates << " for all), entropy above "
+						<< classifier.GetMaxEntropy() << " bits is random for all but "
+						<< classifier.GetCountAboveEntropy() << " windows (" << max_entropy
+						<< " bits for all)" << std::endl;
+}
+
+/* Learns @analyzer on even windows of samples of types and compares it with
+   scoring by all types on odd ones. */
+void ReportCascade(ptrid::CascadeTypeAnalyzer &analyzer, const std::vector<std::string> &paths,
+									 double coverage) {
+	ForEachWindow(paths, [&](size_t type, size_t index, const uint8_t *window, size_t len) {
+		if (index % 2 == 0) analyzer.GetClassifier().Learn(type, window, len);
+	});
+	analyzer.GetClassifier().Fit(coverage);
+
+	size_t count_held_out = 0, count_right_full = 0, count_right_cascade = 0;
+	std::chrono::steady_clock::duration duration_full{}, duration_cascade{};
+	ForEachWindow(paths, [&](size_t type, size_t index, const uint8_t *window, size_t len) {
+		if (index % 2 == 0) return;
+		count_held_out++;
+		auto time_start = std::chrono::steady_clock::now();
+		count_right_full += analyzer.GetMarkov().GetScorer().GetBest(window, len) == type;
+		auto time_full = std::chrono::steady_clock::now();
+		count_right_cascade += analyzer(window, len) == type;
+		duration_full += time_full - time_start;
+		duration_cascade += std::chrono::steady_clock::now() - time_full;
+	});
+
+	double count_windows = std::max<size_t>(count_held_out, 1);
+	std::cout << "Cascade on " << count_held_out << " held-out windows: accuracy "
+						<< 100. * count_right_cascade / count_windows << "% (all types "
+						<< 100. * count_right_full / count_windows << "%), "
+						<< std::chrono::duration<double>(duration_full).count() /
+									 std::max(std::chrono::duration<double>(duration_cascade).count(), 1e-9)
+						<< " times faster" << std::endl;
+}
+
 int main(int argc, char** argv) {
 	boost::program_options::options_description opt_descr(
 		"Usage: ptrid_new --types PATH_TO_TYPE_1 ... PATH_TO_TYPE_N " 
-		"[--save PATH] [--mode {MC, ID, CHI2}]");
+		"[--save PATH] [--mode {MC, ID, CHI2}] [--threads N] [--quantize {16, 8}] "
+		"[--early-exit PAIRS] [--cascade [--cascade-coverage FRACTION] [--cascade-report]] [--replay FILE_1 ... FILE_N [--realtime]] [--quiet] "
+		"[--interface NAME] [--time SECONDS] [--snaplen BYTES] [--buffer MB] "
+		"[--timeout MS] [--immediate] [--tstamp-type NAME] [--stats-interval SECONDS] "
+		"[--ports PORT_1 ... PORT_N] [--filter EXPRESSION] [--workers N] [--ring-size PACKETS]");
 	opt_descr.add_options()("help,h", "print usage message")(
 			"save", boost::program_options::value<std::string>()->default_value("."),
 			"path to directory for saving data")(
@@ -309,7 +573,57 @@ int main(int argc, char** argv) {
 					->required(),
 			"paths to directories containing files of the same type")(
 			"mode", boost::program_options::value<std::string>()->default_value("MC"),
-			"mode of analyzing of data (MC - markov chain, ID - information distance, CHI2 - chi-squared)"
+			"mode of analyzing of data (MC - markov chain, ID - information distance, CHI2 - chi-squared)")(
+			"threads", boost::program_options::value<size_t>()->default_value(1),
+			"number of threads reading directories of types (0 - all hardware threads)")(
+			"quantize", boost::program_options::value<std::string>(),
+			"width in bits of codes of log-probabilities of MC models (16 or 8), "
+			"models of doubles are used without it")(
+			"early-exit", boost::program_options::value<size_t>()->default_value(0),
+			"pairs of a payload scored between checks of early exit of MC "
+			"(0 - payloads are scored exactly)")(
+			"cascade", boost::program_options::bool_switch(),
+			"payloads of MC are shortlisted by bytes before scoring by pairs, "
+			"thresholds are learned from the types")(
+			"cascade-coverage", boost::program_options::value<double>()->default_value(1.),
+			"fraction of windows of the types covered by thresholds of the cascade "
+			"(1 - the thresholds are maxima of the windows)")(
+			"cascade-report", boost::program_options::bool_switch(),
+			"accuracy and speed of the cascade are reported on held-out windows of the types")(
+			"replay",
+			boost::program_options::value<std::vector<std::string>>()->multitoken(),
+			"pcap files replayed instead of sniffing of an interface")(
+			"realtime", boost::program_options::bool_switch(),
+			"packets of replayed files keep gaps of their timestamps, "
+			"they are replayed as fast as possible without it")(
+			"quiet", boost::program_options::bool_switch(),
+			"types of payloads aren't printed")(
+			"interface", boost::program_options::value<std::string>()->default_value(""),
+			"interface for sniffing (the first one by default)")(
+			"time", boost::program_options::value<size_t>()->default_value(60),
+			"seconds of sniffing (0 - until SIGINT or SIGTERM)")(
+			"snaplen", boost::program_options::value<int>()->default_value(262144),
+			"bytes of a packet captured")(
+			"buffer", boost::program_options::value<int>()->default_value(0),
+			"megabytes of the kernel ring of packets (0 - the default of libpcap)")(
+			"timeout", boost::program_options::value<int>()->default_value(100),
+			"milliseconds of waiting of packets to deliver them by batches")(
+			"immediate", boost::program_options::bool_switch(),
+			"packets are delivered as soon as they arrive")(
+			"tstamp-type", boost::program_options::value<std::string>()->default_value(""),
+			"type of timestamps of packets (host, host_lowprec, host_hiprec, adapter, "
+			"adapter_unsynced)")(
+			"stats-interval", boost::program_options::value<size_t>()->default_value(0),
+			"seconds between reports of dropped packets (0 - at the end of sniffing)")(
+			"ports", boost::program_options::value<std::vector<uint16_t>>()->multitoken(),
+			"ports of HTTP sessions (all ports by default)")(
+			"filter", boost::program_options::value<std::string>()->default_value(""),
+			"pcap-filter expression applied with the filter of HTTP sessions")(
+			"workers", boost::program_options::value<size_t>()->default_value(0),
+			"threads checking sessions, packets are sharded by sessions "
+			"(0 - packets are checked by the capturing thread)")(
+			"ring-size", boost::program_options::value<size_t>()->default_value(4096),
+			"packets of the ring of a worker (a power of 2)"
 			);
 
 	try {
@@ -332,57 +646,107 @@ int main(int argc, char** argv) {
 																" - doesn't directory.");
 		}
 
+		SniffOptions sniff_options;
+		if (vm.count("replay") > 0)
+			sniff_options.replay_paths = vm["replay"].as<std::vector<std::string>>();
+		sniff_options.is_realtime = vm["realtime"].as<bool>();
+		sniff_options.is_quiet = vm["quiet"].as<bool>();
+		sniff_options.interface_name = vm["interface"].as<std::string>();
+		sniff_options.time_sniffing = std::chrono::seconds(vm["time"].as<size_t>());
+		sniff_options.capture.size_snapshot = vm["snaplen"].as<int>();
+		sniff_options.capture.size_buffer = vm["buffer"].as<int>() * 1024 * 1024;
+		sniff_options.capture.timeout_ms = vm["timeout"].as<int>();
+		sniff_options.capture.is_immediate = vm["immediate"].as<bool>();
+		sniff_options.capture.tstamp_type = vm["tstamp-type"].as<std::string>();
+		if (vm.count("ports") > 0)
+			sniff_options.ports = vm["ports"].as<std::vector<uint16_t>>();
+		sniff_options.capture.filter = vm["filter"].as<std::string>();
+		sniff_options.count_workers = vm["workers"].as<size_t>();
+		sniff_options.size_ring = vm["ring-size"].as<size_t>();
+		sniff_options.capture.stats_interval =
+				std::chrono::seconds(vm["stats-interval"].as<size_t>());
+		if (sniff_options.capture.size_snapshot <= 0 || vm["buffer"].as<int>() < 0 ||
+				vm["buffer"].as<int>() > 2047)
+			throw std::invalid_argument("parameters \'snaplen\' or \'buffer\' are incorrect.");
+		for (const std::string &path : sniff_options.replay_paths) {
+			if (!std::filesystem::is_regular_file(std::filesystem::path(path)))
+				throw std::runtime_error(path + " - doesn't file.");
+		}
+
 		ptrid::ReaderBytes reader(2);
-		EthIpv4HttpTypeChecker checker;
+		reader.SetCountThreads(vm["threads"].as<size_t>());
+		const std::vector<std::string> &paths = vm["types"].as<std::vector<std::string>>();
+		std::vector<std::string> type_names = paths;
+		type_names.push_back(std::string("random"));
 
+		/* the analyzer is chosen once, the checker is compiled for it */
 		if (vm["mode"].as<std::string>() == "MC") {
-			std::vector<ptrid::MarkovChain> types(
-				vm["types"].as<std::vector<std::string>>().size() + 1);
-			
+			std::vector<MarkovChain> types(paths.size() + 1);
 			for(size_t i = 0; i < types.size()-1; i++) {
 				reader.Clean();
-				reader.Read(vm["types"].as<std::vector<std::string>>()[i]);
-				types[i].Create(ptrid::ProbabilisticScheme(2, 256, reader.GetFrequencies()));
+				reader.Read(paths[i]);
+				types[i].Create(ProbabilisticScheme(2, 256, reader.GetFrequencies()));
 				types[i].useAdditiveSmoothing(1000);
 			}
-			types[types.size()-1].Create(ptrid::ProbabilisticScheme(2, 256, std::vector<uint32_t>(256*256, 1)));
-
-			checker.analyzer = new MarkovTypeAnalyzer(types);
-			checker.type_names = vm["types"].as<std::vector<std::string>>();
-			checker.type_names.push_back(std::string("random"));
+			types[types.size()-1].Create(ProbabilisticScheme(2, 256, std::vector<uint32_t>(256*256, 1)));
+
+			if (vm.count("quantize") > 0) {
+				ptrid::QuantizedTypeAnalyzer analyzer(
+						std::span<const MarkovChain>(types),
+						ptrid::GetQuantizedWidth(vm["quantize"].as<std::string>()));
+				Sniff(analyzer, type_names, sniff_options);
+			} else if (vm["cascade"].as<bool>()) {
+				std::vector<std::vector<uint32_t>> unigrams;
+				ptrid::ReaderBytes reader_bytes(1);
+				reader_bytes.SetCountThreads(vm["threads"].as<size_t>());
+				for (const std::string &path : paths) {
+					reader_bytes.Clean();
+					reader_bytes.Read(path);
+					unigrams.push_back(reader_bytes.GetFrequencies());
+				}
+				unigrams.emplace_back(256, 1);
+				ptrid::CascadeTypeAnalyzer analyzer(std::span<const MarkovChain>(types),
+																						 unigrams, types.size() - 1);
+				double coverage = vm["cascade-coverage"].as<double>();
+				if (!(coverage > 0. && coverage <= 1.))
+					throw std::invalid_argument("parameter \'cascade-coverage\' is incorrect.");
+				if (vm["cascade-report"].as<bool>()) {
+					ptrid::CascadeTypeAnalyzer probe(std::span<const MarkovChain>(types), unigrams,
+																					 types.size() - 1);
+					ReportCascade(probe, paths, coverage);
+				}
+				LearnCascade(analyzer, paths, coverage);
+				Sniff(analyzer, type_names, sniff_options);
+			} else {
+				ptrid::MarkovTypeAnalyzer analyzer{std::span<const MarkovChain>(types)};
+				analyzer.SetEarlyExit(vm["early-exit"].as<size_t>());
+				Sniff(analyzer, type_names, sniff_options);
+				if (analyzer.GetEarlyExit() > 0)
+					std::cout << "Early exit scored " << analyzer.GetCountConsumed() << " of "
+										<< analyzer.GetCountBytes() << " bytes of payloads" << std::endl;
+			}
 		} else if (vm["mode"].as<std::string>() == "ID" || 
 							 vm["mode"].as<std::string>() == "CHI2") {
-			std::vector<ptrid::ProbabilisticScheme> types(
-					vm["types"].as<std::vector<std::string>>().size() + 1);
-			
+			std::vector<ProbabilisticScheme> types(paths.size() + 1);
 			for(size_t i = 0; i < types.size()-1; i++) {
 				reader.Clean();
-				reader.Read(vm["types"].as<std::vector<std::string>>()[i]);
+				reader.Read(paths[i]);
 				types[i].Create(2, 256, reader.GetFrequencies());
 				types[i].useAdditiveSmoothing(1000);
 			}
 			types[types.size()-1].Create(2, 256, std::vector<uint32_t>(256*256, 1));
 
-			if (vm["mode"].as<std::string>() == "ID")
-				checker.analyzer = new InfoDistTypeAnalyzer(types);
-			else
-				checker.analyzer = new ChiSqTypeAnalyzer(types);
-			checker.type_names = vm["types"].as<std::vector<std::string>>();
-			checker.type_names.push_back(std::string("random"));
+			/* samples are smoothed by useAdditiveSmoothing(1000) */
+			if (vm["mode"].as<std::string>() == "ID") {
+				ptrid::InfoDistTypeAnalyzer analyzer(std::span<const ProbabilisticScheme>(types), 1000.);
+				Sniff(analyzer, type_names, sniff_options);
+			} else {
+				ptrid::ChiSqTypeAnalyzer analyzer(std::span<const ProbabilisticScheme>(types), 1000.);
+				Sniff(analyzer, type_names, sniff_options);
+			}
 		} else {
 			throw std::invalid_argument("parameter \'mode\' is incorrect.");
 		}
-
-		ptrid::Sniffer sniffer((ptrid::ProcessorTraffic *)&checker);
-		std::vector<std::string> interfaces = sniffer.GetAvailableInterfaceNames();
-		sniffer.SetInterfaceName(interfaces[0]);
-		sniffer.OpenInterface();
-		if (sniffer.GetLinkLayerProtocol() != DLT_EN10MB)
-			throw std::runtime_error("Ethernet protocol doesn't using on this interface.");
-		std::chrono::seconds time_sniffing(60);
-		sniffer.Run(time_sniffing);
-		sniffer.CloseInterface();
-		delete checker.analyzer;
 	} catch (std::exception &e) {
 		if (e.what()[0] == '\0')
 			std::cout << opt_descr << std::endl;
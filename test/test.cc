@@ -1,10 +1,103 @@
 #include <gtest/gtest.h>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/serialization/vector.hpp>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <thread>
+
+#include "../src/ptrid_lib/batch_scorer.h"
+#include "../src/ptrid_lib/cascade_classifier.h"
+#include "../src/ptrid_lib/corpus_index.h"
+#include "../src/ptrid_lib/dumps.h"
+#include "../src/ptrid_lib/histogram.h"
+#include "../src/ptrid_lib/ngrams.h"
 #include "../src/ptrid_lib/readers.h"
+#include "../src/ptrid_lib/sniffer.h"
 #include "../src/ptrid_lib/probabilistic_scheme.h"
 #include "../src/ptrid_lib/markov_chain.h"
+#include "../src/ptrid_lib/likelihood_model.h"
+#include "../src/ptrid_lib/quantized_model.h"
+#include "../src/ptrid_lib/spsc_ring.h"
+#include "../src/ptrid_lib/type_analyzer.h"
 #include "../src/ptrid_lib/math_func.h"
 
+/* Allocations of the current thread are counted while @count_allocations
+   is set. All forms of operator new and delete are replaced, they aren't
+   inlined, so callers don't see malloc and free behind them. */
+static thread_local bool count_allocations = false;
+static thread_local size_t count_allocated = 0;
+
+static void *Allocate(size_t size, std::align_val_t alignment) noexcept {
+	if (count_allocations) count_allocated += 1;
+	size_t align = static_cast<size_t>(alignment);
+	size = std::max<size_t>(size, 1);
+	if (align <= alignof(std::max_align_t)) return malloc(size);
+	return aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+static void *AllocateOrThrow(size_t size, std::align_val_t alignment) {
+	if (void *memory = Allocate(size, alignment)) return memory;
+	throw std::bad_alloc();
+}
+
+constexpr std::align_val_t kAlignNew{alignof(std::max_align_t)};
+
+[[gnu::noinline]] void *operator new(size_t size) { return AllocateOrThrow(size, kAlignNew); }
+[[gnu::noinline]] void *operator new[](size_t size) { return AllocateOrThrow(size, kAlignNew); }
+[[gnu::noinline]] void *operator new(size_t size, std::align_val_t alignment) {
+	return AllocateOrThrow(size, alignment);
+}
+[[gnu::noinline]] void *operator new[](size_t size, std::align_val_t alignment) {
+	return AllocateOrThrow(size, alignment);
+}
+[[gnu::noinline]] void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	return Allocate(size, kAlignNew);
+}
+[[gnu::noinline]] void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return Allocate(size, kAlignNew);
+}
+[[gnu::noinline]] void *operator new(size_t size, std::align_val_t alignment,
+																		 const std::nothrow_t &) noexcept {
+	return Allocate(size, alignment);
+}
+[[gnu::noinline]] void *operator new[](size_t size, std::align_val_t alignment,
+																			 const std::nothrow_t &) noexcept {
+	return Allocate(size, alignment);
+}
+
+[[gnu::noinline]] void operator delete(void *memory) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete[](void *memory) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete(void *memory, size_t) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete[](void *memory, size_t) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete(void *memory, std::align_val_t) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete[](void *memory, std::align_val_t) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+	free(memory);
+}
+[[gnu::noinline]] void operator delete[](void *memory, size_t, std::align_val_t) noexcept {
+	free(memory);
+}
+[[gnu::noinline]] void operator delete(void *memory, const std::nothrow_t &) noexcept {
+	free(memory);
+}
+[[gnu::noinline]] void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+	free(memory);
+}
+[[gnu::noinline]] void operator delete(void *memory, std::align_val_t,
+																			 const std::nothrow_t &) noexcept {
+	free(memory);
+}
+[[gnu::noinline]] void operator delete[](void *memory, std::align_val_t,
+																				 const std::nothrow_t &) noexcept {
+	free(memory);
+}
+
 TEST(ReaderBytesTests, CreateReader) {
 	ptrid::ReaderBytes reader1(1);
 	ptrid::ReaderBytes reader2(2);
@@ -73,12 +166,24 @@ TEST(ReaderBytesTests, ReadFile) {
 	EXPECT_EQ(reader2.GetCountElements(), sum);
 }
 
+/* Reading a directory writes its index into it, so tests read a fresh copy
+   of files_for_simple_tests/dir instead of the fixture itself. */
+static std::string CopyTestDirectory() {
+	std::filesystem::path copy = std::filesystem::temp_directory_path() / "ptrid_test_dir";
+	std::filesystem::remove_all(copy);
+	std::filesystem::create_directory(copy);
+	for (const char *name : {"10a.txt", "5b.txt"})
+		std::filesystem::copy_file(std::filesystem::path("../test/files_for_simple_tests/dir") / name,
+															 copy / name);
+	return copy.string();
+}
+
 TEST(ReaderBytesTests, ReadDirectory) {
 	ptrid::ReaderBytes reader1(1);
 	ptrid::ReaderBytes reader2(2);
 
-	reader1.Read("../test/files_for_simple_tests/dir");
-	reader2.Read("../test/files_for_simple_tests/dir");
+	reader1.Read(CopyTestDirectory());
+	reader2.Read(CopyTestDirectory());
 
 	std::vector<uint32_t> result1, result2;
 
@@ -98,6 +203,787 @@ TEST(ReaderBytesTests, ReadDirectory) {
 	EXPECT_EQ(15, reader2.GetCountElements());
 }
 
+struct ReaderBytesData : ptrid::ReaderBytes {
+	ReaderBytesData(const int8_t deep) : ReaderBytes(deep) {}
+
+	std::vector<uint32_t> ReadWithMode(const std::string &path, ptrid::ReadingMode mode) {
+		std::vector<uint32_t> frequencies(frequencies_.GetSize(), 0);
+		SetReadingMode(mode);
+		ReadData(path, frequencies);
+		return frequencies;
+	}
+};
+
+static std::string WriteTestData(const std::string &name, size_t size) {
+	std::string path = (std::filesystem::temp_directory_path() / name).string();
+	std::mt19937 gen(size);
+	std::ofstream ofs(path, std::ofstream::binary);
+	for (size_t i = 0; i < size; i++) {
+		/* runs of one byte alternate with random bytes */
+		char value = (i / 4096) % 2 ? (char)gen() : 'z';
+		ofs.put(value);
+	}
+	return path;
+}
+
+TEST(ReaderBytesTests, MappedEqualsStream) {
+	std::vector<std::string> paths = {
+			"../test/files_for_simple_tests/empty.txt",
+			"../test/files_for_simple_tests/10a.txt",
+			"../test/files_for_simple_tests/dir/5b.txt",
+			WriteTestData("ptrid_test_1b.bin", 1),
+			WriteTestData("ptrid_test_3m.bin", 3 * (1 << 20) + 17)};
+
+	for (int8_t deep = 1; deep <= 2; deep++) {
+		ReaderBytesData reader(deep);
+		for (auto &path : paths)
+			EXPECT_EQ(reader.ReadWithMode(path, ptrid::ReadingMode::kStream),
+								reader.ReadWithMode(path, ptrid::ReadingMode::kMapped));
+	}
+}
+
+TEST(ReaderBytesTests, MappedReadsPipe) {
+	std::string path_data = WriteTestData("ptrid_test_pipe.bin", 2 * (1 << 20) + 3);
+	std::string path_fifo =
+			(std::filesystem::temp_directory_path() / "ptrid_test.fifo").string();
+	std::filesystem::remove(path_fifo);
+	ASSERT_EQ(0, mkfifo(path_fifo.c_str(), 0600));
+
+	for (int8_t deep = 1; deep <= 2; deep++) {
+		ReaderBytesData reader(deep);
+		std::thread writer([&]() {
+			std::ifstream ifs(path_data, std::ifstream::binary);
+			std::ofstream ofs(path_fifo, std::ofstream::binary);
+			ofs << ifs.rdbuf();
+		});
+		std::vector<uint32_t> from_pipe =
+				reader.ReadWithMode(path_fifo, ptrid::ReadingMode::kMapped);
+		writer.join();
+		EXPECT_EQ(reader.ReadWithMode(path_data, ptrid::ReadingMode::kStream), from_pipe);
+	}
+
+	/* callers learn whether the file came in one mapped block */
+	size_t size_fed = 0;
+	bool is_mapped = false;
+	auto feed = [&size_fed](const uint8_t *, size_t len) { size_fed += len; };
+	EXPECT_TRUE(ptrid::ReaderBytes::FeedFileMapped(path_data, feed, &is_mapped));
+	EXPECT_TRUE(is_mapped);
+	std::thread writer([&]() {
+		std::ifstream ifs(path_data, std::ifstream::binary);
+		std::ofstream ofs(path_fifo, std::ofstream::binary);
+		ofs << ifs.rdbuf();
+	});
+	EXPECT_TRUE(ptrid::ReaderBytes::FeedFileMapped(path_fifo, feed, &is_mapped));
+	writer.join();
+	EXPECT_FALSE(is_mapped);
+	EXPECT_EQ(2 * std::filesystem::file_size(path_data), size_fed);
+	EXPECT_FALSE(ptrid::ReaderBytes::FeedFileMapped(
+			std::filesystem::temp_directory_path().string(), feed, &is_mapped));
+	EXPECT_EQ(EISDIR, errno);
+	std::filesystem::remove(path_fifo);
+}
+
+static std::string MakeTestDirectory(const std::string &name, size_t count_files) {
+	std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+	std::filesystem::remove_all(path);
+	std::filesystem::create_directory(path);
+	for (size_t i = 0; i < count_files; i++) {
+		std::filesystem::path path_to_file = WriteTestData(name + "_" + std::to_string(i), 5000 + i * 777);
+		std::filesystem::rename(path_to_file, path / path_to_file.filename());
+	}
+	return path.string();
+}
+
+static void RemoveDumps(const std::string &path) {
+	for (auto &entry : std::filesystem::directory_iterator(path))
+		if (entry.path().extension() == ".dmp")
+			std::filesystem::remove(entry.path());
+}
+
+TEST(ReaderBytesTests, ReadDirectoryParallel) {
+	std::string path = MakeTestDirectory("ptrid_test_parallel", 23);
+
+	for (int8_t deep = 1; deep <= 2; deep++) {
+		ptrid::ReaderBytes sequential(deep);
+		sequential.Read(path);
+		RemoveDumps(path);
+
+		ptrid::ReaderBytes parallel(deep);
+		parallel.SetCountThreads(4);
+		EXPECT_EQ(4, parallel.GetCountThreads());
+		parallel.Read(path);
+		EXPECT_EQ(sequential.GetFrequencies(), parallel.GetFrequencies());
+
+		ptrid::ReaderBytes from_index(deep);
+		from_index.SetCountThreads(3);
+		from_index.Read(path);
+		EXPECT_EQ(sequential.GetFrequencies(), from_index.GetFrequencies());
+	}
+	std::filesystem::remove_all(path);
+}
+
+TEST(DumpTests, ChecksumDoesntDependOnBlocks) {
+	std::string path = WriteTestData("ptrid_test_checksum.bin", 100003);
+	std::ifstream ifs(path, std::ifstream::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+	ptrid::Checksum whole;
+	whole.Update(data.data(), data.size());
+	ptrid::Checksum by_blocks;
+	for (size_t i = 0, len = 1; i < data.size(); i += len, len = len * 3 % 101 + 1)
+		by_blocks.Update(data.data() + i, std::min(len, data.size() - i));
+	EXPECT_EQ(whole.Get(), by_blocks.Get());
+	EXPECT_EQ(whole.Get(), ptrid::GetChecksumOfFile(path));
+
+	data[data.size() / 2] ^= 1;
+	ptrid::Checksum changed;
+	changed.Update(data.data(), data.size());
+	EXPECT_NE(whole.Get(), changed.Get());
+}
+
+TEST(DumpTests, StaleDumpIsRebuilt) {
+	std::string path = WriteTestData("ptrid_test_stale.bin", 4000);
+	std::string path_to_dump = path + "_2.dmp";
+	std::filesystem::remove(path_to_dump);
+
+	ptrid::ReaderBytes reader(2);
+	reader.Read(path);
+	ASSERT_TRUE(ptrid::IsBinaryDump(path_to_dump));
+	auto time_of_dump = std::filesystem::last_write_time(path_to_dump);
+
+	/* new time but the same data: the dump is still used */
+	std::filesystem::last_write_time(path, time_of_dump + std::chrono::seconds(5));
+	ptrid::ReaderBytes touched(2);
+	touched.Read(path);
+	EXPECT_EQ(reader.GetFrequencies(), touched.GetFrequencies());
+	EXPECT_EQ(time_of_dump, std::filesystem::last_write_time(path_to_dump));
+
+	/* the same size but other data */
+	{
+		std::fstream fs(path, std::fstream::in | std::fstream::out | std::fstream::binary);
+		fs.seekp(10);
+		fs.put('\x01');
+	}
+	std::vector<uint32_t> expected = reader.GetFrequencies();
+	ptrid::ReaderBytes changed(2);
+	changed.Read(path);
+	EXPECT_NE(expected, changed.GetFrequencies());
+
+	ptrid::ReaderBytes rebuilt(2);
+	rebuilt.SetReadingMode(ptrid::ReadingMode::kStream);
+	std::filesystem::remove(path_to_dump);
+	rebuilt.Read(path);
+	EXPECT_EQ(rebuilt.GetFrequencies(), changed.GetFrequencies());
+}
+
+TEST(DumpTests, TextDumpIsMigrated) {
+	std::string path = WriteTestData("ptrid_test_text_dump.bin", 3000);
+	std::string path_to_dump = path + "_1.dmp";
+	ptrid::ReaderBytes reader(1);
+	std::filesystem::remove(path_to_dump);
+	reader.Read(path);
+
+	/* a text dump with wrong data proves that the dump is really read */
+	std::vector<uint32_t> text_frequencies = reader.GetFrequencies();
+	text_frequencies[0] += 1;
+	{
+		std::ofstream ofs(path_to_dump);
+		boost::archive::text_oarchive output_archive(ofs);
+		output_archive << text_frequencies;
+	}
+	ASSERT_FALSE(ptrid::IsBinaryDump(path_to_dump));
+
+	ptrid::ReaderBytes migrated(1);
+	migrated.Read(path);
+	EXPECT_EQ(text_frequencies, migrated.GetFrequencies());
+	EXPECT_TRUE(ptrid::IsBinaryDump(path_to_dump));
+
+	ptrid::ReaderBytes from_binary(1);
+	from_binary.Read(path);
+	EXPECT_EQ(text_frequencies, from_binary.GetFrequencies());
+}
+
+TEST(DumpTests, DirectoryDumpFollowsSamples) {
+	std::string path = MakeTestDirectory("ptrid_test_dir_dump", 5);
+	ptrid::ReaderBytes reader(2);
+	reader.Read(path);
+
+	std::filesystem::path path_to_new_file = WriteTestData("ptrid_test_dir_dump_new", 700);
+	std::filesystem::rename(path_to_new_file, path + "/" + path_to_new_file.filename().string());
+	ptrid::ReaderBytes with_new_file(2);
+	with_new_file.Read(path);
+	EXPECT_EQ(reader.GetCountElements() + 700, with_new_file.GetCountElements());
+	std::filesystem::remove_all(path);
+}
+
+static std::vector<uint32_t> SumFrequencies(int8_t deep, const std::vector<std::string> &paths) {
+	ReaderBytesData reader(deep);
+	std::vector<uint32_t> sum;
+	for (auto &path : paths) {
+		std::vector<uint32_t> frequencies = reader.ReadWithMode(path, ptrid::ReadingMode::kStream);
+		sum.resize(frequencies.size(), 0);
+		for (size_t i = 0; i < frequencies.size(); i++)
+			sum[i] += frequencies[i];
+	}
+	return sum;
+}
+
+TEST(IndexTests, FollowsChangedSamples) {
+	std::string path = MakeTestDirectory("ptrid_test_index", 6);
+	std::filesystem::create_directories(path + "/sub/subsub");
+	std::filesystem::rename(path + "/ptrid_test_index_4", path + "/sub/ptrid_test_index_4");
+	std::filesystem::rename(path + "/ptrid_test_index_5", path + "/sub/subsub/ptrid_test_index_5");
+	for (int8_t deep = 1; deep <= 2; deep++) {
+		ptrid::ReaderBytes reader(deep);
+		reader.Read(path);
+		EXPECT_EQ(SumFrequencies(deep, {path + "/ptrid_test_index_0", path + "/ptrid_test_index_1",
+																		path + "/ptrid_test_index_2", path + "/ptrid_test_index_3",
+																		path + "/sub/ptrid_test_index_4",
+																		path + "/sub/subsub/ptrid_test_index_5"}),
+							reader.GetFrequencies());
+	}
+
+	/* a removed sample, a sample changed in place and a new sample */
+	std::filesystem::remove(path + "/sub/ptrid_test_index_4");
+	{
+		std::fstream fs(path + "/ptrid_test_index_1",
+										std::fstream::in | std::fstream::out | std::fstream::binary);
+		fs.seekp(100);
+		fs.write("\x01\x02\x03", 3);
+	}
+	std::filesystem::path path_to_new_file = WriteTestData("ptrid_test_index_new", 900);
+	std::filesystem::rename(path_to_new_file, path + "/sub/subsub/new");
+	for (int8_t deep = 1; deep <= 2; deep++) {
+		ptrid::ReaderBytes reader(deep);
+		reader.SetCountThreads(2);
+		reader.Read(path);
+		EXPECT_EQ(SumFrequencies(deep, {path + "/ptrid_test_index_0", path + "/ptrid_test_index_1",
+																		path + "/ptrid_test_index_2", path + "/ptrid_test_index_3",
+																		path + "/sub/subsub/ptrid_test_index_5",
+																		path + "/sub/subsub/new"}),
+							reader.GetFrequencies());
+
+		ptrid::CorpusIndex index(path + "/index_" + std::to_string(deep) + ".dmp", deep,
+														 reader.GetFrequencies().size());
+		index.Load();
+		EXPECT_EQ(6, index.GetEntries().size());
+		EXPECT_NE(nullptr, index.Find("sub/subsub/new"));
+		EXPECT_EQ(nullptr, index.Find("sub/ptrid_test_index_4"));
+	}
+
+	/* a touched sample isn't read again, its entry gets the new time */
+	std::filesystem::last_write_time(path + "/ptrid_test_index_2",
+																	 std::filesystem::last_write_time(path + "/ptrid_test_index_2") +
+																			 std::chrono::hours(1));
+	for (int8_t deep = 1; deep <= 2; deep++) {
+		ptrid::ReaderBytes reader(deep);
+		reader.Read(path);
+		ptrid::CorpusIndex index(path + "/index_" + std::to_string(deep) + ".dmp", deep,
+														 reader.GetFrequencies().size());
+		index.Load();
+		ASSERT_NE(nullptr, index.Find("ptrid_test_index_2"));
+		EXPECT_EQ(ptrid::GetSourceInfo(path + "/ptrid_test_index_2").mtime,
+							index.Find("ptrid_test_index_2")->source.mtime);
+		EXPECT_EQ(index.GetFrequencies(), reader.GetFrequencies());
+	}
+	std::filesystem::remove_all(path);
+}
+
+TEST(IndexTests, ResumesFromJournal) {
+	std::string path = MakeTestDirectory("ptrid_test_journal", 3);
+	std::string path_to_index = path + "/index_1.dmp";
+	std::string path_to_journal = path + "/index_1.journal.dmp";
+	ptrid::ReaderBytes reader(1);
+	reader.Read(path);
+
+	/* an interrupted run left a put of a read sample and a half written record */
+	std::vector<uint32_t> expected = reader.GetFrequencies();
+	{
+		ptrid::CorpusIndex index(path_to_index, 1, expected.size());
+		index.Load();
+		ptrid::CorpusIndex::Entry entry = *index.Find("ptrid_test_journal_0");
+		std::vector<uint32_t> frequencies(expected.size(), 0);
+		ptrid::CorpusIndex::DecodeCells(entry.cells, [&](size_t i, uint32_t frequency) {
+			frequencies[i] = frequency;
+		});
+		frequencies[7] += 5;
+		expected[7] += 5;
+		entry.cells = ptrid::CorpusIndex::EncodeCells(frequencies);
+		index.Put("ptrid_test_journal_0", std::move(entry));
+		index.Flush();
+	}
+	{
+		std::ofstream ofs(path_to_journal, std::ofstream::binary | std::ofstream::app);
+		ofs.write("\x01\x00\x00\x00\xff", 5);
+	}
+
+	ptrid::ReaderBytes resumed(1);
+	resumed.Read(path);
+	EXPECT_EQ(expected, resumed.GetFrequencies());
+	EXPECT_FALSE(std::filesystem::exists(path_to_journal));
+
+	ptrid::ReaderBytes committed(1);
+	committed.Read(path);
+	EXPECT_EQ(expected, committed.GetFrequencies());
+	std::filesystem::remove_all(path);
+}
+
+TEST(IndexTests, CellsRoundTrip) {
+	std::vector<uint32_t> frequencies(65536, 0);
+	frequencies[0] = 1;
+	frequencies[1] = 300;
+	frequencies[200] = UINT32_MAX;
+	frequencies[65535] = 7;
+	std::vector<uint32_t> decoded(frequencies.size(), 0);
+	ptrid::CorpusIndex::DecodeCells(ptrid::CorpusIndex::EncodeCells(frequencies),
+																	[&](size_t i, uint32_t frequency) { decoded[i] = frequency; });
+	EXPECT_EQ(frequencies, decoded);
+	EXPECT_TRUE(ptrid::CorpusIndex::EncodeCells(std::vector<uint32_t>(256, 0)).empty());
+}
+
+TEST(NGramTests, TableCountsLikeMap) {
+	std::mt19937_64 gen(11);
+	ptrid::NGramTable table, other;
+	std::map<uint64_t, uint32_t> expected;
+	for (size_t i = 0; i < 20000; i++) {
+		uint64_t key = gen() % 5000 * 0x10001;
+		(i % 3 ? table : other).Add(key);
+		expected[key] += 1;
+	}
+	table.Merge(other);
+	EXPECT_EQ(expected.size(), table.GetCountKeys());
+	EXPECT_EQ(20000, table.GetCountElements());
+	for (auto &[key, count] : expected)
+		EXPECT_EQ(count, table.Get(key));
+	EXPECT_EQ(0, table.Get(0x10000));
+	table.Clear();
+	EXPECT_EQ(0, table.GetCountKeys());
+}
+
+static std::map<uint64_t, uint32_t> CountNGramsNaive(int8_t deep, const std::string &path) {
+	std::ifstream ifs(path, std::ifstream::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	std::map<uint64_t, uint32_t> ngrams;
+	for (size_t i = 0; i + deep <= data.size(); i++) {
+		uint64_t key = 0;
+		for (int8_t k = deep - 1; k >= 0; k--)
+			key = key * 256 + data[i + k];
+		ngrams[key] += 1;
+	}
+	return ngrams;
+}
+
+TEST(NGramTests, ReaderCountsNGrams) {
+	std::string path = WriteTestData("ptrid_test_ngrams.bin", 100000);
+	std::string path_to_blocks = WriteTestData("ptrid_test_ngrams_blocks.bin", (1 << 20) + 5);
+	for (int8_t deep = 3; deep <= ptrid::kMaxDeep; deep += 5) {
+		ptrid::ReaderBytes reader(deep);
+		reader.Read(path);
+		EXPECT_TRUE(reader.GetFrequencies().empty());
+		std::map<uint64_t, uint32_t> counted;
+		reader.GetNGrams().ForEach([&](uint64_t key, uint32_t count) { counted[key] = count; });
+		EXPECT_EQ(CountNGramsNaive(deep, path), counted);
+
+		/* n-grams crossing blocks of the stream */
+		ptrid::ReaderBytes mapped(deep), stream(deep);
+		stream.SetReadingMode(ptrid::ReadingMode::kStream);
+		mapped.Read(path_to_blocks);
+		stream.Read(path_to_blocks);
+		EXPECT_EQ(mapped.GetNGrams().GetCountKeys(), stream.GetNGrams().GetCountKeys());
+		size_t count_differences = 0;
+		mapped.GetNGrams().ForEach([&](uint64_t key, uint32_t count) {
+			count_differences += stream.GetFrequency(key) != count;
+		});
+		EXPECT_EQ(0, count_differences);
+	}
+}
+
+TEST(NGramTests, ReaderReadsDirectory) {
+	std::string path = MakeTestDirectory("ptrid_test_ngrams_dir", 9);
+	ptrid::ReaderBytes from_files(4);
+	for (auto &entry : std::filesystem::directory_iterator(path))
+		from_files.Read(entry.path().string());
+
+	ptrid::ReaderBytes from_directory(4);
+	from_directory.SetCountThreads(3);
+	from_directory.Read(path);
+	EXPECT_EQ(from_files.GetCountElements(), from_directory.GetCountElements());
+	from_files.GetNGrams().ForEach([&](uint64_t key, uint32_t count) {
+		EXPECT_EQ(count, from_directory.GetFrequency(key));
+	});
+	std::filesystem::remove_all(path);
+}
+
+TEST(NGramTests, ChainBacksOff) {
+	std::string path = WriteTestData("ptrid_test_chain.bin", 20000);
+	ptrid::ReaderBytes reader(3);
+	reader.Read(path);
+	ptrid::NGramMarkovChain chain(3, reader.GetNGrams());
+	EXPECT_LT(chain.GetCountKeys(), 4 * reader.GetNGrams().GetCountKeys());
+
+	/* a frequent, a seen and an unseen context */
+	uint64_t seen_context = 0;
+	reader.GetNGrams().ForEach([&](uint64_t key, uint32_t) { seen_context = key & 0xFFFF; });
+	for (uint64_t context : {(uint64_t)'z' + 'z' * 256, seen_context, (uint64_t)0xFFFE}) {
+		long double sum = 0;
+		for (uint64_t byte = 0; byte < 256; byte++)
+			sum += chain.GetProbability(context + (byte << 16));
+		EXPECT_NEAR(1., sum, 1e-9);
+	}
+	EXPECT_GT(chain.GetProbability('z' + 'z' * 256 + 'z' * 65536), 0.5);
+	EXPECT_GT(chain.GetProbability(0xFFFE + ('a' << 16)), 0.);
+
+	/* long runs of one byte take one n-gram for any deep */
+	std::string path_to_run = (std::filesystem::temp_directory_path() / "ptrid_test_run.bin").string();
+	std::ofstream(path_to_run, std::ofstream::binary) << std::string(100000, 'z');
+	ptrid::ReaderBytes run_reader(ptrid::kMaxDeep);
+	run_reader.Read(path_to_run);
+	EXPECT_EQ(1, run_reader.GetNGrams().GetCountKeys());
+	EXPECT_EQ(100000 - ptrid::kMaxDeep + 1, run_reader.GetCountElements());
+}
+
+TEST(AllocationTests, ClassifyDoesntCopy) {
+	ptrid::ReaderBytes type_reader(2);
+	type_reader.Read(CopyTestDirectory());
+	ptrid::ProbabilisticScheme scheme(2, 256, type_reader.GetFrequencies());
+	ptrid::MarkovChain chain{ptrid::ProbabilisticScheme(scheme)};
+	chain.useAdditiveSmoothing(1000);
+	std::vector<ptrid::MarkovChain> chains(2);
+	chains[0] = ptrid::MarkovChain(chain);
+	chains[1].Create(ptrid::ProbabilisticScheme(2, 256, std::vector<uint32_t>(256 * 256, 1)));
+	ptrid::LikelihoodModel model(chain);
+	ptrid::MarkovTypeAnalyzer analyzer{std::span<const ptrid::MarkovChain>(chains)};
+	std::vector<uint8_t> payload(70000);
+	std::mt19937 gen(3);
+	for (auto &value : payload) value = gen() % 16;
+	ptrid::ReaderBytes reader(2);
+	reader.Read(payload.data(), payload.size());
+	/* buffers of the scorer are allocated by the first call */
+	size_t type = analyzer(reader.GetHistogram());
+
+	count_allocated = 0;
+	count_allocations = true;
+	/* the one allocation which must be counted */
+	{ std::vector<int> control(1); }
+	double result = 0;
+	size_t count_found = 0;
+	for (size_t i = 0; i < 3; i++) {
+		reader.Clean();
+		reader.Read(payload.data(), payload.size());
+		result += model.Score(reader.GetFrequencies());
+		count_found += analyzer(reader.GetHistogram()) == type;
+	}
+	ptrid::ReaderBytes moved_reader(std::move(reader));
+	ptrid::ProbabilisticScheme moved_scheme(std::move(scheme));
+	ptrid::MarkovChain moved_chain(std::move(chain));
+	moved_reader = std::move(type_reader);
+	moved_chain = ptrid::MarkovChain(std::move(moved_chain));
+	count_allocations = false;
+
+	EXPECT_EQ(1, count_allocated);
+	EXPECT_LT(result, 0);
+	EXPECT_EQ(3, count_found);
+	EXPECT_EQ(65536, moved_scheme.GetSizeScheme());
+	EXPECT_EQ(256, moved_chain.GetSizeSet());
+	EXPECT_EQ(15, moved_reader.GetCountElements());
+}
+
+/* Samples of four synthetic types: text, random bytes, little-endian
+   counters and base64. */
+static std::vector<uint8_t> MakeTypedSample(size_t type, size_t size, std::mt19937 &gen) {
+	static const std::vector<std::string> words = {"the ", "data ", "type ", "of ", "traffic ",
+																								 "is ", "found\n", "by ", "bytes, "};
+	static const std::string base64 =
+			"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::vector<uint8_t> sample;
+	for (uint32_t counter = gen() % 1000; sample.size() < size; counter += gen() % 3) {
+		if (type == 0) {
+			const std::string &word = words[gen() % words.size()];
+			sample.insert(sample.end(), word.begin(), word.end());
+		} else if (type == 1) {
+			sample.push_back(gen());
+		} else if (type == 2) {
+			for (size_t k = 0; k < 4; k++) sample.push_back(counter >> (8 * k));
+		} else {
+			sample.push_back(base64[gen() % base64.size()]);
+		}
+	}
+	sample.resize(size);
+	return sample;
+}
+
+template <class Real>
+static std::vector<size_t> ClassifyTypedSamples(const std::vector<std::vector<uint32_t>> &types,
+																								const std::vector<std::vector<uint32_t>> &samples) {
+	std::vector<ptrid::BasicProbabilisticScheme<Real>> schemes;
+	std::vector<ptrid::BasicMarkovChain<Real>> chains;
+	for (auto &frequencies : types) {
+		schemes.emplace_back(2, 256, frequencies);
+		schemes.back().useAdditiveSmoothing(1000);
+		chains.emplace_back(ptrid::BasicProbabilisticScheme<Real>(2, 256, frequencies));
+		chains.back().useAdditiveSmoothing(1000);
+	}
+
+	/* the types found by the likelihood, the information distance and chi2 */
+	std::vector<size_t> found;
+	for (auto &frequencies : samples) {
+		ptrid::BasicProbabilisticScheme<Real> scheme(2, 256, frequencies);
+		scheme.useAdditiveSmoothing(1000);
+		std::vector<long double> likelihoods(types.size(), 0);
+		std::vector<Real> distances(types.size()), chi2(types.size());
+		for (size_t type = 0; type < types.size(); type++) {
+			for (size_t i = 0; i < frequencies.size(); i++)
+				if (frequencies[i] != 0)
+					likelihoods[type] += frequencies[i] * log10l(chains[type].GetProbability(i % 256, i / 256));
+			distances[type] = ptrid::GetInfoDistance(schemes[type], scheme);
+			chi2[type] = ptrid::GetChi2(scheme, schemes[type]);
+		}
+		found.push_back(std::max_element(likelihoods.begin(), likelihoods.end()) - likelihoods.begin());
+		found.push_back(std::min_element(distances.begin(), distances.end()) - distances.begin());
+		found.push_back(std::min_element(chi2.begin(), chi2.end()) - chi2.begin());
+	}
+	return found;
+}
+
+TEST(PrecisionTests, ClassificationDoesntDependOnPrecision) {
+	const size_t count_types = 4;
+	std::mt19937 gen(5);
+	std::vector<std::vector<uint32_t>> types, samples;
+	for (size_t type = 0; type < count_types; type++) {
+		ptrid::ReaderBytes reader(2);
+		for (size_t i = 0; i < 8; i++) {
+			std::vector<uint8_t> sample = MakeTypedSample(type, 20000, gen);
+			reader.Read(sample.data(), sample.size());
+		}
+		types.push_back(reader.GetFrequencies());
+	}
+	for (size_t i = 0; i < 40; i++) {
+		ptrid::ReaderBytes reader(2);
+		std::vector<uint8_t> sample = MakeTypedSample(i % count_types, 64 + gen() % 3000, gen);
+		reader.Read(sample.data(), sample.size());
+		samples.push_back(reader.GetFrequencies());
+	}
+
+	std::vector<size_t> found = ClassifyTypedSamples<long double>(types, samples);
+	EXPECT_EQ(found, ClassifyTypedSamples<double>(types, samples));
+	EXPECT_EQ(found, ClassifyTypedSamples<float>(types, samples));
+	size_t count_right = 0;
+	for (size_t i = 0; i < found.size(); i++)
+		count_right += found[i] == (i / 3) % count_types;
+	EXPECT_GT(count_right, found.size() * 3 / 4);
+}
+
+/* Types are the text of dir and the capture of a JPEG transfer, samples
+   are the text files and windows of the capture. Files are read as bytes,
+   so reading them doesn't write dumps. */
+TEST(PrecisionTests, FixturesDontDependOnPrecision) {
+	const std::string path = "../test/files_for_simple_tests/";
+	auto read_file = [&path](const std::string &name) {
+		std::ifstream ifs(path + name, std::ifstream::binary);
+		EXPECT_TRUE(ifs.is_open()) << name;
+		return std::vector<uint8_t>((std::istreambuf_iterator<char>(ifs)),
+																std::istreambuf_iterator<char>());
+	};
+	std::vector<uint8_t> capture = read_file("test_jpg.pcap");
+	ptrid::ReaderBytes text_reader(2), capture_reader(2);
+	for (const std::string name : {"dir/10a.txt", "dir/5b.txt"}) {
+		std::vector<uint8_t> text = read_file(name);
+		text_reader.Read(text.data(), text.size());
+	}
+	capture_reader.Read(capture.data(), capture.size());
+	std::vector<std::vector<uint32_t>> types = {text_reader.GetFrequencies(),
+																						 capture_reader.GetFrequencies()};
+
+	std::vector<std::vector<uint32_t>> samples;
+	for (const std::string name : {"10a.txt", "dir/10a.txt", "dir/5b.txt", "empty.txt"}) {
+		std::vector<uint8_t> text = read_file(name);
+		ptrid::ReaderBytes reader(2);
+		if (!text.empty()) reader.Read(text.data(), text.size());
+		samples.push_back(reader.GetFrequencies());
+	}
+	const size_t count_texts = samples.size();
+	for (size_t begin = 0; begin + 1460 <= capture.size(); begin += 1460 * 10) {
+		ptrid::ReaderBytes reader(2);
+		reader.Read(capture.data() + begin, 1460);
+		samples.push_back(reader.GetFrequencies());
+	}
+
+	std::vector<size_t> found = ClassifyTypedSamples<long double>(types, samples);
+	EXPECT_EQ(found, ClassifyTypedSamples<double>(types, samples));
+	EXPECT_EQ(found, ClassifyTypedSamples<float>(types, samples));
+	/* by the likelihood, letters are of the text, the empty file scores zero
+	   by both types and windows are of the capture */
+	for (size_t i = 0; i < count_texts; i++) EXPECT_EQ(0, found[i * 3]) << i;
+	for (size_t i = count_texts; i < samples.size(); i++) EXPECT_EQ(1, found[i * 3]) << i;
+}
+
+/* Unsmoothed schemes keep zero cells, which kernels must skip. */
+template <class Real>
+static void ExpectMathKernelsEqualScalar(std::mt19937 &gen) {
+	std::vector<uint32_t> frequencies_a(256 * 256), frequencies_b(256 * 256);
+	for (size_t i = 0; i < frequencies_a.size() - 3; i++) {
+		frequencies_a[i] = gen() % 3 == 0 ? 0 : gen() % 1000;
+		frequencies_b[i] = gen() % 5 == 0 ? 0 : gen() % 1000;
+	}
+	ptrid::BasicProbabilisticScheme<Real> a(2, 256, frequencies_a), b(2, 256, frequencies_b);
+	ptrid::BasicMarkovChain<Real> chain(b);
+
+	Real info_distance = ptrid::GetInfoDistance(ptrid::HistogramKernel::kScalar, a, b);
+	Real chi2 = ptrid::GetChi2(ptrid::HistogramKernel::kScalar, a, b);
+	Real entropy = ptrid::GetEntropy(ptrid::HistogramKernel::kScalar, a);
+	Real entropy_chain = ptrid::GetEntropy(ptrid::HistogramKernel::kScalar, chain);
+	for (ptrid::HistogramKernel kernel : {ptrid::HistogramKernel::kAvx2, ptrid::HistogramKernel::kAvx512}) {
+		if (!ptrid::IsSupportedHistogramKernel(kernel)) continue;
+		/* sums of both are taken in double, float results are rounded to
+		   about 1e-7 of them */
+		double tolerance = std::is_same_v<Real, float> ? 1e-6 : 1e-9;
+		EXPECT_NEAR(info_distance, ptrid::GetInfoDistance(kernel, a, b), tolerance)
+				<< ptrid::GetHistogramKernelName(kernel);
+		EXPECT_NEAR(chi2, ptrid::GetChi2(kernel, a, b), fabs(chi2) * tolerance)
+				<< ptrid::GetHistogramKernelName(kernel);
+		EXPECT_NEAR(entropy, ptrid::GetEntropy(kernel, a), tolerance * 16)
+				<< ptrid::GetHistogramKernelName(kernel);
+		EXPECT_NEAR(entropy_chain, ptrid::GetEntropy(kernel, chain), tolerance * 16)
+				<< ptrid::GetHistogramKernelName(kernel);
+	}
+}
+
+TEST(MathFuncTests, KernelsEqualScalarReference) {
+	std::mt19937 gen(23);
+	ExpectMathKernelsEqualScalar<float>(gen);
+	ExpectMathKernelsEqualScalar<double>(gen);
+	ptrid::BasicProbabilisticScheme<long double> scheme(1, 256, std::vector<uint32_t>(256, 1));
+	EXPECT_NEAR(8., ptrid::GetEntropy(ptrid::HistogramKernel::kAvx2, scheme), 1e-12);
+}
+
+/* Times of the kernels over 256x256 cells of double are printed, they
+   depend on the build and the machine, so they aren't checked. */
+TEST(MathFuncTests, TimesOfKernels) {
+	const size_t kCountRuns = 20;
+	std::mt19937 gen(29);
+	std::vector<uint32_t> frequencies_a(256 * 256), frequencies_b(256 * 256);
+	for (size_t i = 0; i < frequencies_a.size(); i++) {
+		frequencies_a[i] = gen() % 3 == 0 ? 0 : gen() % 1000;
+		frequencies_b[i] = gen() % 1000 + 1;
+	}
+	ptrid::BasicProbabilisticScheme<double> a(2, 256, frequencies_a), b(2, 256, frequencies_b);
+
+	auto time_kernel = [&](ptrid::HistogramKernel kernel) {
+		volatile double sink = 0.;
+		std::vector<double> durations;
+		for (int func = 0; func < 3; func++) {
+			auto time_start = std::chrono::steady_clock::now();
+			for (size_t run = 0; run < kCountRuns; run++) {
+				if (func == 0) sink = sink + ptrid::GetInfoDistance(kernel, a, b);
+				if (func == 1) sink = sink + ptrid::GetEntropy(kernel, a);
+				if (func == 2) sink = sink + ptrid::GetChi2(kernel, a, b);
+			}
+			std::chrono::duration<double, std::micro> duration =
+					std::chrono::steady_clock::now() - time_start;
+			durations.push_back(duration.count() / kCountRuns);
+		}
+		std::cout << ptrid::GetHistogramKernelName(kernel) << ": information distance "
+							<< durations[0] << " us, entropy " << durations[1] << " us, chi2 "
+							<< durations[2] << " us" << std::endl;
+	};
+
+	for (ptrid::HistogramKernel kernel : {ptrid::HistogramKernel::kScalar, ptrid::HistogramKernel::kAvx2,
+																				ptrid::HistogramKernel::kAvx512})
+		if (ptrid::IsSupportedHistogramKernel(kernel)) time_kernel(kernel);
+}
+
+TEST(HistogramTests, KernelsEqualScalar) {
+	std::mt19937 gen(7);
+	std::vector<uint8_t> random_data(300000), low_entropy_data(300000);
+	for (size_t i = 0; i < random_data.size(); i++) {
+		random_data[i] = gen();
+		low_entropy_data[i] = (i / 1000) % 3 ? 'a' : 'b' + i % 2;
+	}
+
+	for (auto kernel : {ptrid::HistogramKernel::kSse2, ptrid::HistogramKernel::kAvx2,
+											ptrid::HistogramKernel::kAvx512}) {
+		if (!ptrid::IsSupportedHistogramKernel(kernel)) continue;
+		for (int8_t deep = 1; deep <= 2; deep++)
+			for (auto *data : {&random_data, &low_entropy_data})
+				for (size_t len : {0, 1, 2, 9, 17, 1500, 70000, 300000}) {
+					std::vector<uint32_t> expected(65536, 3), result(65536, 3);
+					ptrid::CountFrequencies(ptrid::HistogramKernel::kScalar, deep,
+																	data->data(), len, expected.data());
+					ptrid::CountFrequencies(kernel, deep, data->data(), len, result.data());
+					EXPECT_EQ(expected, result) << ptrid::GetHistogramKernelName(kernel)
+																			<< " deep " << (int)deep << " len " << len;
+				}
+	}
+}
+
+TEST(HistogramTests, TouchedEqualsDense) {
+	std::mt19937 gen(23);
+	ptrid::TouchedHistogram session(65536), packet(65536);
+	std::vector<uint32_t> expected(65536, 0);
+	for (size_t i = 0; i < 40; i++) {
+		std::vector<uint8_t> payload(20 + gen() % 200);
+		for (auto &byte : payload) byte = gen() % 64;
+		packet.Clean();
+		EXPECT_EQ(0, packet.GetCountElements());
+		packet.Count(2, payload.data(), payload.size());
+		ptrid::CountFrequencies(2, payload.data(), payload.size(), expected.data());
+		session.Merge(packet);
+		EXPECT_EQ(payload.size() - 1, packet.GetCountElements());
+		EXPECT_FALSE(packet.IsDense());
+	}
+	EXPECT_EQ(expected, session.GetCounts());
+	uint64_t count_elements = 0;
+	size_t count_cells = 0;
+	session.ForEach([&](size_t cell, uint32_t count) {
+		EXPECT_EQ(expected[cell], count);
+		count_elements += count;
+		count_cells += 1;
+	});
+	EXPECT_EQ(count_elements, session.GetCountElements());
+	EXPECT_EQ(count_cells, std::count_if(expected.begin(), expected.end(), [](uint32_t count) { return count != 0; }));
+
+	/* too many cells for the list */
+	std::vector<uint8_t> random_data(20000);
+	for (auto &byte : random_data) byte = gen();
+	session.Count(2, random_data.data(), random_data.size());
+	ptrid::CountFrequencies(2, random_data.data(), random_data.size(), expected.data());
+	EXPECT_TRUE(session.IsDense());
+	EXPECT_EQ(expected, session.GetCounts());
+	session.Clean();
+	EXPECT_FALSE(session.IsDense());
+	EXPECT_EQ(std::vector<uint32_t>(65536, 0), session.GetCounts());
+}
+
+TEST(BatchScorerTests, TouchedEqualsDense) {
+	std::mt19937 gen(29);
+	std::vector<ptrid::BasicProbabilisticScheme<double>> schemes;
+	for (size_t type = 0; type < 3; type++) {
+		std::vector<uint32_t> type_frequencies(256 * 256);
+		for (auto &frequency : type_frequencies) frequency = gen() % 100;
+		schemes.emplace_back(2, 256, type_frequencies);
+		schemes.back().useAdditiveSmoothing(1000);
+	}
+	ptrid::BatchScorer scorer;
+	scorer.Create(ptrid::BatchMetric::kInfoDistance,
+								std::span<const ptrid::BasicProbabilisticScheme<double>>(schemes), 1000.);
+
+	ptrid::ReaderBytes reader(2);
+	std::vector<uint8_t> payload(500);
+	for (auto &byte : payload) byte = gen();
+	reader.Read(payload.data(), payload.size());
+	ASSERT_FALSE(reader.GetHistogram().IsDense());
+	std::vector<double> touched_scores(3), dense_scores(3);
+	scorer.Score(reader.GetHistogram(), touched_scores);
+	scorer.Score(reader.GetFrequencies(), dense_scores);
+	for (size_t type = 0; type < 3; type++)
+		EXPECT_NEAR(dense_scores[type], touched_scores[type], 1e-9);
+	EXPECT_EQ(scorer.GetBest(reader.GetFrequencies()), scorer.GetBest(reader.GetHistogram()));
+
+	reader.Clean();
+	EXPECT_EQ(0, reader.GetCountElements());
+	EXPECT_EQ(std::vector<uint32_t>(65536, 0), reader.GetFrequencies());
+}
+
 TEST(ProbabilisticSchemeTests, FromEmptyFile) {
 	ptrid::ReaderBytes reader1(1);
 	ptrid::ReaderBytes reader2(2);
@@ -156,8 +1042,8 @@ TEST(ProbabilisticSchemeTests, FromDirectory) {
 	ptrid::ReaderBytes reader1(1);
 	ptrid::ReaderBytes reader2(2);
 
-	reader1.Read("../test/files_for_simple_tests/dir");
-	reader2.Read("../test/files_for_simple_tests/dir");
+	reader1.Read(CopyTestDirectory());
+	reader2.Read(CopyTestDirectory());
 
 	ptrid::ProbabilisticScheme scheme1(reader1.GetDeep(), reader1.GetSizeSet(), reader1.GetFrequencies());
 	ptrid::ProbabilisticScheme scheme2(reader2.GetDeep(), reader2.GetSizeSet(), reader2.GetFrequencies());
@@ -179,10 +1065,36 @@ TEST(ProbabilisticSchemeTests, FromDirectory) {
 	EXPECT_TRUE(1. - sum < 1e-10);
 }
 
+TEST(ProbabilisticSchemeTests, MarginalsFollowNumerators) {
+	std::mt19937 gen(11);
+	std::vector<uint32_t> frequencies(256 * 256);
+	for (auto &frequency : frequencies)
+		frequency = gen() % 4 == 0 ? gen() % 100 : 0;
+
+	ptrid::ProbabilisticScheme scheme(2, 256, frequencies);
+	auto expect_sums = [](const ptrid::ProbabilisticScheme &scheme) {
+		for (size_t i = 0; i < scheme.GetSizeSet(); i++) {
+			long double prob = 0., num = 0.;
+			for (size_t j = 0; j < scheme.GetSizeSet(); j++) {
+				prob += scheme.GetProbability(i, j);
+				num += scheme.GetNumerator(i, j);
+			}
+			EXPECT_EQ(prob, scheme.GetProbability(i));
+			EXPECT_EQ(num, scheme.GetNumerator(i));
+		}
+	};
+	expect_sums(scheme);
+	scheme.useAdditiveSmoothing(1000);
+	expect_sums(scheme);
+	ptrid::ProbabilisticScheme copied(scheme);
+	expect_sums(copied);
+	ptrid::ProbabilisticScheme moved(std::move(copied));
+	expect_sums(moved);
+}
 TEST(MarkovChainTests, Create) {
 	ptrid::ReaderBytes reader(2);
 	
-	reader.Read("../test/files_for_simple_tests/dir");
+	reader.Read(CopyTestDirectory());
 	ptrid::ProbabilisticScheme scheme(2, 256, reader.GetFrequencies());
 
 	ptrid::MarkovChain chain(scheme);
@@ -201,7 +1113,7 @@ TEST(MarkovChainTests, Create) {
 TEST(MarkovChainTests, Smoothing) {
 	ptrid::ReaderBytes reader(2);
 	
-	reader.Read("../test/files_for_simple_tests/dir");
+	reader.Read(CopyTestDirectory());
 	ptrid::ProbabilisticScheme scheme(2, 256, reader.GetFrequencies());
 	ptrid::MarkovChain chain(scheme);
 	chain.useAdditiveSmoothing();
@@ -216,6 +1128,537 @@ TEST(MarkovChainTests, Smoothing) {
 	}
 }
 
+TEST(MarkovChainTests, TableInOrderOfHistograms) {
+	ptrid::ReaderBytes reader(2);
+
+	reader.Read(CopyTestDirectory());
+	ptrid::MarkovChain chain(ptrid::ProbabilisticScheme(2, 256, reader.GetFrequencies()));
+	chain.useAdditiveSmoothing();
+	std::span<const long double> transitions = chain.GetTransitions();
+	EXPECT_EQ(0, (uintptr_t)transitions.data() % ptrid::kCacheLine);
+	ASSERT_EQ(256 * 256, transitions.size());
+	for (size_t to = 0; to < 256; to++) {
+		std::span<const long double> column = chain.GetColumn(to);
+		for (size_t from = 0; from < 256; from++) {
+			EXPECT_EQ(chain.GetProbability(from, to), transitions[from + to * 256]);
+			EXPECT_EQ(chain.GetProbability(from, to), column[from]);
+		}
+	}
+
+	ptrid::MarkovChain copied(chain);
+	EXPECT_EQ(0, (uintptr_t)copied.GetTransitions().data() % ptrid::kCacheLine);
+	EXPECT_EQ(chain.GetProbability('a', 'a'), copied.GetProbability('a', 'a'));
+}
+
+TEST(LikelihoodModelTests, ScoreEqualsChain) {
+	std::mt19937 gen(13);
+	std::vector<uint32_t> type_frequencies(256 * 256), frequencies(256 * 256);
+	for (size_t i = 0; i < type_frequencies.size(); i++) {
+		type_frequencies[i] = gen() % 3 == 0 ? gen() % 1000 : 0;
+		frequencies[i] = gen() % 5 == 0 ? gen() % 10 : 0;
+	}
+	ptrid::MarkovChain chain(ptrid::ProbabilisticScheme(2, 256, type_frequencies));
+	chain.useAdditiveSmoothing(1000);
+	ptrid::LikelihoodModel model(chain);
+
+	long double expected = 0.;
+	for (size_t from = 0; from < 256; from++)
+		for (size_t to = 0; to < 256; to++)
+			if (frequencies[from + to * 256] != 0)
+				expected += (long double)frequencies[from + to * 256] *
+										log10l(chain.GetProbability(from, to));
+	EXPECT_NEAR(expected, model.Score(frequencies), fabsl(expected) * 1e-12);
+	EXPECT_EQ((double)log10l(chain.GetProbability('a', 'b')), model.GetLogProbability('a', 'b'));
+
+	/* a pair which the chain never gives */
+	ptrid::LikelihoodModel strict_model(ptrid::MarkovChain(ptrid::ProbabilisticScheme(2, 256, type_frequencies)));
+	size_t absent = std::find(type_frequencies.begin(), type_frequencies.end(), 0) - type_frequencies.begin();
+	frequencies[absent] = 1;
+	EXPECT_EQ(-INFINITY, strict_model.Score(frequencies));
+}
+
+/* Scoring walks the table and the histogram in the order of their memory,
+   the same dot product by rows of the table (a stride of 2 KiB) is timed
+   beside it. The times are only printed, they depend on the build. */
+TEST(LikelihoodModelTests, ScoringStreamsTable) {
+	const size_t kCountRuns = 200;
+	std::mt19937 gen(19);
+	std::vector<uint32_t> type_frequencies(256 * 256), frequencies(256 * 256);
+	for (size_t i = 0; i < type_frequencies.size(); i++) {
+		type_frequencies[i] = gen() % 1000;
+		frequencies[i] = gen() % 10;
+	}
+	ptrid::MarkovChain chain(ptrid::ProbabilisticScheme(2, 256, type_frequencies));
+	chain.useAdditiveSmoothing(1000);
+	ptrid::LikelihoodModel model(chain);
+
+	volatile double sink = 0.;
+	auto time_start = std::chrono::steady_clock::now();
+	for (size_t run = 0; run < kCountRuns; run++) sink = sink + model.Score(frequencies);
+	auto time_linear = std::chrono::steady_clock::now();
+	double score_strided = 0.;
+	for (size_t run = 0; run < kCountRuns; run++) {
+		score_strided = 0.;
+		for (size_t from = 0; from < 256; from++)
+			for (size_t to = 0; to < 256; to++)
+				score_strided += frequencies[from + to * 256] * model.GetLogProbability(from, to);
+		sink = sink + score_strided;
+	}
+	auto time_strided = std::chrono::steady_clock::now();
+
+	EXPECT_NEAR(score_strided, model.Score(frequencies), fabs(score_strided) * 1e-9);
+	std::chrono::duration<double, std::micro> duration_linear = time_linear - time_start;
+	std::chrono::duration<double, std::micro> duration_strided = time_strided - time_linear;
+	std::cout << "Scoring of 256x256 pairs: " << duration_linear.count() / kCountRuns
+						<< " us linearly, " << duration_strided.count() / kCountRuns << " us by rows"
+						<< std::endl;
+}
+
+TEST(QuantizedModelTests, KernelsEqualScalarAndErrorIsBounded) {
+	std::mt19937 gen(17);
+	std::vector<uint32_t> type_frequencies(256 * 256), frequencies(256 * 256);
+	for (size_t i = 0; i < type_frequencies.size(); i++) {
+		type_frequencies[i] = gen() % 3 == 0 ? gen() % 1000 : 0;
+		frequencies[i] = gen() % 5 == 0 ? gen() % 100000 : 0;
+	}
+	ptrid::MarkovChain chain(ptrid::ProbabilisticScheme(2, 256, type_frequencies));
+	chain.useAdditiveSmoothing(1000);
+	ptrid::LikelihoodModel model(chain);
+
+	for (ptrid::QuantizedWidth width : {ptrid::QuantizedWidth::k16, ptrid::QuantizedWidth::k8}) {
+		ptrid::QuantizedModel quantized(model, width);
+		double score = quantized.Score(ptrid::HistogramKernel::kScalar, frequencies);
+		for (ptrid::HistogramKernel kernel : {ptrid::HistogramKernel::kSse2, ptrid::HistogramKernel::kAvx2,
+																					ptrid::HistogramKernel::kAvx512})
+			if (ptrid::IsSupportedHistogramKernel(kernel)) {
+				EXPECT_EQ(score, quantized.Score(kernel, frequencies)) << ptrid::GetHistogramKernelName(kernel);
+			}
+
+		double max_error = 0.;
+		for (size_t to = 0; to < 256; to++)
+			for (size_t from = 0; from < 256; from++) {
+				EXPECT_NEAR(model.GetLogProbability(from, to), quantized.GetLogProbability(from, to),
+										quantized.GetMaxError(to) * (1 + 1e-9));
+				max_error += frequencies[from + to * 256] * quantized.GetMaxError(to);
+			}
+		EXPECT_NEAR(model.Score(frequencies), score, max_error);
+	}
+}
+
+TEST(BatchScorerTests, ScoresEqualPerType) {
+	const size_t count_types = 11; /* not a whole number of lanes */
+	std::mt19937 gen(19);
+	std::vector<ptrid::BasicProbabilisticScheme<double>> schemes;
+	std::vector<ptrid::LikelihoodModel> models;
+	for (size_t type = 0; type < count_types; type++) {
+		std::vector<uint32_t> type_frequencies(256 * 256);
+		for (auto &frequency : type_frequencies)
+			frequency = gen() % (type + 2) == 0 ? gen() % 1000 : 0;
+		schemes.emplace_back(2, 256, type_frequencies);
+		schemes.back().useAdditiveSmoothing(1000);
+		ptrid::BasicMarkovChain<double> chain(ptrid::BasicProbabilisticScheme<double>(2, 256, type_frequencies));
+		chain.useAdditiveSmoothing(1000);
+		models.emplace_back(chain);
+	}
+	std::vector<uint32_t> frequencies(256 * 256);
+	for (size_t i = 0; i < 300; i++)
+		frequencies[gen() % frequencies.size()] += gen() % 10 + 1;
+	ptrid::BasicProbabilisticScheme<double> data_scheme(2, 256, frequencies);
+	data_scheme.useAdditiveSmoothing(1000);
+
+	ptrid::BatchScorer likelihood, info_distance, chi2;
+	likelihood.Create(models);
+	info_distance.Create(ptrid::BatchMetric::kInfoDistance,
+											 std::span<const ptrid::BasicProbabilisticScheme<double>>(schemes), 1000.);
+	chi2.Create(ptrid::BatchMetric::kChi2,
+							std::span<const ptrid::BasicProbabilisticScheme<double>>(schemes), 1000.);
+	for (ptrid::HistogramKernel kernel : {ptrid::HistogramKernel::kScalar, ptrid::HistogramKernel::kAvx2,
+																				ptrid::HistogramKernel::kAvx512}) {
+		if (!ptrid::IsSupportedHistogramKernel(kernel)) continue;
+		std::vector<double> scores(count_types);
+		likelihood.Score(kernel, frequencies, scores);
+		for (size_t type = 0; type < count_types; type++)
+			EXPECT_NEAR(models[type].Score(frequencies), scores[type], fabs(scores[type]) * 1e-12);
+		info_distance.Score(kernel, frequencies, scores);
+		for (size_t type = 0; type < count_types; type++)
+			EXPECT_NEAR(ptrid::GetInfoDistance(schemes[type], data_scheme), scores[type], 1e-9);
+		chi2.Score(kernel, frequencies, scores);
+		for (size_t type = 0; type < count_types; type++) {
+			double expected = ptrid::GetChi2(data_scheme, schemes[type]);
+			EXPECT_NEAR(expected, scores[type], fabs(expected) * 1e-9);
+		}
+	}
+	EXPECT_EQ(count_types, likelihood.GetCountTypes());
+}
+
+TEST(BatchScorerTests, PairsWalkEqualsHistogram) {
+	std::mt19937 gen(31);
+	std::vector<ptrid::LikelihoodModel> models;
+	for (size_t type = 0; type < 5; type++) {
+		std::vector<uint32_t> type_frequencies(256 * 256);
+		for (auto &frequency : type_frequencies) frequency = gen() % 100;
+		ptrid::MarkovChain chain(ptrid::ProbabilisticScheme(2, 256, type_frequencies));
+		chain.useAdditiveSmoothing(1000);
+		models.emplace_back(chain);
+	}
+	ptrid::BatchScorer scorer;
+	scorer.Create(models);
+
+	for (size_t len : {(size_t)1, (size_t)2, (size_t)100, (size_t)1460,
+										 ptrid::BatchScorer::kMaxLenPairsWalk + 100}) {
+		std::vector<uint8_t> payload(len);
+		for (auto &byte : payload) byte = gen() % 32;
+		ptrid::ReaderBytes reader(2);
+		reader.Read(payload.data(), payload.size());
+		std::vector<double> expected(5), scores(5);
+		scorer.Score(reader.GetFrequencies(), expected);
+		for (ptrid::HistogramKernel kernel : {ptrid::HistogramKernel::kScalar, ptrid::HistogramKernel::kAvx2,
+																					ptrid::HistogramKernel::kAvx512}) {
+			if (!ptrid::IsSupportedHistogramKernel(kernel)) continue;
+			scorer.ScorePairs(kernel, payload.data(), payload.size(), scores);
+			for (size_t type = 0; type < 5; type++)
+				EXPECT_NEAR(expected[type], scores[type], fabs(expected[type]) * 1e-12) << len;
+		}
+		scorer.Score(payload.data(), payload.size(), scores);
+		for (size_t type = 0; type < 5; type++)
+			EXPECT_NEAR(expected[type], scores[type], fabs(expected[type]) * 1e-12) << len;
+	}
+}
+
+TEST(BatchScorerTests, EarlyExitAgreesWithWholeData) {
+	std::mt19937 gen(41);
+	/* type i is trained on bytes from 16 * i to 16 * i + 15 */
+	std::vector<ptrid::LikelihoodModel> models;
+	for (size_t type = 0; type < 4; type++) {
+		std::vector<uint8_t> sample(100000);
+		for (auto &byte : sample) byte = type * 16 + gen() % 16;
+		ptrid::ReaderBytes reader(2);
+		reader.Read(sample.data(), sample.size());
+		ptrid::MarkovChain chain(ptrid::ProbabilisticScheme(2, 256, reader.GetFrequencies()));
+		chain.useAdditiveSmoothing(1000);
+		models.emplace_back(chain);
+	}
+	ptrid::BatchScorer scorer;
+	scorer.Create(models);
+
+	for (size_t type = 0; type < 4; type++) {
+		std::vector<uint8_t> data(200000);
+		for (auto &byte : data) byte = type * 16 + gen() % 16;
+		ptrid::EarlyExitResult result = scorer.GetBestEarly(data.data(), data.size(), 1000);
+		EXPECT_EQ(type, result.type);
+		EXPECT_TRUE(result.is_early);
+		EXPECT_LT(result.consumed, data.size());
+	}
+	/* undecided data are scored to the end */
+	for (size_t len : {(size_t)0, (size_t)1, (size_t)2, (size_t)5000}) {
+		std::vector<uint8_t> data(len);
+		for (auto &byte : data) byte = gen();
+		std::vector<double> scores(4);
+		scorer.ScorePairs(data.data(), data.size(), scores);
+		ptrid::EarlyExitResult result = scorer.GetBestEarly(data.data(), data.size(), 1000);
+		EXPECT_EQ(std::max_element(scores.begin(), scores.end()) - scores.begin(), result.type);
+		if (!result.is_early) {
+			EXPECT_EQ(len, result.consumed);
+		}
+		/* a file gets the EOF sentinel pair as ReaderBytes counts it */
+		std::vector<uint8_t> file = len < 2 ? std::vector<uint8_t>(2, (uint8_t)EOF) : data;
+		if (len >= 2) file.push_back((uint8_t)EOF);
+		scorer.ScorePairs(file.data(), file.size(), scores);
+		result = scorer.GetBestEarly(data.data(), data.size(), 1000, true);
+		EXPECT_EQ(std::max_element(scores.begin(), scores.end()) - scores.begin(), result.type);
+	}
+}
+
+TEST(BatchScorerTests, SessionEqualsWholeHistogram) {
+	const size_t count_types = 5;
+	std::mt19937 gen(37);
+	std::vector<ptrid::BasicProbabilisticScheme<double>> schemes;
+	std::vector<ptrid::LikelihoodModel> models;
+	for (size_t type = 0; type < count_types; type++) {
+		std::vector<uint32_t> type_frequencies(256 * 256);
+		for (auto &frequency : type_frequencies) frequency = gen() % 100;
+		schemes.emplace_back(2, 256, type_frequencies);
+		schemes.back().useAdditiveSmoothing(1000);
+		ptrid::BasicMarkovChain<double> chain(ptrid::BasicProbabilisticScheme<double>(2, 256, type_frequencies));
+		chain.useAdditiveSmoothing(1000);
+		models.emplace_back(chain);
+	}
+	std::vector<ptrid::BatchScorer> scorers(3);
+	scorers[0].Create(models);
+	scorers[1].Create(ptrid::BatchMetric::kInfoDistance,
+										std::span<const ptrid::BasicProbabilisticScheme<double>>(schemes), 1000.);
+	scorers[2].Create(ptrid::BatchMetric::kChi2,
+										std::span<const ptrid::BasicProbabilisticScheme<double>>(schemes), 1000.);
+
+	for (const auto &scorer : scorers) {
+		ptrid::BatchSession session;
+		ptrid::TouchedHistogram histogram(256 * 256);
+		std::vector<double> expected(count_types), scores(count_types);
+		scorer.Score(session, scores);
+		scorer.Score(histogram, expected);
+		for (size_t type = 0; type < count_types; type++)
+			EXPECT_NEAR(expected[type], scores[type], fabs(expected[type]) * 1e-9 + 1e-9);
+		/* repeated bytes make counts above 1 */
+		for (size_t len : {(size_t)1, (size_t)600, (size_t)1460, (size_t)3000}) {
+			std::vector<uint8_t> segment(len);
+			for (auto &byte : segment) byte = gen() % 16;
+			scorer.AddToSession(session, segment.data(), segment.size());
+			histogram.Count(2, segment.data(), segment.size());
+			scorer.Score(session, scores);
+			scorer.Score(histogram, expected);
+			for (size_t type = 0; type < count_types; type++)
+				EXPECT_NEAR(expected[type], scores[type], fabs(expected[type]) * 1e-9 + 1e-9) << len;
+			EXPECT_EQ(scorer.GetBest(histogram), scorer.GetBest(session));
+		}
+		session.Clear();
+		EXPECT_TRUE(session.IsEmpty());
+	}
+}
+
+TEST(CascadeClassifierTests, LearnedCascadeAgreesWithAllTypes) {
+	const size_t count_types = 9; /* the last one is random */
+	std::mt19937 gen(43);
+	/* type i is of bytes from 16 * i to 16 * i + 47 */
+	auto make_window = [&gen](size_t type, size_t len) {
+		std::vector<uint8_t> window(len);
+		for (auto &byte : window) byte = type * 16 + gen() % 48;
+		return window;
+	};
+	std::vector<ptrid::LikelihoodModel> models;
+	std::vector<std::vector<uint32_t>> unigrams;
+	std::vector<std::vector<uint8_t>> samples;
+	for (size_t type = 0; type + 1 < count_types; type++) {
+		samples.push_back(make_window(type, 100000));
+		ptrid::ReaderBytes reader(2), reader_bytes(1);
+		reader.Read(samples.back().data(), samples.back().size());
+		reader_bytes.Read(samples.back().data(), samples.back().size());
+		ptrid::MarkovChain chain(ptrid::ProbabilisticScheme(2, 256, reader.GetFrequencies()));
+		chain.useAdditiveSmoothing(1000);
+		models.emplace_back(chain);
+		unigrams.push_back(reader_bytes.GetFrequencies());
+
+		ptrid::ProbabilisticScheme scheme_bytes(1, 256, reader_bytes.GetFrequencies());
+		uint32_t counts[256];
+		std::copy(reader_bytes.GetFrequencies().begin(), reader_bytes.GetFrequencies().end(), counts);
+		EXPECT_NEAR(ptrid::GetEntropy(scheme_bytes),
+								ptrid::GetEntropyOfBytes(counts, samples.back().size()), 1e-9);
+	}
+	models.emplace_back(ptrid::MarkovChain(ptrid::ProbabilisticScheme(2, 256, std::vector<uint32_t>(256 * 256, 1))));
+	unigrams.emplace_back(256, 1);
+	ptrid::BatchScorer scorer;
+	scorer.Create(models);
+	ptrid::CascadeClassifier cascade;
+	cascade.Create(models, unigrams, count_types - 1);
+
+	/* every type is a candidate until learning */
+	EXPECT_EQ(count_types, cascade.GetCountCandidates());
+	for (size_t i = 0; i < 20; i++) {
+		std::vector<uint8_t> window(ptrid::CascadeClassifier::kSizeWindow);
+		for (auto &byte : window) byte = gen() % 160;
+		EXPECT_EQ(scorer.GetBest(window.data(), window.size()),
+							cascade.GetBest(window.data(), window.size()));
+	}
+
+	for (size_t type = 0; type + 1 < count_types; type++)
+		cascade.Learn(type, samples[type].data(), samples[type].size());
+	/* learning doesn't change the bounds until they are fitted */
+	EXPECT_EQ(count_types, cascade.GetCountCandidates());
+	EXPECT_THROW(cascade.Fit(0.), std::invalid_argument);
+	cascade.Fit();
+	EXPECT_LT(cascade.GetCountCandidates(), count_types);
+	EXPECT_LT(cascade.GetMaxEntropy(), 8.);
+	EXPECT_EQ(0, cascade.GetCountAboveEntropy());
+	EXPECT_EQ(0, cascade.GetCountBeyondCandidates());
+	size_t count_candidates = cascade.GetCountCandidates();
+	double max_entropy = cascade.GetMaxEntropy();
+
+	/* a random window of a type sets the maxima, but not the quantile */
+	std::vector<uint8_t> odd_window(ptrid::CascadeClassifier::kSizeWindow);
+	for (auto &byte : odd_window) byte = gen();
+	cascade.Learn(0, odd_window.data(), odd_window.size());
+	cascade.Fit();
+	EXPECT_GT(cascade.GetMaxEntropy(), max_entropy);
+	cascade.Fit(1. - 1. / cascade.GetCountWindows());
+	EXPECT_LE(cascade.GetMaxEntropy(), max_entropy);
+	EXPECT_LE(cascade.GetCountCandidates(), count_candidates);
+	EXPECT_EQ(1, cascade.GetCountAboveEntropy());
+	EXPECT_LE(cascade.GetCountBeyondCandidates(), 1);
+	for (size_t type = 0; type + 1 < count_types; type++) {
+		std::vector<uint8_t> window = make_window(type, ptrid::CascadeClassifier::kSizeWindow);
+		EXPECT_EQ(type, scorer.GetBest(window.data(), window.size()));
+		EXPECT_EQ(type, cascade.GetBest(window.data(), window.size()));
+	}
+	std::vector<uint8_t> random_window(ptrid::CascadeClassifier::kSizeWindow);
+	for (auto &byte : random_window) byte = gen();
+	EXPECT_EQ(count_types - 1, cascade.GetBest(random_window.data(), random_window.size()));
+}
+
+TEST(TypeAnalyzerTests, AnalyzersAgreeWithScorers) {
+	const size_t count_types = 6;
+	std::mt19937 gen(47);
+	std::vector<ptrid::BasicProbabilisticScheme<double>> schemes;
+	std::vector<ptrid::BasicMarkovChain<double>> chains;
+	for (size_t type = 0; type < count_types; type++) {
+		std::vector<uint32_t> type_frequencies(256 * 256);
+		for (auto &frequency : type_frequencies) frequency = gen() % 100;
+		schemes.emplace_back(2, 256, type_frequencies);
+		schemes.back().useAdditiveSmoothing(1000);
+		chains.emplace_back(ptrid::BasicProbabilisticScheme<double>(2, 256, type_frequencies));
+		chains.back().useAdditiveSmoothing(1000);
+	}
+	std::span<const ptrid::BasicProbabilisticScheme<double>> span_schemes(schemes);
+	std::span<const ptrid::BasicMarkovChain<double>> span_chains(chains);
+	ptrid::MarkovTypeAnalyzer markov(span_chains);
+	ptrid::MarkovTypeAnalyzer markov_early(span_chains);
+	markov_early.SetEarlyExit(100);
+	ptrid::InfoDistTypeAnalyzer info_distance(span_schemes, 1000.);
+	ptrid::ChiSqTypeAnalyzer chi2(span_schemes, 1000.);
+	ptrid::QuantizedTypeAnalyzer quantized(span_chains, ptrid::QuantizedWidth::k16);
+	EXPECT_EQ(count_types, quantized.GetCountTypes());
+
+	ptrid::BatchScorer scorer_info_distance;
+	scorer_info_distance.Create(ptrid::BatchMetric::kInfoDistance, span_schemes, 1000.);
+	ptrid::SessionSample session_markov, session_info_distance, session_chi2, session_quantized;
+	ptrid::TouchedHistogram histogram(256 * 256);
+	for (size_t len : {(size_t)700, (size_t)1460, (size_t)5000}) {
+		std::vector<uint8_t> segment(len);
+		for (auto &byte : segment) byte = gen() % 64;
+		EXPECT_EQ(markov(segment.data(), segment.size()),
+							markov_early(segment.data(), segment.size()));
+		EXPECT_EQ(scorer_info_distance.GetBest(segment.data(), segment.size()),
+							info_distance(segment.data(), segment.size()));
+
+		histogram.Count(2, segment.data(), segment.size());
+		EXPECT_EQ(markov(histogram),
+							markov.AddToSession(session_markov, segment.data(), segment.size()));
+		EXPECT_EQ(info_distance(histogram), info_distance.AddToSession(session_info_distance,
+																																	 segment.data(), segment.size()));
+		EXPECT_EQ(chi2(histogram),
+							chi2.AddToSession(session_chi2, segment.data(), segment.size()));
+		EXPECT_EQ(quantized(histogram),
+							quantized.AddToSession(session_quantized, segment.data(), segment.size()));
+	}
+	EXPECT_EQ(markov_early.GetCountBytes(), 700 + 1460 + 5000);
+	EXPECT_LE(markov_early.GetCountConsumed(), markov_early.GetCountBytes());
+}
+
+TEST(SpscRingTests, ConsumerGetsEverythingInOrder) {
+	EXPECT_THROW(ptrid::SpscRing<int> ring(6), std::invalid_argument);
+
+	const uint64_t count_values = 200000;
+	ptrid::SpscRing<std::vector<uint64_t>> ring(64);
+	std::thread producer([&] {
+		for (uint64_t value = 0; value < count_values;) {
+			std::vector<uint64_t> *slot = ring.BeginPush();
+			if (!slot) {
+				std::this_thread::yield();
+				continue;
+			}
+			slot->assign(value % 4 + 1, value);
+			ring.EndPush();
+			value += 1;
+		}
+	});
+	uint64_t count_wrong = 0;
+	for (uint64_t value = 0; value < count_values;) {
+		std::vector<uint64_t> *slot = ring.Front();
+		if (!slot) {
+			std::this_thread::yield();
+			continue;
+		}
+		count_wrong += *slot != std::vector<uint64_t>(value % 4 + 1, value);
+		ring.Pop();
+		value += 1;
+	}
+	producer.join();
+
+	EXPECT_EQ(0, count_wrong);
+	EXPECT_EQ(0, ring.GetSize());
+	EXPECT_EQ(count_values, ring.GetCountPushed());
+	EXPECT_LE(ring.GetMaxSize(), ring.GetCapacity());
+	EXPECT_EQ(nullptr, ring.Front());
+}
+
+/* counts packets given by the sniffer */
+struct CountingProcessor : ptrid::ProcessorTraffic {
+	uint64_t count_packets = 0;
+	uint64_t count_bytes = 0;
+	uint64_t count_batches = 0;
+
+	void operator()(const struct pcap_pkthdr *packet_header, const u_char *) override {
+		count_packets += 1;
+		count_bytes += packet_header->caplen;
+	}
+
+	void EndBatch() override { count_batches += 1; }
+};
+
+TEST(SnifferTests, ReplaysFile) {
+	CountingProcessor processor;
+	ptrid::Sniffer sniffer(&processor);
+	sniffer.OpenFile("../test/files_for_simple_tests/test_jpg.pcap");
+	sniffer.Replay(false);
+	EXPECT_EQ(69, sniffer.GetCountPackets());
+	EXPECT_EQ(216438, sniffer.GetCountBytes());
+	EXPECT_EQ(69, processor.count_packets);
+	EXPECT_EQ(216438, processor.count_bytes);
+	EXPECT_LE(1, processor.count_batches);
+
+	EXPECT_THROW(sniffer.OpenFile("../test/files_for_simple_tests/absent.pcap"),
+							 std::runtime_error);
+}
+
+/* counts packets which pass the filter of HTTP checkers */
+struct TcpPayloadProcessor : CountingProcessor {
+	std::vector<uint16_t> ports;
+
+	std::string GetFilter() const override { return ptrid::GetTcpPayloadFilter(ports); }
+};
+
+/* 15 of 69 packets of the file are segments with payloads or FIN or RST,
+   11 of them are from port 8000 */
+TEST(SnifferTests, FiltersPackets) {
+	TcpPayloadProcessor processor;
+	processor.ports = {8000};
+	ptrid::Sniffer sniffer(&processor);
+	sniffer.OpenFile("../test/files_for_simple_tests/test_jpg.pcap");
+	sniffer.Replay(false);
+	EXPECT_EQ(15, processor.count_packets);
+
+	TcpPayloadProcessor processor_sources;
+	ptrid::Sniffer sniffer_sources(&processor_sources);
+	ptrid::CaptureSettings settings;
+	settings.filter = "src port 8000";
+	sniffer_sources.SetCaptureSettings(settings);
+	EXPECT_EQ("(" + ptrid::GetTcpPayloadFilter({}) + ") and (src port 8000)",
+						sniffer_sources.GetFilter());
+	sniffer_sources.OpenFile("../test/files_for_simple_tests/test_jpg.pcap");
+	sniffer_sources.Replay(false);
+	EXPECT_EQ(11, processor_sources.count_packets);
+	EXPECT_EQ(11, sniffer_sources.GetCountPackets());
+
+	settings.filter = "src port (";
+	sniffer_sources.SetCaptureSettings(settings);
+	EXPECT_THROW(sniffer_sources.OpenFile("../test/files_for_simple_tests/test_jpg.pcap"),
+							 std::runtime_error);
+}
+
+/* the file has no packets from 0.54 to 3.07 seconds, the replay is
+   stopped inside this gap */
+TEST(SnifferTests, StopsRealtimeReplay) {
+	CountingProcessor processor;
+	ptrid::Sniffer sniffer(&processor);
+	sniffer.OpenFile("../test/files_for_simple_tests/test_jpg.pcap");
+	auto time_start = std::chrono::steady_clock::now();
+	std::thread replaying([&sniffer] { sniffer.Replay(true); });
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+	sniffer.Stop();
+	replaying.join();
+	EXPECT_LT(std::chrono::steady_clock::now() - time_start, std::chrono::seconds(2));
+	EXPECT_EQ(6, processor.count_packets);
+	EXPECT_EQ(processor.count_packets, sniffer.GetCountPackets());
+}
+
 TEST(InfoDistanceTests, DeepOne) {
 	ptrid::ProbabilisticScheme scheme_numerator((uint8_t)1, (size_t)5, std::vector<uint32_t>({3, 5, 2, 0, 0}));
 	ptrid::ProbabilisticScheme scheme_denominator((uint8_t)1, (size_t)5, std::vector<uint32_t>({5, 3, 1, 0, 1}));